@@ -0,0 +1,59 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "hnswlib/hnswlib.h"
+
+using namespace std;
+using namespace hnswlib;
+
+/*
+ * Compares building HierarchicalNSW with addPoint called from ParallelFor and with buildFrom, at 1, 2, 4, ...
+ * threads up to the number of cores. Reports the build time and recall@1 of the vectors themselves.
+ * Usage: bench_build [elements] [dim]
+ */
+
+static double self_recall(HierarchicalNSW<float> &index, const vector<float> &data, size_t n, size_t dim) {
+    size_t step = n / 1000 + 1, found = 0, total = 0;
+    for (size_t i = 0; i < n; i += step, total++) {
+        std::priority_queue<std::pair<float, labeltype>> result = index.searchKnn(data.data() + i * dim, 1);
+        found += !result.empty() && result.top().second == i;
+    }
+    return (double) found / total;
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? atoi(argv[1]) : 200000;
+    size_t dim = argc > 2 ? atoi(argv[2]) : 64;
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    mt19937 rng(42);
+    uniform_real_distribution<float> distrib;
+    vector<float> data(n * dim);
+    for (float &x : data)
+        x = distrib(rng);
+
+    L2Space space(dim);
+    cout << "threads\taddPoint s\tbuildFrom s\tspeedup\trecall addPoint\trecall buildFrom\n";
+    for (size_t threads = 1;; threads = std::min(2 * threads, max_threads)) {
+        HierarchicalNSW<float> by_point(&space, n, 16, 100);
+        auto start = chrono::steady_clock::now();
+        ParallelFor(0, n, threads, [&](size_t i, size_t threadId) {
+            by_point.addPoint(data.data() + i * dim, i);
+        });
+        double point_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        HierarchicalNSW<float> bulk(&space, n, 16, 100);
+        start = chrono::steady_clock::now();
+        bulk.buildFrom(data.data(), nullptr, n, threads);
+        double bulk_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        cout << threads << "\t" << point_seconds << "\t\t" << bulk_seconds << "\t\t" << point_seconds / bulk_seconds
+             << "x\t" << self_recall(by_point, data, n, dim) << "\t\t" << self_recall(bulk, data, n, dim) << "\n";
+        if (threads == max_threads)
+            break;
+    }
+    return 0;
+}
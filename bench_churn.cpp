@@ -0,0 +1,134 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <unordered_set>
+#include "hnswlib/hnswlib.h"
+
+using namespace std;
+using namespace hnswlib;
+
+/*
+ * Steady-state churn: an index of n elements where every round deletes a tenth of the live elements and
+ * inserts as many new ones. Compares keeping the deleted elements as tombstones, the tombstone index after
+ * compact(), reusing the slots (setReplaceDeleted), and an index built from scratch on the final live elements
+ * as the reference. Reports the slots in use, recall@10 against brute force and the search speed.
+ * Usage: bench_churn [elements] [rounds] [queries]
+ */
+
+static const size_t dim = 32;
+static const size_t k = 10;
+
+struct ChurnResult {
+    size_t slots;
+    double seconds;
+    double recall;
+    double qps;
+};
+
+static void measure(HierarchicalNSW<float> &index, const vector<float> &queries, size_t nq,
+                    const vector<unordered_set<labeltype>> &truth, ChurnResult &result) {
+    index.setEf(64);
+    size_t correct = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < nq; i++) {
+        std::priority_queue<std::pair<float, labeltype>> answer = index.searchKnn(queries.data() + i * dim, k);
+        while (!answer.empty()) {
+            correct += truth[i].count(answer.top().second);
+            answer.pop();
+        }
+    }
+    auto end = chrono::steady_clock::now();
+    result.recall = (double) correct / (nq * k);
+    result.qps = nq / chrono::duration<double>(end - start).count();
+    result.slots = index.cur_element_count;
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? atoi(argv[1]) : 100000;
+    size_t rounds = argc > 2 ? atoi(argv[2]) : 10;
+    size_t nq = argc > 3 ? atoi(argv[3]) : 1000;
+    size_t churn = n / 10;
+    size_t total = n + rounds * churn;
+
+    // clustered data, closer to real embeddings than uniform noise
+    mt19937 rng(42);
+    normal_distribution<float> normal;
+    const size_t clusters = 500;
+    vector<float> centers(clusters * dim);
+    for (float &x : centers)
+        x = normal(rng) * 3;
+    vector<float> data(total * dim), queries(nq * dim);
+    for (size_t i = 0; i < total + nq; i++) {
+        float *v = i < total ? data.data() + i * dim : queries.data() + (i - total) * dim;
+        size_t c = rng() % clusters;
+        for (size_t j = 0; j < dim; j++)
+            v[j] = centers[c * dim + j] + normal(rng);
+    }
+
+    // the same deletions for both modes: labels are the rows of data
+    vector<vector<labeltype>> deletions(rounds);
+    vector<labeltype> live(n);
+    for (size_t i = 0; i < n; i++)
+        live[i] = i;
+    for (size_t r = 0; r < rounds; r++) {
+        shuffle(live.begin(), live.end(), rng);
+        deletions[r].assign(live.end() - churn, live.end());
+        live.resize(n - churn);
+        for (size_t i = 0; i < churn; i++)
+            live.push_back(n + r * churn + i);
+    }
+
+    L2Space space(dim);
+    vector<unordered_set<labeltype>> truth(nq);
+    for (size_t i = 0; i < nq; i++) {
+        vector<pair<float, labeltype>> distances;
+        distances.reserve(live.size());
+        for (labeltype label : live)
+            distances.emplace_back(L2Sqr(queries.data() + i * dim, data.data() + label * dim, space.get_dist_func_param()), label);
+        partial_sort(distances.begin(), distances.begin() + k, distances.end());
+        for (size_t j = 0; j < k; j++)
+            truth[i].insert(distances[j].second);
+    }
+
+    cout << "mode\t\tslots\ttime s\trecall@10\tQPS\n";
+    for (int replace = 0; replace < 2; replace++) {
+        HierarchicalNSW<float> index(&space, replace ? n : total, 16, 100);
+        index.setReplaceDeleted(replace != 0);
+        ParallelFor(0, n, 0, [&](size_t i, size_t threadId) {
+            index.addPoint(data.data() + i * dim, i);
+        });
+        auto start = chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; r++) {
+            for (labeltype label : deletions[r])
+                index.markDelete(label);
+            ParallelFor(n + r * churn, n + (r + 1) * churn, 0, [&](size_t i, size_t threadId) {
+                index.addPoint(data.data() + i * dim, i);
+            });
+        }
+        ChurnResult result;
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        measure(index, queries, nq, truth, result);
+        cout << (replace ? "reuse slots" : "tombstones") << "\t" << result.slots << "\t" << result.seconds << "\t"
+             << result.recall << "\t\t" << result.qps << "\n";
+
+        if (!replace) {
+            start = chrono::steady_clock::now();
+            index.compact();
+            result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            measure(index, queries, nq, truth, result);
+            cout << "compacted\t" << result.slots << "\t" << result.seconds << "\t" << result.recall << "\t\t"
+                 << result.qps << "\n";
+        }
+    }
+
+    HierarchicalNSW<float> rebuilt(&space, n, 16, 100);
+    ParallelFor(0, live.size(), 0, [&](size_t i, size_t threadId) {
+        rebuilt.addPoint(data.data() + live[i] * dim, live[i]);
+    });
+    ChurnResult result;
+    measure(rebuilt, queries, nq, truth, result);
+    cout << "rebuilt\t\t" << result.slots << "\t-\t" << result.recall << "\t\t" << result.qps << "\n";
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "hnswlib/hnswlib.h"
+
+using namespace std;
+using namespace hnswlib;
+
+/*
+ * Compares the uint8 squared L2 kernels of L2SpaceI on 128-d vectors, the dimension of SIFT
+ * and of the sift_1b.cpp benchmark. Every kernel the host supports is timed against the same
+ * set of vectors and checked against the scalar result.
+ */
+
+static double measure_ns_per_call(DISTFUNC<int> fn, const vector<unsigned char> &data, size_t n, size_t dim,
+                                  size_t rounds, long long &checksum) {
+    long long sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++) {
+        const unsigned char *query = data.data() + (r % n) * dim;
+        for (size_t i = 0; i < n; i++)
+            sum += fn(query, data.data() + i * dim, &dim);
+    }
+    auto end = chrono::steady_clock::now();
+    checksum = sum;
+    return chrono::duration_cast<chrono::nanoseconds>(end - start).count() / (double) (rounds * n);
+}
+
+int main() {
+    const size_t dim = 128;
+    // 1 MB of vectors, stays in L2 so the kernels rather than memory are measured
+    const size_t n = 8192;
+    const size_t rounds = 200;
+
+    vector<unsigned char> data(n * dim);
+    mt19937 rng(42);
+    for (unsigned char &x : data)
+        x = rng() % 256;
+
+    vector<pair<string, DISTFUNC<int>>> kernels;
+    kernels.push_back(make_pair(string("scalar"), (DISTFUNC<int>) L2SqrI));
+#if defined(USE_SSE) && defined(__SSE2__)
+    kernels.push_back(make_pair(string("sse2"), (DISTFUNC<int>) L2SqrISSE));
+#endif
+#if defined(USE_RUNTIME_DISPATCH)
+    const CpuFeatures &cpu = getCpuFeatures();
+    if (cpu.avx2)
+        kernels.push_back(make_pair(string("avx2"), (DISTFUNC<int>) L2SqrIAVX2));
+    if (cpu.avx512bw)
+        kernels.push_back(make_pair(string("avx512bw"), (DISTFUNC<int>) L2SqrIAVX512));
+    if (cpu.avx512bw && cpu.avx512vnni)
+        kernels.push_back(make_pair(string("avx512vnni"), (DISTFUNC<int>) L2SqrIVNNI));
+#endif
+    L2SpaceI space(dim);
+    kernels.push_back(make_pair(string("L2SpaceI"), space.get_dist_func()));
+
+    cout << "kernel\tns/distance\tspeedup\n";
+    double scalar_ns = 0;
+    long long scalar_checksum = 0;
+    for (size_t k = 0; k < kernels.size(); k++) {
+        long long checksum;
+        double ns = measure_ns_per_call(kernels[k].second, data, n, dim, rounds, checksum);
+        if (k == 0) {
+            scalar_ns = ns;
+            scalar_checksum = checksum;
+        } else if (checksum != scalar_checksum) {
+            cout << kernels[k].first << " returned different distances\n";
+            return 1;
+        }
+        cout << kernels[k].first << "\t" << ns << "\t\t" << scalar_ns / ns << "x\n";
+    }
+    return 0;
+}
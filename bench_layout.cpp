@@ -0,0 +1,85 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "hnswlib/hnswlib.h"
+
+using namespace std;
+using namespace hnswlib;
+
+/*
+ * Compares the search speed of HierarchicalNSW with level 0 interleaved (one record of links, vector
+ * and label per element) and split into three arrays (setSplitLayout) at several dimensions. The
+ * same graph is searched in both layouts, alternating, and the median of the rounds is reported.
+ * Usage: bench_layout [elements] [queries]
+ */
+
+static double measure_qps(HierarchicalNSW<float> &index, const vector<float> &queries, size_t nq, size_t dim,
+                          size_t &checksum) {
+    size_t sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < nq; i++) {
+        std::priority_queue<std::pair<float, labeltype>> result = index.searchKnn(queries.data() + i * dim, 10);
+        while (!result.empty()) {
+            sum += result.top().second;
+            result.pop();
+        }
+    }
+    auto end = chrono::steady_clock::now();
+    checksum = sum;
+    return nq / chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? atoi(argv[1]) : 200000;
+    size_t nq = argc > 2 ? atoi(argv[2]) : 5000;
+    const size_t rounds = 5;
+    const size_t efs[] = {50, 200};
+
+    cout << "dim\tef\tQPS interleaved\tQPS split\tspeedup\n";
+    for (size_t dim : {16, 128, 512}) {
+        // clustered data, closer to real embeddings than uniform noise
+        mt19937 rng(42);
+        normal_distribution<float> normal;
+        const size_t clusters = 1000;
+        vector<float> centers(clusters * dim);
+        for (float &x : centers)
+            x = normal(rng) * 3;
+        vector<float> data(n * dim), queries(nq * dim);
+        for (size_t i = 0; i < n + nq; i++) {
+            float *v = i < n ? data.data() + i * dim : queries.data() + (i - n) * dim;
+            size_t c = rng() % clusters;
+            for (size_t j = 0; j < dim; j++)
+                v[j] = centers[c * dim + j] + normal(rng);
+        }
+
+        L2Space space(dim);
+        HierarchicalNSW<float> index(&space, n, 16, 100);
+        ParallelFor(0, n, 0, [&](size_t i, size_t threadId) {
+            index.addPoint(data.data() + i * dim, i);
+        });
+
+        for (size_t ef : efs) {
+            index.setEf(ef);
+            vector<double> qps_interleaved, qps_split;
+            for (size_t r = 0; r < rounds; r++) {
+                size_t checksum_interleaved, checksum_split;
+                index.setSplitLayout(false);
+                qps_interleaved.push_back(measure_qps(index, queries, nq, dim, checksum_interleaved));
+                index.setSplitLayout(true);
+                qps_split.push_back(measure_qps(index, queries, nq, dim, checksum_split));
+                if (checksum_interleaved != checksum_split) {
+                    cout << "the layouts returned different results\n";
+                    return 1;
+                }
+            }
+            sort(qps_interleaved.begin(), qps_interleaved.end());
+            sort(qps_split.begin(), qps_split.end());
+            double interleaved = qps_interleaved[rounds / 2];
+            double split = qps_split[rounds / 2];
+            cout << dim << "\t" << ef << "\t" << interleaved << "\t\t" << split << "\t\t" << split / interleaved << "x\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <vector>
+#include "hnswlib/hnswlib.h"
+
+using namespace std;
+using namespace hnswlib;
+
+/*
+ * Measures the cost of taking a visited list from the pool and giving it back, the way every
+ * search and every insert does, as the number of concurrent threads grows.
+ * The mutex-guarded deque the pool used before is kept here as the reference point.
+ */
+
+class MutexVisitedListPool {
+    std::deque<VisitedList *> pool;
+    std::mutex poolguard;
+    int numelements;
+
+public:
+    MutexVisitedListPool(int initmaxpools, int numelements1) {
+        numelements = numelements1;
+        for (int i = 0; i < initmaxpools; i++)
+            pool.push_front(new VisitedList(numelements));
+    }
+
+    VisitedList *getFreeVisitedList() {
+        VisitedList *rez;
+        {
+            std::unique_lock <std::mutex> lock(poolguard);
+            if (pool.size() > 0) {
+                rez = pool.front();
+                pool.pop_front();
+            } else {
+                rez = new VisitedList(numelements);
+            }
+        }
+        rez->reset();
+        return rez;
+    };
+
+    void releaseVisitedList(VisitedList *vl) {
+        std::unique_lock <std::mutex> lock(poolguard);
+        pool.push_front(vl);
+    };
+
+    ~MutexVisitedListPool() {
+        while (pool.size()) {
+            VisitedList *rez = pool.front();
+            pool.pop_front();
+            delete rez;
+        }
+    };
+};
+
+template<typename Pool>
+static double measure_ns_per_op(size_t num_threads, size_t ops_per_thread) {
+    const int numelements = 100000;
+    Pool pool(1, numelements);
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&, t] {
+            size_t id = t;
+            for (size_t i = 0; i < ops_per_thread; i++) {
+                VisitedList *vl = pool.getFreeVisitedList();
+                // a few visits, as a very short search would do
+                for (int j = 0; j < 8; j++) {
+                    id = (id * 2654435761u + 1) % numelements;
+                    vl->mass[id] = vl->curV;
+                }
+                pool.releaseVisitedList(vl);
+            }
+        }));
+    }
+    for (auto &thread : threads)
+        thread.join();
+    auto end = std::chrono::steady_clock::now();
+
+    double total_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    // wall time per operation and thread: flat means the pool scales
+    return total_ns / ops_per_thread;
+}
+
+int main() {
+    const size_t ops_per_thread = 200000;
+    cout << "threads\tmutex pool ns/op\tthread-slot pool ns/op\n";
+    for (size_t num_threads = 1; num_threads <= 64; num_threads *= 2) {
+        double mutex_ns = measure_ns_per_op<MutexVisitedListPool>(num_threads, ops_per_thread);
+        double slot_ns = measure_ns_per_op<VisitedListPool>(num_threads, ops_per_thread);
+        cout << num_threads << "\t" << mutex_ns << "\t\t\t" << slot_ns << "\n";
+    }
+    return 0;
+}
@@ -3,35 +3,42 @@
 #include <fstream>
 #include <mutex>
 #include <algorithm>
+#include "huge_pages.h"
 
 namespace hnswlib {
     template<typename dist_t>
     class BruteforceSearch : public AlgorithmInterface<dist_t> {
     public:
         BruteforceSearch(SpaceInterface <dist_t> *s) {
-
+            data_ = nullptr;
+            huge_pages_ = false;
         }
-        BruteforceSearch(SpaceInterface<dist_t> *s, const std::string &location) {
+        BruteforceSearch(SpaceInterface<dist_t> *s, const std::string &location, bool huge_pages = false) {
+            huge_pages_ = huge_pages;
             loadIndex(location, s);
         }
 
-        BruteforceSearch(SpaceInterface <dist_t> *s, size_t maxElements) {
+        // huge_pages backs the data with huge pages where available, see huge_pages.h
+        BruteforceSearch(SpaceInterface <dist_t> *s, size_t maxElements, bool huge_pages = false) {
             maxelements_ = maxElements;
+            huge_pages_ = huge_pages;
+            space_ = s;
             data_size_ = s->get_data_size();
             fstdistfunc_ = s->get_dist_func();
             dist_func_param_ = s->get_dist_func_param();
             size_per_element_ = data_size_ + sizeof(labeltype);
-            data_ = (char *) malloc(maxElements * size_per_element_);
+            data_ = (char *) allocateLarge(maxElements * size_per_element_, huge_pages_);
             if (data_ == nullptr)
                 std::runtime_error("Not enough memory: BruteforceSearch failed to allocate data");
             cur_element_count = 0;
         }
 
         ~BruteforceSearch() {
-            free(data_);
+            freeLarge(data_);
         }
 
         char *data_;
+        bool huge_pages_;
         size_t maxelements_;
         size_t cur_element_count;
         size_t size_per_element_;
@@ -39,6 +46,7 @@ namespace hnswlib {
         size_t data_size_;
         DISTFUNC <dist_t> fstdistfunc_;
         void *dist_func_param_;
+        SpaceInterface<dist_t> *space_;
         std::mutex index_lock;
 
         std::unordered_map<labeltype,size_t > dict_external_to_internal;
@@ -65,7 +73,10 @@ namespace hnswlib {
                 }
             }
             memcpy(data_ + size_per_element_ * idx + data_size_, &label, sizeof(labeltype));
-            memcpy(data_ + size_per_element_ * idx, datapoint, data_size_);
+            if (space_->has_encoder())
+                space_->encode(datapoint, data_ + size_per_element_ * idx);
+            else
+                memcpy(data_ + size_per_element_ * idx, datapoint, data_size_);
 
 
 
@@ -91,14 +102,22 @@ namespace hnswlib {
         searchKnn(const void *query_data, size_t k) const {
             std::priority_queue<std::pair<dist_t, labeltype >> topResults;
             if (cur_element_count == 0) return topResults;
+            DISTFUNC<dist_t> distfunc = fstdistfunc_;
+            std::vector<char> query_buffer;
+            if (space_->has_encoder()) {
+                query_buffer.resize(space_->get_query_size());
+                space_->encode_query(query_data, query_buffer.data());
+                query_data = query_buffer.data();
+                distfunc = space_->get_query_dist_func();
+            }
             for (int i = 0; i < k; i++) {
-                dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
+                dist_t dist = distfunc(query_data, data_ + size_per_element_ * i, dist_func_param_);
                 topResults.push(std::pair<dist_t, labeltype>(dist, *((labeltype *) (data_ + size_per_element_ * i +
                                                                                     data_size_))));
             }
             dist_t lastdist = topResults.top().first;
             for (int i = k; i < cur_element_count; i++) {
-                dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
+                dist_t dist = distfunc(query_data, data_ + size_per_element_ * i, dist_func_param_);
                 if (dist <= lastdist) {
                     topResults.push(std::pair<dist_t, labeltype>(dist, *((labeltype *) (data_ + size_per_element_ * i +
                                                                                         data_size_))));
@@ -152,11 +171,12 @@ namespace hnswlib {
             readBinaryPOD(input, size_per_element_);
             readBinaryPOD(input, cur_element_count);
 
+            space_ = s;
             data_size_ = s->get_data_size();
             fstdistfunc_ = s->get_dist_func();
             dist_func_param_ = s->get_dist_func_param();
             size_per_element_ = data_size_ + sizeof(labeltype);
-            data_ = (char *) malloc(maxelements_ * size_per_element_);
+            data_ = (char *) allocateLarge(maxelements_ * size_per_element_, huge_pages_);
             if (data_ == nullptr)
                 std::runtime_error("Not enough memory: loadIndex failed to allocate data");
 
@@ -0,0 +1,101 @@
+#pragma once
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace hnswlib {
+///////////////////////////////////////////////////////////
+//
+// Instruction set extensions of the host CPU, detected once at
+// runtime. The AVX2 and AVX-512 distance kernels are compiled
+// for their target with PORTABLE_TARGET independently of the
+// compiler flags and picked by the spaces when the host has them,
+// so one build runs everywhere and still uses the widest units.
+//
+/////////////////////////////////////////////////////////
+
+    struct CpuFeatures {
+        bool avx2;
+        bool fma;
+        bool avx512f;
+        bool avx512bw;
+        bool avx512vnni;
+        bool f16c;
+        bool avx512bf16;
+    };
+
+#if defined(USE_RUNTIME_DISPATCH)
+    static void cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuidex(info, leaf, subleaf);
+        for (int i = 0; i < 4; i++)
+            regs[i] = (unsigned int) info[i];
+#else
+        __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    // register state the operating system saves on context switches
+    static unsigned long long xgetbv0() {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        unsigned int eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return ((unsigned long long) edx << 32) | eax;
+#endif
+    }
+
+    static CpuFeatures detectCpuFeatures() {
+        CpuFeatures features = {false, false, false, false, false, false, false};
+        unsigned int regs[4];
+        cpuid(0, 0, regs);
+        unsigned int max_leaf = regs[0];
+        if (max_leaf < 1)
+            return features;
+
+        cpuid(1, 0, regs);
+        bool osxsave = (regs[2] >> 27) & 1;
+        bool avx = (regs[2] >> 28) & 1;
+        if (!osxsave || !avx)
+            return features;
+        unsigned long long xcr0 = xgetbv0();
+        // xmm and ymm state
+        if ((xcr0 & 0x6) != 0x6)
+            return features;
+        features.fma = (regs[2] >> 12) & 1;
+        features.f16c = (regs[2] >> 29) & 1;
+
+        if (max_leaf < 7)
+            return features;
+        cpuid(7, 0, regs);
+        features.avx2 = (regs[1] >> 5) & 1;
+        // opmask and zmm state
+        if ((xcr0 & 0xe0) == 0xe0) {
+            features.avx512f = (regs[1] >> 16) & 1;
+            features.avx512bw = features.avx512f && ((regs[1] >> 30) & 1);
+            features.avx512vnni = features.avx512f && ((regs[2] >> 11) & 1);
+            // sub-leaf 1 is there when sub-leaf 0 reports it in eax
+            if (features.avx512f && regs[0] >= 1) {
+                cpuid(7, 1, regs);
+                features.avx512bf16 = (regs[0] >> 5) & 1;
+            }
+        }
+        return features;
+    }
+#else
+    static CpuFeatures detectCpuFeatures() {
+        CpuFeatures features = {false, false, false, false, false, false, false};
+        return features;
+    }
+#endif
+
+    static const CpuFeatures &getCpuFeatures() {
+        static const CpuFeatures features = detectCpuFeatures();
+        return features;
+    }
+}
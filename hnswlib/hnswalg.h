@@ -1,10 +1,19 @@
 #pragma once
 
 #include "visited_list_pool.h"
+#include "mapped_file.h"
+#include "huge_pages.h"
+#include "link_list_arena.h"
+#include "label_map.h"
+#include "index_format.h"
+#include "parallel.h"
 #include "hnswlib.h"
 #include <random>
-#include <stdlib.h>
+#include <numeric>
+#include <algorithm>
+#include <functional>
 #include <unordered_set>
+#include <stdlib.h>
 #include <list>
 
 
@@ -12,26 +21,90 @@ namespace hnswlib {
     typedef unsigned int tableint;
     typedef unsigned int linklistsizeint;
 
-    template<typename dist_t>
+    // orderings of the internal ids for HierarchicalNSW::reorder
+    enum ReorderMethod {
+        // breadth-first from the enterpoint over the level 0 graph
+        REORDER_BFS,
+        // reverse Cuthill-McKee: breadth-first from low degree elements, neighbors by increasing degree
+        REORDER_RCM
+    };
+
+    /*
+     * Relaxed atomic access to the words of the link lists: searches read them without locks while inserts
+     * change them, see HierarchicalNSW::readLinkList.
+     */
+    template<typename T>
+    static inline T loadRelaxed(const T *ptr) {
+#if defined(_MSC_VER)
+        return *(const volatile T *) ptr;
+#else
+        return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+#endif
+    }
+
+    template<typename T>
+    static inline void storeRelaxed(T *ptr, T value) {
+#if defined(_MSC_VER)
+        *(volatile T *) ptr = value;
+#else
+        __atomic_store_n(ptr, value, __ATOMIC_RELAXED);
+#endif
+    }
+
+    /*
+     * StaticDistance optionally names a type with a static distance() that computes the distance of the space,
+     * e.g. L2SqrStatic<128> for L2Space(128); the search loops then call it directly instead of through
+     * fstdistfunc_. It has to match the space and the space must not have an encoder.
+     */
+    template<typename dist_t, typename StaticDistance = void>
     class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     public:
 
         HierarchicalNSW(SpaceInterface<dist_t> *s) {
-
+            mapped_file_ = nullptr;
+            huge_pages_ = false;
+            split_layout_ = false;
+            replace_deleted_ = false;
+            rerank_vectors_ = nullptr;
+            rerank_k_ = 0;
+            visited_set_type_ = VISITED_LIST;
+            visited_list_pool_ = nullptr;
+            visited_hash_pool_ = nullptr;
         }
 
-        HierarchicalNSW(SpaceInterface<dist_t> *s, const std::string &location, bool nmslib = false, size_t max_elements=0) {
-            loadIndex(location, s, max_elements);
+        HierarchicalNSW(SpaceInterface<dist_t> *s, const std::string &location, bool nmslib = false, size_t max_elements=0,
+                        bool use_mmap = false, size_t num_threads = 1, bool huge_pages = false) {
+            mapped_file_ = nullptr;
+            huge_pages_ = huge_pages;
+            link_list_arena_.setHugePages(huge_pages);
+            split_layout_ = false;
+            replace_deleted_ = false;
+            rerank_vectors_ = nullptr;
+            rerank_k_ = 0;
+            visited_set_type_ = VISITED_LIST;
+            if (use_mmap)
+                loadIndexMmap(location, s);
+            else
+                loadIndex(location, s, max_elements, num_threads);
         }
 
-        HierarchicalNSW(SpaceInterface<dist_t> *s, size_t max_elements, size_t M = 16, size_t ef_construction = 200, size_t random_seed = 100) :
-                link_list_locks_(max_elements), element_levels_(max_elements) {
+        /**
+         * With huge_pages the level 0 memory, the link list table and the visited lists are backed by huge pages
+         * where the system provides them (see huge_pages.h and getPageBacking).
+         */
+        HierarchicalNSW(SpaceInterface<dist_t> *s, size_t max_elements, size_t M = 16, size_t ef_construction = 200, size_t random_seed = 100,
+                        bool huge_pages = false) :
+                link_list_locks_(max_elements), link_list_versions_(max_elements), element_levels_(max_elements) {
             max_elements_ = max_elements;
+            huge_pages_ = huge_pages;
+            link_list_arena_.setHugePages(huge_pages);
+            split_layout_ = false;
 
             has_deletions_=false;
-            data_size_ = s->get_data_size();
-            fstdistfunc_ = s->get_dist_func();
-            dist_func_param_ = s->get_dist_func_param();
+            replace_deleted_ = false;
+            setSpace(s);
+            rerank_vectors_ = nullptr;
+            rerank_k_ = 0;
             M_ = M;
             maxM_ = M_;
             maxM0_ = M_ * 2;
@@ -46,13 +119,16 @@ namespace hnswlib {
             label_offset_ = size_links_level0_ + data_size_;
             offsetLevel0_ = 0;
 
-            data_level0_memory_ = (char *) malloc(max_elements_ * size_data_per_element_);
+            data_level0_memory_ = (char *) allocateLarge(max_elements_ * size_data_per_element_, huge_pages_);
             if (data_level0_memory_ == nullptr)
                 throw std::runtime_error("Not enough memory");
+            level0_ = level0Layout(data_level0_memory_, max_elements_, false);
+            mapped_file_ = nullptr;
 
             cur_element_count = 0;
 
-            visited_list_pool_ = new VisitedListPool(1, max_elements);
+            visited_set_type_ = VISITED_LIST;
+            createVisitedListPools(max_elements);
 
 
 
@@ -60,7 +136,7 @@ namespace hnswlib {
             enterpoint_node_ = -1;
             maxlevel_ = -1;
 
-            linkLists_ = (char **) malloc(sizeof(void *) * max_elements_);
+            linkLists_ = (char **) allocateLarge(sizeof(void *) * max_elements_, huge_pages_);
             if (linkLists_ == nullptr)
                 throw std::runtime_error("Not enough memory: HierarchicalNSW failed to allocate linklists");
             size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
@@ -76,18 +152,19 @@ namespace hnswlib {
         };
 
         ~HierarchicalNSW() {
-
-            free(data_level0_memory_);
-            for (tableint i = 0; i < cur_element_count; i++) {
-                if (element_levels_[i] > 0)
-                    free(linkLists_[i]);
+            if (mapped_file_ == nullptr) {
+                freeLarge(data_level0_memory_);
+            } else {
+                // level 0 and the upper layers point into the mapping
+                delete mapped_file_;
             }
-            free(linkLists_);
+            freeLarge(linkLists_);
             delete visited_list_pool_;
+            delete visited_hash_pool_;
         }
 
         size_t max_elements_;
-        size_t cur_element_count;
+        std::atomic<size_t> cur_element_count;
         size_t size_data_per_element_;
         size_t size_links_per_element_;
 
@@ -97,14 +174,20 @@ namespace hnswlib {
         size_t ef_construction_;
 
         double mult_, revSize_;
-        int maxlevel_;
+        // searches read the entry point without locks: inserts store enterpoint_node_ before maxlevel_
+        std::atomic<int> maxlevel_;
 
 
+        VisitedSetType visited_set_type_;
         VisitedListPool *visited_list_pool_;
+        VisitedHashSetPool *visited_hash_pool_;
+        // held with replace_deleted_ while slots and labels change, it guards deleted_elements_
         std::mutex cur_element_count_guard_;
 
         std::vector<std::mutex> link_list_locks_;
-        tableint enterpoint_node_;
+        // seqlock of the link lists of every element, odd while a writer changes them
+        std::vector<std::atomic<unsigned int>> link_list_versions_;
+        std::atomic<tableint> enterpoint_node_;
 
 
         size_t size_links_level0_;
@@ -112,57 +195,259 @@ namespace hnswlib {
 
 
         char *data_level0_memory_;
+
+        /*
+         * Where level 0 keeps the links, the vector and the label of an element: at base + id * stride of
+         * one record per element (interleaved, the file format), or of three arrays (split, see setSplitLayout).
+         */
+        struct Level0Layout {
+            char *links;
+            char *data;
+            char *labels;
+            size_t links_stride;
+            size_t data_stride;
+            size_t labels_stride;
+        };
+        Level0Layout level0_;
+        bool split_layout_;
+
         char **linkLists_;
+        // owns the upper-layer link lists that linkLists_ points to (unless the index is mapped)
+        LinkListArena link_list_arena_;
         std::vector<int> element_levels_;
 
-        size_t data_size_;
+        // non-null when the index is served read-only straight from a memory-mapped file
+        MappedFile *mapped_file_;
+        // allocate the large arrays with huge pages, see allocateLarge
+        bool huge_pages_;
 
-        bool has_deletions_;
+        size_t data_size_;
 
+        std::atomic<bool> has_deletions_;
+        // with replace_deleted_ inserts take the slots of deleted elements, kept here (see setReplaceDeleted)
+        bool replace_deleted_;
+        std::vector<tableint> deleted_elements_;
 
         size_t label_offset_;
         DISTFUNC<dist_t> fstdistfunc_;
         void *dist_func_param_;
-        std::unordered_map<labeltype, tableint> label_lookup_;
+
+        // spaces with an encoder store data_size_ byte codes of input_size_ byte vectors,
+        // queries are encoded into query_size_ bytes and compared with query_dist_func_
+        SpaceInterface<dist_t> *space_;
+        bool has_encoder_;
+        size_t input_size_;
+        size_t query_size_;
+        DISTFUNC<dist_t> query_dist_func_;
+        BATCHDISTFUNC<dist_t> batch_dist_func_;
+        BATCHDISTFUNC<dist_t> query_batch_dist_func_;
+
+        // original vectors indexed by label for the exact re-rank, see setRerank
+        const char *rerank_vectors_;
+        size_t rerank_k_;
+        DISTFUNC<dist_t> input_dist_func_;
+        void *input_dist_func_param_;
+        LabelMap<labeltype, tableint> label_lookup_;
 
         std::default_random_engine level_generator_;
+        std::mutex level_generator_guard_;
+
+        void setSpace(SpaceInterface<dist_t> *s) {
+            DistanceCall<dist_t, StaticDistance>::checkSpace(s);
+            space_ = s;
+            data_size_ = s->get_data_size();
+            fstdistfunc_ = s->get_dist_func();
+            dist_func_param_ = s->get_dist_func_param();
+            has_encoder_ = s->has_encoder();
+            input_size_ = s->get_input_size();
+            query_size_ = s->get_query_size();
+            query_dist_func_ = s->get_query_dist_func();
+            batch_dist_func_ = s->get_batch_dist_func();
+            query_batch_dist_func_ = s->get_query_batch_dist_func();
+            input_dist_func_ = s->get_input_dist_func();
+            input_dist_func_param_ = s->get_input_dist_func_param();
+        }
+
+        // distance between two elements of the index
+        inline dist_t elementDistance(const void *data1, const void *data2) const {
+            return DistanceCall<dist_t, StaticDistance>::call(fstdistfunc_, data1, data2, dist_func_param_);
+        }
+
+        // distance between a query returned by encodeQuery and an element of the index
+        inline dist_t queryDistance(const void *query, const void *data) const {
+            return DistanceCall<dist_t, StaticDistance>::call(query_dist_func_, query, data, dist_func_param_);
+        }
+
+        // distances of an element (or a vector being inserted) to n elements of the index
+        inline void elementDistances(const void *data, const void *const *vectors, size_t n, dist_t *dists) const {
+            DistanceCall<dist_t, StaticDistance>::callBatch(batch_dist_func_, fstdistfunc_, data, vectors, n, dists,
+                                                            dist_func_param_);
+        }
+
+        // distances of a query returned by encodeQuery to n elements of the index
+        inline void queryDistances(const void *query, const void *const *vectors, size_t n, dist_t *dists) const {
+            DistanceCall<dist_t, StaticDistance>::callBatch(query_batch_dist_func_, query_dist_func_, query, vectors, n,
+                                                            dists, dist_func_param_);
+        }
+
+        // returns the query in the form query_dist_func_ expects, buffer holds it if it has to be encoded
+        const void *encodeQuery(const void *query_data, std::vector<char> &buffer) const {
+            if (!has_encoder_)
+                return query_data;
+            buffer.resize(query_size_);
+            space_->encode_query(query_data, buffer.data());
+            return buffer.data();
+        }
+
+        // turns the top_candidates heap of a search into its k best results, closest first
+        void sortCandidates(const void *query_data, std::vector<std::pair<dist_t, tableint>> &top_candidates, size_t k) const {
+            if (rerank_vectors_ != nullptr) {
+                rerankCandidates(query_data, top_candidates, k);
+                return;
+            }
+            while (top_candidates.size() > k) {
+                std::pop_heap(top_candidates.begin(), top_candidates.end(), CompareByFirst());
+                top_candidates.pop_back();
+            }
+            std::sort_heap(top_candidates.begin(), top_candidates.end(), CompareByFirst());
+        }
+
+        /**
+         * Re-ranks the results of spaces that store approximations of the vectors (e.g. L2SpaceSQ8): searches
+         * collect max(k, rerank_k) candidates and order them by the exact distance between the query and
+         * vectors + label * (input vector size). vectors has to hold the original vector of every label in
+         * the index, e.g. in a memory-mapped file, and outlive the index. nullptr turns re-ranking off.
+         */
+        void setRerank(const void *vectors, size_t rerank_k = 0) {
+            rerank_vectors_ = (const char *) vectors;
+            rerank_k_ = rerank_k;
+        }
+
+        size_t searchEf(size_t k) const {
+            if (rerank_vectors_ != nullptr)
+                k = std::max(k, rerank_k_);
+            return std::max(ef_, k);
+        }
+
+        // replaces the distances of the candidates with exact ones and keeps the k closest, closest first
+        void rerankCandidates(const void *query_data, std::vector<std::pair<dist_t, tableint>> &candidates, size_t k) const {
+            for (std::pair<dist_t, tableint> &candidate : candidates) {
+                const char *vector = rerank_vectors_ + getExternalLabel(candidate.second) * input_size_;
+                candidate.first = input_dist_func_(query_data, vector, input_dist_func_param_);
+            }
+            std::sort(candidates.begin(), candidates.end(), CompareByFirst());
+            if (candidates.size() > k)
+                candidates.resize(k);
+        }
 
         inline labeltype getExternalLabel(tableint internal_id) const {
             labeltype return_label;
-            memcpy(&return_label,(data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), sizeof(labeltype));
+            memcpy(&return_label, level0_.labels + internal_id * level0_.labels_stride, sizeof(labeltype));
             return return_label;
         }
 
         inline void setExternalLabel(tableint internal_id, labeltype label) const {
-            memcpy((data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), &label, sizeof(labeltype));
+            memcpy(level0_.labels + internal_id * level0_.labels_stride, &label, sizeof(labeltype));
         }
 
         inline labeltype *getExternalLabeLp(tableint internal_id) const {
-            return (labeltype *) (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_);
+            return (labeltype *) (level0_.labels + internal_id * level0_.labels_stride);
         }
 
         inline char *getDataByInternalId(tableint internal_id) const {
-            return (data_level0_memory_ + internal_id * size_data_per_element_ + offsetData_);
+            return (level0_.data + internal_id * level0_.data_stride);
         }
 
         int getRandomLevel(double reverse_size) {
+            // the generator is shared by the inserting threads
+            std::unique_lock <std::mutex> lock(level_generator_guard_);
             std::uniform_real_distribution<double> distribution(0.0, 1.0);
             double r = -log(distribution(level_generator_)) * reverse_size;
             return (int) r;
         }
 
+        void createVisitedListPools(size_t max_elements) {
+            // only the pool in use keeps a list ready, an unused VisitedListPool costs no memory
+            visited_list_pool_ = new VisitedListPool(visited_set_type_ == VISITED_LIST ? 1 : 0, max_elements, huge_pages_);
+            visited_hash_pool_ = new VisitedHashSetPool(0, max_elements, huge_pages_);
+        }
+
+        /**
+         * Selects how searches and inserts remember visited elements. VISITED_LIST costs max_elements * 2 bytes
+         * per concurrent search, VISITED_HASH_SET grows with the number of elements a search touches and pays
+         * with slower lookups; it is meant for indexes too large to keep a full list per thread.
+         * Must not be called while searches or inserts are running.
+         */
+        void setVisitedSetType(VisitedSetType type) {
+            visited_set_type_ = type;
+            delete visited_list_pool_;
+            delete visited_hash_pool_;
+            createVisitedListPools(max_elements_);
+        }
+
+        VisitedSetType getVisitedSetType() const {
+            return visited_set_type_;
+        }
+
+        // a copy of a link list and the unvisited neighbors of a node, their vectors and distances
+        struct SearchBuffers {
+            tableint *links;
+            tableint *batch_ids;
+            const void **batch_data;
+            dist_t *batch_dists;
+        };
+
+        // the buffers live in the scratch memory of the pooled visited set, searches do not allocate them
+        template <typename VisitedT>
+        SearchBuffers searchBuffersOf(VisitedT *vl) const {
+            size_t bytes = maxM0_ * (sizeof(const void *) + sizeof(dist_t) + 2 * sizeof(tableint));
+            if (vl->scratch.size() < bytes)
+                vl->scratch.resize(bytes);
+            char *scratch = vl->scratch.data();
+            SearchBuffers buffers;
+            buffers.batch_data = (const void **) scratch;
+            buffers.batch_dists = (dist_t *) (scratch + maxM0_ * sizeof(const void *));
+            buffers.batch_ids = (tableint *) (scratch + maxM0_ * (sizeof(const void *) + sizeof(dist_t)));
+            buffers.links = buffers.batch_ids + maxM0_;
+            return buffers;
+        }
+
+        /**
+         * Search for the ef_construction_ closest elements at layer, starting at ep_id. Inserts pass the level
+         * of the entry point as descend_from, the greedy descent to layer + 1 is then done first.
+         */
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+        searchBaseLayer(tableint ep_id, const void *data_point, int layer, int descend_from) {
+            if (visited_set_type_ == VISITED_HASH_SET)
+                return searchBaseLayer(ep_id, data_point, layer, descend_from, visited_hash_pool_);
+            return searchBaseLayer(ep_id, data_point, layer, descend_from, visited_list_pool_);
+        }
+
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
         searchBaseLayer(tableint ep_id, const void *data_point, int layer) {
-            VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-            vl_type *visited_array = vl->mass;
-            vl_type visited_array_tag = vl->curV;
+            return searchBaseLayer(ep_id, data_point, layer, layer);
+        }
+
+        template <typename VisitedT>
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+        searchBaseLayer(tableint ep_id, const void *data_point, int layer, int descend_from,
+                        BasicVisitedListPool<VisitedT> *pool) {
+            VisitedT *vl = pool->getFreeVisitedList();
+            SearchBuffers buffers = searchBuffersOf(vl);
+            tableint *links = buffers.links;
+            tableint *batch_ids = buffers.batch_ids;
+            const void **batch_data = buffers.batch_data;
+            dist_t *batch_dists = buffers.batch_dists;
+
+            if (descend_from > layer)
+                ep_id = descendGreedily(ep_id, data_point, descend_from, layer, links);
 
             std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
             std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidateSet;
 
             dist_t lowerBound;
             if (!isMarkedDeleted(ep_id)) {
-                dist_t dist = fstdistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_);
+                dist_t dist = elementDistance(data_point, getDataByInternalId(ep_id));
                 top_candidates.emplace(dist, ep_id);
                 lowerBound = dist;
                 candidateSet.emplace(-dist, ep_id);
@@ -170,7 +455,7 @@ namespace hnswlib {
                 lowerBound = std::numeric_limits<dist_t>::max();
                 candidateSet.emplace(-lowerBound, ep_id);
             }
-            visited_array[ep_id] = visited_array_tag;
+            vl->visit(ep_id);
 
             while (!candidateSet.empty()) {
                 std::pair<dist_t, tableint> curr_el_pair = candidateSet.top();
@@ -181,36 +466,32 @@ namespace hnswlib {
 
                 tableint curNodeNum = curr_el_pair.second;
 
-                std::unique_lock <std::mutex> lock(link_list_locks_[curNodeNum]);
-
-                int *data;// = (int *)(linkList0_ + curNodeNum * size_links_per_element0_);
-                if (layer == 0) {
-                    data = (int*)get_linklist0(curNodeNum);
-                } else {
-                    data = (int*)get_linklist(curNodeNum, layer);
-//                    data = (int *) (linkLists_[curNodeNum] + (layer - 1) * size_links_per_element_);
-                }
-                size_t size = getListCount((linklistsizeint*)data);
-                tableint *datal = (tableint *) (data + 1);
-#ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-                _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-                _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
-                _mm_prefetch(getDataByInternalId(*(datal + 1)), _MM_HINT_T0);
-#endif
+                // a copy, the lists of an element taking a deleted slot are read while the inserting thread holds its lock
+                size_t size = readLinkList(curNodeNum, layer, links);
+                tableint *datal = links;
+                if (size > 0)
+                    vl->prefetch(*datal);
 
+                size_t batch_size = 0;
                 for (size_t j = 0; j < size; j++) {
                     tableint candidate_id = *(datal + j);
 //                    if (candidate_id == 0) continue;
+                    if (j + 1 < size)
+                        vl->prefetch(*(datal + j + 1));
+                    if (!vl->visit(candidate_id)) continue;
+                    char *currObj1 = (getDataByInternalId(candidate_id));
 #ifdef USE_SSE
-                    _mm_prefetch((char *) (visited_array + *(datal + j + 1)), _MM_HINT_T0);
-                    _mm_prefetch(getDataByInternalId(*(datal + j + 1)), _MM_HINT_T0);
+                    _mm_prefetch(currObj1, _MM_HINT_T0);
 #endif
-                    if (visited_array[candidate_id] == visited_array_tag) continue;
-                    visited_array[candidate_id] = visited_array_tag;
-                    char *currObj1 = (getDataByInternalId(candidate_id));
+                    batch_ids[batch_size] = candidate_id;
+                    batch_data[batch_size] = currObj1;
+                    batch_size++;
+                }
+                elementDistances(data_point, batch_data, batch_size, batch_dists);
 
-                    dist_t dist1 = fstdistfunc_(data_point, currObj1, dist_func_param_);
+                for (size_t j = 0; j < batch_size; j++) {
+                    tableint candidate_id = batch_ids[j];
+                    dist_t dist1 = batch_dists[j];
                     if (top_candidates.size() < ef_construction_ || lowerBound > dist1) {
                         candidateSet.emplace(-dist1, candidate_id);
 #ifdef USE_SSE
@@ -228,7 +509,7 @@ namespace hnswlib {
                     }
                 }
             }
-            visited_list_pool_->releaseVisitedList(vl);
+            pool->releaseVisitedList(vl);
 
             return top_candidates;
         }
@@ -236,16 +517,32 @@ namespace hnswlib {
         template <bool has_deletions>
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
         searchBaseLayerST(tableint ep_id, const void *data_point, size_t ef) const {
-            VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-            vl_type *visited_array = vl->mass;
-            vl_type visited_array_tag = vl->curV;
+            if (visited_set_type_ == VISITED_HASH_SET)
+                return searchBaseLayerST<has_deletions>(ep_id, data_point, ef, visited_hash_pool_);
+            return searchBaseLayerST<has_deletions>(ep_id, data_point, ef, visited_list_pool_);
+        }
+
+        // an ep_id of -1 starts at the entry point of the index, after the greedy descent through the upper layers
+        template <bool has_deletions, typename VisitedT>
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+        searchBaseLayerST(tableint ep_id, const void *data_point, size_t ef, BasicVisitedListPool<VisitedT> *pool) const {
+            VisitedT *vl = pool->getFreeVisitedList();
+            SearchBuffers buffers = searchBuffersOf(vl);
+            // copy of the link list of the current node, see readLinkList
+            tableint *links = buffers.links;
+            tableint *batch_ids = buffers.batch_ids;
+            const void **batch_data = buffers.batch_data;
+            dist_t *batch_dists = buffers.batch_dists;
+
+            if (ep_id == (tableint) -1)
+                ep_id = searchUpperLayers(data_point, links);
 
             std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
             std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
 
             dist_t lowerBound;
             if (!has_deletions || !isMarkedDeleted(ep_id)) {
-                dist_t dist = fstdistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_);
+                dist_t dist = queryDistance(data_point, getDataByInternalId(ep_id));
                 lowerBound = dist;
                 top_candidates.emplace(dist, ep_id);
                 candidate_set.emplace(-dist, ep_id);
@@ -254,7 +551,7 @@ namespace hnswlib {
                 candidate_set.emplace(-lowerBound, ep_id);
             }
 
-            visited_array[ep_id] = visited_array_tag;
+            vl->visit(ep_id);
 
             while (!candidate_set.empty()) {
 
@@ -266,54 +563,52 @@ namespace hnswlib {
                 candidate_set.pop();
 
                 tableint current_node_id = current_node_pair.second;
-                int *data = (int *) get_linklist0(current_node_id);
-                size_t size = getListCount((linklistsizeint*)data);
+                size_t size = readLinkList(current_node_id, 0, links);
 //                bool cur_node_deleted = isMarkedDeleted(current_node_id);
 
-#ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-                _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-                _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
-                _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
-#endif
+                if (size > 0)
+                    vl->prefetch(links[0]);
 
-                for (size_t j = 1; j <= size; j++) {
-                    int candidate_id = *(data + j);
-//                    if (candidate_id == 0) continue;
+                // gather the unvisited neighbors first and prefetch their vectors, then compute all distances in one call
+                size_t batch_size = 0;
+                for (size_t j = 0; j < size; j++) {
+                    tableint candidate_id = links[j];
+                    if (j + 1 < size)
+                        vl->prefetch(links[j + 1]);
+                    if (vl->visit(candidate_id)) {
+                        char *currObj1 = (getDataByInternalId(candidate_id));
 #ifdef USE_SSE
-                    _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
-                    _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
-                                 _MM_HINT_T0);////////////
+                        _mm_prefetch(currObj1, _MM_HINT_T0);
 #endif
-                    if (!(visited_array[candidate_id] == visited_array_tag)) {
-
-                        visited_array[candidate_id] = visited_array_tag;
-
-                        char *currObj1 = (getDataByInternalId(candidate_id));
-                        dist_t dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
+                        batch_ids[batch_size] = candidate_id;
+                        batch_data[batch_size] = currObj1;
+                        batch_size++;
+                    }
+                }
+                queryDistances(data_point, batch_data, batch_size, batch_dists);
 
-                        if (top_candidates.size() < ef || lowerBound > dist) {
-                            candidate_set.emplace(-dist, candidate_id);
+                for (size_t j = 0; j < batch_size; j++) {
+                    tableint candidate_id = batch_ids[j];
+                    dist_t dist = batch_dists[j];
+                    if (top_candidates.size() < ef || lowerBound > dist) {
+                        candidate_set.emplace(-dist, candidate_id);
 #ifdef USE_SSE
-                            _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
-                                         offsetLevel0_,///////////
-                                         _MM_HINT_T0);////////////////////////
+                        _mm_prefetch((char *) get_linklist0(candidate_set.top().second), _MM_HINT_T0);
 #endif
 
-                            if (!has_deletions || !isMarkedDeleted(candidate_id))
-                                top_candidates.emplace(dist, candidate_id);
+                        if (!has_deletions || !isMarkedDeleted(candidate_id))
+                            top_candidates.emplace(dist, candidate_id);
 
-                            if (top_candidates.size() > ef)
-                                top_candidates.pop();
+                        if (top_candidates.size() > ef)
+                            top_candidates.pop();
 
-                            if (!top_candidates.empty())
-                                lowerBound = top_candidates.top().first;
-                        }
+                        if (!top_candidates.empty())
+                            lowerBound = top_candidates.top().first;
                     }
                 }
             }
 
-            visited_list_pool_->releaseVisitedList(vl);
+            pool->releaseVisitedList(vl);
             return top_candidates;
         }
 
@@ -339,9 +634,7 @@ namespace hnswlib {
                 bool good = true;
                 for (std::pair<dist_t, tableint> second_pair : return_list) {
                     dist_t curdist =
-                            fstdistfunc_(getDataByInternalId(second_pair.second),
-                                         getDataByInternalId(curent_pair.second),
-                                         dist_func_param_);;
+                            elementDistance(getDataByInternalId(second_pair.second), getDataByInternalId(curent_pair.second));;
                     if (curdist < dist_to_query) {
                         good = false;
                         break;
@@ -362,12 +655,72 @@ namespace hnswlib {
 
 
         linklistsizeint *get_linklist0(tableint internal_id) const {
-            return (linklistsizeint *) (data_level0_memory_ + internal_id * size_data_per_element_ + offsetLevel0_);
+            return (linklistsizeint *) (level0_.links + internal_id * level0_.links_stride);
         };
 
-        linklistsizeint *get_linklist0(tableint internal_id, char *data_level0_memory_) const {
-            return (linklistsizeint *) (data_level0_memory_ + internal_id * size_data_per_element_ + offsetLevel0_);
-        };
+        static size_t alignLevel0Array(size_t size) {
+            return (size + 63) & ~(size_t) 63;
+        }
+
+        size_t level0MemorySize(size_t max_elements, bool split) const {
+            if (!split)
+                return max_elements * size_data_per_element_;
+            return alignLevel0Array(max_elements * size_links_level0_) + alignLevel0Array(max_elements * data_size_) +
+                   max_elements * sizeof(labeltype);
+        }
+
+        // the layout of level 0 for max_elements elements in memory of level0MemorySize bytes
+        Level0Layout level0Layout(char *memory, size_t max_elements, bool split) const {
+            Level0Layout layout;
+            if (split) {
+                layout.links = memory;
+                layout.data = layout.links + alignLevel0Array(max_elements * size_links_level0_);
+                layout.labels = layout.data + alignLevel0Array(max_elements * data_size_);
+                layout.links_stride = size_links_level0_;
+                layout.data_stride = data_size_;
+                layout.labels_stride = sizeof(labeltype);
+            } else {
+                layout.links = memory + offsetLevel0_;
+                layout.data = memory + offsetData_;
+                layout.labels = memory + label_offset_;
+                layout.links_stride = size_data_per_element_;
+                layout.data_stride = size_data_per_element_;
+                layout.labels_stride = size_data_per_element_;
+            }
+            return layout;
+        }
+
+        void copyLevel0Element(const Level0Layout &from, tableint from_id, const Level0Layout &to, tableint to_id) const {
+            memcpy(to.links + to_id * to.links_stride, from.links + from_id * from.links_stride, size_links_level0_);
+            memcpy(to.data + to_id * to.data_stride, from.data + from_id * from.data_stride, data_size_);
+            memcpy(to.labels + to_id * to.labels_stride, from.labels + from_id * from.labels_stride, sizeof(labeltype));
+        }
+
+        /**
+         * With split the level 0 links, the vectors and the labels are kept in three arrays instead of one record
+         * per element. Graph hops then only bring link lists into the cache and distance computations only vectors,
+         * and vectors of 64 byte multiples start at cache lines. The existing elements are moved; saved files keep
+         * the interleaved format and loading starts interleaved. Must not be called while searches or inserts are running.
+         */
+        void setSplitLayout(bool split) {
+            checkWritable();
+            if (split == split_layout_)
+                return;
+            char *memory = (char *) allocateLarge(level0MemorySize(max_elements_, split), huge_pages_);
+            if (memory == nullptr)
+                throw std::runtime_error("Not enough memory: setSplitLayout failed to allocate base layer");
+            Level0Layout layout = level0Layout(memory, max_elements_, split);
+            for (tableint i = 0; i < cur_element_count; i++)
+                copyLevel0Element(level0_, i, layout, i);
+            freeLarge(data_level0_memory_);
+            data_level0_memory_ = memory;
+            level0_ = layout;
+            split_layout_ = split;
+        }
+
+        bool isSplitLayout() const {
+            return split_layout_;
+        }
 
         linklistsizeint *get_linklist(tableint internal_id, int level) const {
             return (linklistsizeint *) (linkLists_[internal_id] + (level - 1) * size_links_per_element_);
@@ -396,24 +749,28 @@ namespace hnswlib {
                 else
                     ll_cur = get_linklist(cur_c, level);
 
-                if (*ll_cur) {
+                // an element taking a deleted slot keeps the deletion mark in the header until it is linked
+                if (getListCount(ll_cur)) {
                     throw std::runtime_error("The newly inserted element should have blank link list");
                 }
-                setListCount(ll_cur,selectedNeighbors.size());
                 tableint *data = (tableint *) (ll_cur + 1);
-
-
                 for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
                     if (data[idx])
                         throw std::runtime_error("Possible memory corruption");
                     if (level > element_levels_[selectedNeighbors[idx]])
                         throw std::runtime_error("Trying to make a link on a non-existent level");
-
-                    data[idx] = selectedNeighbors[idx];
-
                 }
+
+                beginLinkListWrite(cur_c);
+                for (size_t idx = 0; idx < selectedNeighbors.size(); idx++)
+                    storeRelaxed(data + idx, selectedNeighbors[idx]);
+                setListCount(ll_cur,selectedNeighbors.size());
+                endLinkListWrite(cur_c);
             }
             for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
+                // the slot of a deleted neighbor may be taken by an insert holding its lock, its lists are rebuilt then
+                if (replace_deleted_ && isMarkedDeleted(selectedNeighbors[idx]))
+                    continue;
 
                 std::unique_lock <std::mutex> lock(link_list_locks_[selectedNeighbors[idx]]);
 
@@ -435,35 +792,37 @@ namespace hnswlib {
 
                 tableint *data = (tableint *) (ll_other + 1);
                 if (sz_link_list_other < Mcurmax) {
-                    data[sz_link_list_other] = cur_c;
+                    beginLinkListWrite(selectedNeighbors[idx]);
+                    storeRelaxed(data + sz_link_list_other, cur_c);
                     setListCount(ll_other, sz_link_list_other + 1);
+                    endLinkListWrite(selectedNeighbors[idx]);
                 } else {
                     // finding the "weakest" element to replace it with the new one
-                    dist_t d_max = fstdistfunc_(getDataByInternalId(cur_c), getDataByInternalId(selectedNeighbors[idx]),
-                                                dist_func_param_);
+                    dist_t d_max = elementDistance(getDataByInternalId(cur_c), getDataByInternalId(selectedNeighbors[idx]));
                     // Heuristic:
                     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
                     candidates.emplace(d_max, cur_c);
 
                     for (size_t j = 0; j < sz_link_list_other; j++) {
                         candidates.emplace(
-                                fstdistfunc_(getDataByInternalId(data[j]), getDataByInternalId(selectedNeighbors[idx]),
-                                             dist_func_param_), data[j]);
+                                elementDistance(getDataByInternalId(data[j]), getDataByInternalId(selectedNeighbors[idx])), data[j]);
                     }
 
                     getNeighborsByHeuristic2(candidates, Mcurmax);
 
+                    beginLinkListWrite(selectedNeighbors[idx]);
                     int indx = 0;
                     while (candidates.size() > 0) {
-                        data[indx] = candidates.top().second;
+                        storeRelaxed(data + indx, candidates.top().second);
                         candidates.pop();
                         indx++;
                     }
                     setListCount(ll_other, indx);
+                    endLinkListWrite(selectedNeighbors[idx]);
                     // Nearest K:
                     /*int indx = -1;
                     for (int j = 0; j < sz_link_list_other; j++) {
-                        dist_t d = fstdistfunc_(getDataByInternalId(data[j]), getDataByInternalId(rez[idx]), dist_func_param_);
+                        dist_t d = elementDistance(getDataByInternalId(data[j]), getDataByInternalId(rez[idx]));
                         if (d > d_max) {
                             indx = j;
                             d_max = d;
@@ -489,7 +848,7 @@ namespace hnswlib {
             std::priority_queue<std::pair<dist_t, tableint  >> top_candidates;
             if (cur_element_count == 0) return top_candidates;
             tableint currObj = enterpoint_node_;
-            dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+            dist_t curdist = elementDistance(query_data, getDataByInternalId(enterpoint_node_));
 
             for (size_t level = maxlevel_; level > 0; level--) {
                 bool changed = true;
@@ -501,9 +860,9 @@ namespace hnswlib {
                     tableint *datal = (tableint *) (data + 1);
                     for (int i = 0; i < size; i++) {
                         tableint cand = datal[i];
-                        if (cand < 0 || cand > max_elements_)
+                        if (cand >= max_elements_)
                             throw std::runtime_error("cand error");
-                        dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
+                        dist_t d = elementDistance(query_data, getDataByInternalId(cand));
 
                         if (d < curdist) {
                             curdist = d;
@@ -532,206 +891,972 @@ namespace hnswlib {
         };
 
         void resizeIndex(size_t new_max_elements){
+            checkWritable();
             if (new_max_elements<cur_element_count)
                 throw std::runtime_error("Cannot resize, max element is less than the current number of elements");
 
 
             delete visited_list_pool_;
-            visited_list_pool_ = new VisitedListPool(1, new_max_elements);
+            delete visited_hash_pool_;
+            createVisitedListPools(new_max_elements);
 
 
 
             element_levels_.resize(new_max_elements);
 
             std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
+            std::vector<std::atomic<unsigned int>>(new_max_elements).swap(link_list_versions_);
 
 
             // Reallocate base layer
-            char * data_level0_memory_new = (char *) malloc(new_max_elements * size_data_per_element_);
+            char * data_level0_memory_new = (char *) allocateLarge(level0MemorySize(new_max_elements, split_layout_), huge_pages_);
             if (data_level0_memory_new == nullptr)
                 throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
-            memcpy(data_level0_memory_new, data_level0_memory_,cur_element_count * size_data_per_element_);
-            free(data_level0_memory_);
+            Level0Layout level0_new = level0Layout(data_level0_memory_new, new_max_elements, split_layout_);
+            if (split_layout_) {
+                // the arrays start further apart
+                memcpy(level0_new.links, level0_.links, cur_element_count * size_links_level0_);
+                memcpy(level0_new.data, level0_.data, cur_element_count * data_size_);
+                memcpy(level0_new.labels, level0_.labels, cur_element_count * sizeof(labeltype));
+            } else {
+                memcpy(data_level0_memory_new, data_level0_memory_,cur_element_count * size_data_per_element_);
+            }
+            freeLarge(data_level0_memory_);
             data_level0_memory_=data_level0_memory_new;
+            level0_ = level0_new;
 
             // Reallocate all other layers
-            char ** linkLists_new = (char **) malloc(sizeof(void *) * new_max_elements);
+            char ** linkLists_new = (char **) allocateLarge(sizeof(void *) * new_max_elements, huge_pages_);
             if (linkLists_new == nullptr)
                 throw std::runtime_error("Not enough memory: resizeIndex failed to allocate other layers");
             memcpy(linkLists_new, linkLists_,cur_element_count * sizeof(void *));
-            free(linkLists_);
+            freeLarge(linkLists_);
             linkLists_=linkLists_new;
 
             max_elements_=new_max_elements;
 
         }
 
-        void saveIndex(const std::string &location) {
-            std::ofstream output(location, std::ios::binary);
-            std::streampos position;
-
-            writeBinaryPOD(output, offsetLevel0_);
-            writeBinaryPOD(output, max_elements_);
-            writeBinaryPOD(output, cur_element_count);
-            writeBinaryPOD(output, size_data_per_element_);
-            writeBinaryPOD(output, label_offset_);
-            writeBinaryPOD(output, offsetData_);
-            writeBinaryPOD(output, maxlevel_);
-            writeBinaryPOD(output, enterpoint_node_);
-            writeBinaryPOD(output, maxM_);
-
-            writeBinaryPOD(output, maxM0_);
-            writeBinaryPOD(output, M_);
-            writeBinaryPOD(output, mult_);
-            writeBinaryPOD(output, ef_construction_);
-
-            output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
+        /**
+         * Order of the elements for reorder: order[new id] = old id. Every connected part of the level 0 graph
+         * is visited breadth-first, so neighbors get close ids.
+         */
+        std::vector<tableint> graphOrder(ReorderMethod method) const {
+            std::vector<tableint> order;
+            order.reserve(cur_element_count);
+            std::vector<bool> visited(cur_element_count, false);
+
+            std::vector<tableint> roots;
+            if (method == REORDER_BFS) {
+                roots.push_back(enterpoint_node_);
+                for (tableint i = 0; i < cur_element_count; i++)
+                    roots.push_back(i);
+            } else {
+                // peripheral starting points: the lowest degrees first
+                roots.resize(cur_element_count);
+                std::iota(roots.begin(), roots.end(), 0);
+                std::stable_sort(roots.begin(), roots.end(), [&](tableint a, tableint b) {
+                    return getListCount(get_linklist0(a)) < getListCount(get_linklist0(b));
+                });
+            }
 
-            for (size_t i = 0; i < cur_element_count; i++) {
-                unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
-                writeBinaryPOD(output, linkListSize);
-                if (linkListSize)
-                    output.write(linkLists_[i], linkListSize);
+            std::vector<tableint> neighbors;
+            for (tableint root : roots) {
+                if (visited[root])
+                    continue;
+                visited[root] = true;
+                size_t head = order.size();
+                order.push_back(root);
+                while (head < order.size()) {
+                    linklistsizeint *ll = get_linklist0(order[head++]);
+                    size_t size = getListCount(ll);
+                    tableint *links = (tableint *) (ll + 1);
+                    neighbors.clear();
+                    for (size_t j = 0; j < size; j++) {
+                        if (!visited[links[j]])
+                            neighbors.push_back(links[j]);
+                    }
+                    if (method == REORDER_RCM) {
+                        std::stable_sort(neighbors.begin(), neighbors.end(), [&](tableint a, tableint b) {
+                            return getListCount(get_linklist0(a)) < getListCount(get_linklist0(b));
+                        });
+                    }
+                    for (tableint neighbor : neighbors) {
+                        if (visited[neighbor])
+                            continue;
+                        visited[neighbor] = true;
+                        order.push_back(neighbor);
+                    }
+                }
             }
-            output.close();
+            if (method == REORDER_RCM)
+                std::reverse(order.begin(), order.end());
+            return order;
         }
 
-        void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i=0) {
+        /**
+         * Renumbers the internal ids so that elements linked in the graph are stored close to each other,
+         * which saves cache and TLB misses in searches of indexes inserted in random order. Level 0 is
+         * rewritten in the new order, the link lists, the label lookup and the enterpoint are translated.
+         * Labels and search results do not change. Must not be called while searches or inserts are running.
+         */
+        void reorder(ReorderMethod method = REORDER_BFS) {
+            checkWritable();
+            if (cur_element_count == 0)
+                return;
+            std::vector<tableint> order = graphOrder(method);
+            std::vector<tableint> new_id(cur_element_count);
+            for (tableint i = 0; i < cur_element_count; i++)
+                new_id[order[i]] = i;
 
+            char *data_level0_memory_new = (char *) allocateLarge(level0MemorySize(max_elements_, split_layout_), huge_pages_);
+            if (data_level0_memory_new == nullptr)
+                throw std::runtime_error("Not enough memory: reorder failed to allocate base layer");
+            Level0Layout level0_new = level0Layout(data_level0_memory_new, max_elements_, split_layout_);
+            std::vector<int> element_levels_new(max_elements_);
+            std::vector<char *> link_lists_new(cur_element_count);
 
-            std::ifstream input(location, std::ios::binary);
+            for (tableint i = 0; i < cur_element_count; i++) {
+                tableint old_id = order[i];
+                copyLevel0Element(level0_, old_id, level0_new, i);
+                element_levels_new[i] = element_levels_[old_id];
+                link_lists_new[i] = linkLists_[old_id];
+
+                linklistsizeint *ll = (linklistsizeint *) (level0_new.links + i * level0_new.links_stride);
+                tableint *links = (tableint *) (ll + 1);
+                for (size_t j = 0; j < getListCount(ll); j++)
+                    links[j] = new_id[links[j]];
+                // the upper layers are translated where they are
+                for (int level = 1; level <= element_levels_new[i]; level++) {
+                    ll = (linklistsizeint *) (link_lists_new[i] + (level - 1) * size_links_per_element_);
+                    links = (tableint *) (ll + 1);
+                    for (size_t j = 0; j < getListCount(ll); j++)
+                        links[j] = new_id[links[j]];
+                }
+            }
 
-            if (!input.is_open())
-                throw std::runtime_error("Cannot open file");
+            freeLarge(data_level0_memory_);
+            data_level0_memory_ = data_level0_memory_new;
+            level0_ = level0_new;
+            memcpy(linkLists_, link_lists_new.data(), cur_element_count * sizeof(char *));
+            element_levels_.swap(element_levels_new);
+            enterpoint_node_ = new_id[enterpoint_node_];
+
+            // a label re-added after a deletion keeps pointing to its latest element
+            label_lookup_.forEach([&](labeltype label, tableint &id) {
+                id = new_id[id];
+            });
+            for (tableint &id : deleted_elements_)
+                id = new_id[id];
+        }
 
+        // progress of repairDeletedLinks and compact: elements processed so far, elements in total
+        typedef std::function<void(size_t, size_t)> ProgressCallback;
 
-            // get file size:
-            input.seekg(0,input.end);
-            std::streampos total_filesize=input.tellg();
-            input.seekg(0,input.beg);
+        /**
+         * Gives every element that links to deleted elements a new list without them, chosen by the heuristic
+         * among its live neighbors and the live elements reached through the deleted ones. Searches then no
+         * longer expand deleted elements. Runs on num_threads threads (0 means all cores) next to searches,
+         * which do not block: the lists are replaced under their version like in inserts. Must not be called
+         * while inserts are running. progress, when set, is called from the worker threads one at a time.
+         */
+        void repairDeletedLinks(size_t num_threads = 0, ProgressCallback progress = nullptr) {
+            checkWritable();
+            size_t total = cur_element_count;
+            if (!has_deletions_ || total == 0)
+                return;
+            const size_t chunk = 1024;
+            size_t num_chunks = (total + chunk - 1) / chunk;
+            std::atomic<size_t> done(0);
+            std::mutex progress_guard;
+            ParallelFor(0, num_chunks, num_threads, [&](size_t c, size_t threadId) {
+                std::vector<tableint> links(maxM0_);
+                std::vector<tableint> candidates;
+                std::unordered_set<tableint> seen;
+                size_t end = std::min(total, (c + 1) * chunk);
+                for (tableint id = c * chunk; id < end; id++) {
+                    if (isMarkedDeleted(id))
+                        continue;
+                    for (int level = 0; level <= element_levels_[id]; level++)
+                        relinkAroundDeleted(id, level, links, candidates, seen);
+                }
+                size_t done_now = done += end - c * chunk;
+                if (progress) {
+                    std::unique_lock <std::mutex> lock(progress_guard);
+                    progress(done_now, total);
+                }
+            });
+        }
 
-            readBinaryPOD(input, offsetLevel0_);
-            readBinaryPOD(input, max_elements_);
-            readBinaryPOD(input, cur_element_count);
+        // replaces the list of a live element at level if it links to deleted elements
+        void relinkAroundDeleted(tableint internal_id, int level, std::vector<tableint> &links,
+                                 std::vector<tableint> &candidates, std::unordered_set<tableint> &seen) {
+            std::unique_lock <std::mutex> lock(link_list_locks_[internal_id]);
+            linklistsizeint *ll = level == 0 ? get_linklist0(internal_id) : get_linklist(internal_id, level);
+            size_t size = getListCount(ll);
+            tableint *data = (tableint *) (ll + 1);
+            bool links_deleted = false;
+            for (size_t j = 0; j < size && !links_deleted; j++)
+                links_deleted = isMarkedDeleted(data[j]);
+            if (!links_deleted)
+                return;
 
-            size_t max_elements=max_elements_i;
-            if(max_elements < cur_element_count)
-                max_elements = max_elements_;
-            max_elements_ = max_elements;
-            readBinaryPOD(input, size_data_per_element_);
-            readBinaryPOD(input, label_offset_);
-            readBinaryPOD(input, offsetData_);
-            readBinaryPOD(input, maxlevel_);
-            readBinaryPOD(input, enterpoint_node_);
+            // walks through chains of deleted elements until there are enough live candidates
+            candidates.clear();
+            seen.clear();
+            seen.insert(internal_id);
+            std::vector<tableint> deleted;
+            for (size_t j = 0; j < size; j++) {
+                if (!seen.insert(data[j]).second)
+                    continue;
+                if (isMarkedDeleted(data[j]))
+                    deleted.push_back(data[j]);
+                else
+                    candidates.push_back(data[j]);
+            }
+            for (size_t d = 0; d < deleted.size() && candidates.size() < ef_construction_; d++) {
+                size_t size_deleted = readLinkList(deleted[d], level, links.data());
+                for (size_t j = 0; j < size_deleted; j++) {
+                    if (!seen.insert(links[j]).second)
+                        continue;
+                    if (isMarkedDeleted(links[j]))
+                        deleted.push_back(links[j]);
+                    else
+                        candidates.push_back(links[j]);
+                }
+            }
 
-            readBinaryPOD(input, maxM_);
-            readBinaryPOD(input, maxM0_);
-            readBinaryPOD(input, M_);
-            readBinaryPOD(input, mult_);
-            readBinaryPOD(input, ef_construction_);
+            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
+            for (tableint cand : candidates)
+                top_candidates.emplace(elementDistance(getDataByInternalId(cand), getDataByInternalId(internal_id)), cand);
+            if (top_candidates.empty() && level <= maxlevel_) {
+                // the deleted elements around it reach no live one, the nearest live elements are searched from
+                // the top instead, the element would be cut off otherwise
+                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> found =
+                        searchBaseLayer(enterpoint_node_, getDataByInternalId(internal_id), level, maxlevel_);
+                while (!found.empty()) {
+                    if (found.top().second != internal_id)
+                        top_candidates.push(found.top());
+                    found.pop();
+                }
+            }
+            getNeighborsByHeuristic2(top_candidates, level ? maxM_ : maxM0_);
 
+            beginLinkListWrite(internal_id);
+            int indx = 0;
+            while (top_candidates.size() > 0) {
+                storeRelaxed(data + indx, top_candidates.top().second);
+                top_candidates.pop();
+                indx++;
+            }
+            setListCount(ll, indx);
+            endLinkListWrite(internal_id);
+        }
 
-            data_size_ = s->get_data_size();
-            fstdistfunc_ = s->get_dist_func();
-            dist_func_param_ = s->get_dist_func_param();
+        /**
+         * Drops the deleted elements for good: repairs the links around them (repairDeletedLinks) and renumbers
+         * the remaining elements in their current order, their slots are free for new elements; max_elements_
+         * stays. With no element left the index is empty again. The labels of deleted elements are forgotten.
+         * The repair runs next to searches, the renumbering must not: compact as a whole must not be called
+         * while searches or inserts are running.
+         */
+        void compact(size_t num_threads = 0, ProgressCallback progress = nullptr) {
+            checkWritable();
+            repairDeletedLinks(num_threads, progress);
 
-            auto pos=input.tellg();
-            
-            
-            /// Optional - check if index is ok:
+            std::vector<tableint> order;
+            std::vector<tableint> new_id(cur_element_count, (tableint) -1);
+            for (tableint i = 0; i < cur_element_count; i++) {
+                if (!isMarkedDeleted(i)) {
+                    new_id[i] = order.size();
+                    order.push_back(i);
+                }
+            }
+            size_t new_count = order.size();
 
-            input.seekg(cur_element_count * size_data_per_element_,input.cur);
-            for (size_t i = 0; i < cur_element_count; i++) {
-                if(input.tellg() < 0 || input.tellg()>=total_filesize){
-                    throw std::runtime_error("Index seems to be corrupted or unsupported");
+            char *data_level0_memory_new = (char *) allocateLarge(level0MemorySize(max_elements_, split_layout_), huge_pages_);
+            if (data_level0_memory_new == nullptr)
+                throw std::runtime_error("Not enough memory: compact failed to allocate base layer");
+            Level0Layout level0_new = level0Layout(data_level0_memory_new, max_elements_, split_layout_);
+            char **linkLists_new = (char **) allocateLarge(sizeof(void *) * max_elements_, huge_pages_);
+            if (linkLists_new == nullptr) {
+                freeLarge(data_level0_memory_new);
+                throw std::runtime_error("Not enough memory: compact failed to allocate linklists");
+            }
+            std::vector<int> element_levels_new(max_elements_);
+
+            // links to deleted elements the repair could not replace are dropped
+            auto translate = [&](linklistsizeint *ll) {
+                tableint *links = (tableint *) (ll + 1);
+                size_t size = getListCount(ll);
+                size_t kept = 0;
+                for (size_t j = 0; j < size; j++) {
+                    if (new_id[links[j]] != (tableint) -1)
+                        links[kept++] = new_id[links[j]];
                 }
+                setListCount(ll, kept);
+            };
+
+            // the upper layers of the remaining elements go to a new arena in one block, it replaces the old one
+            LinkListArena upper_arena(huge_pages_);
+            size_t upper_size = 0;
+            for (tableint i = 0; i < new_count; i++) {
+                element_levels_new[i] = element_levels_[order[i]];
+                upper_size += size_links_per_element_ * element_levels_new[i];
+            }
+            char *upper = upper_size > 0 ? upper_arena.allocate(upper_size) : nullptr;
+            for (tableint i = 0; i < new_count; i++) {
+                linkLists_new[i] = element_levels_new[i] > 0 ? upper : nullptr;
+                upper += size_links_per_element_ * element_levels_new[i];
+            }
 
-                unsigned int linkListSize;
-                readBinaryPOD(input, linkListSize);
-                if (linkListSize != 0) {
-                    input.seekg(linkListSize,input.cur);
+            ParallelFor(0, new_count, num_threads, [&](size_t i, size_t threadId) {
+                tableint old_id = order[i];
+                copyLevel0Element(level0_, old_id, level0_new, i);
+                translate((linklistsizeint *) (level0_new.links + i * level0_new.links_stride));
+                if (element_levels_new[i] > 0) {
+                    memcpy(linkLists_new[i], linkLists_[old_id], size_links_per_element_ * element_levels_new[i]);
+                    for (int level = 1; level <= element_levels_new[i]; level++)
+                        translate((linklistsizeint *) (linkLists_new[i] + (level - 1) * size_links_per_element_));
+                }
+            }, 1024);
+            link_list_arena_.swap(upper_arena);
+
+            // a deleted enterpoint is replaced by a remaining element of the highest level, none is left when
+            // all elements were deleted
+            tableint enterpoint = (tableint) -1;
+            int maxlevel = -1;
+            if (hasEntryPoint() && new_id[enterpoint_node_] != (tableint) -1) {
+                enterpoint = new_id[enterpoint_node_];
+                maxlevel = maxlevel_;
+            } else {
+                for (tableint i = 0; i < new_count; i++) {
+                    if (element_levels_new[i] > maxlevel) {
+                        enterpoint = i;
+                        maxlevel = element_levels_new[i];
+                    }
                 }
             }
 
-            // throw exception if it either corrupted or old index
-            if(input.tellg()!=total_filesize)
-                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            freeLarge(data_level0_memory_);
+            data_level0_memory_ = data_level0_memory_new;
+            level0_ = level0_new;
+            freeLarge(linkLists_);
+            linkLists_ = linkLists_new;
+            element_levels_.swap(element_levels_new);
+
+            label_lookup_.clear();
+            label_lookup_.reserve(new_count);
+            for (tableint i = 0; i < new_count; i++)
+                label_lookup_.insert(getExternalLabel(i), i);
+            deleted_elements_.clear();
+            has_deletions_ = false;
+            cur_element_count = new_count;
+            enterpoint_node_ = enterpoint;
+            maxlevel_ = maxlevel;
+        }
 
-            input.clear();
+        void saveIndex(const std::string &location) {
+            std::ofstream output(location, std::ios::binary);
 
-            /// Optional check end
+            IndexFileHeader header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC));
+            header.version = INDEX_FILE_VERSION;
+            header.header_size = sizeof(IndexFileHeader);
+
+            header.data_size = data_size_;
+            header.dim = space_->get_dim();
+            header.dist_size = sizeof(dist_t);
+
+            header.max_elements = max_elements_;
+            header.cur_element_count = cur_element_count;
+            header.size_data_per_element = size_data_per_element_;
+            header.size_links_per_element = size_links_per_element_;
+            header.label_offset = label_offset_;
+            header.offset_data = offsetData_;
+            header.offset_level0 = offsetLevel0_;
+            header.maxM = maxM_;
+            header.maxM0 = maxM0_;
+            header.M = M_;
+            header.ef_construction = ef_construction_;
+            header.mult = mult_;
+            header.maxlevel = maxlevel_;
+            header.enterpoint_node = enterpoint_node_;
+            header.has_deletions = has_deletions_;
+
+            std::vector<uint64_t> upper_offsets(cur_element_count + 1);
+            upper_offsets[0] = 0;
+            for (size_t i = 0; i < cur_element_count; i++) {
+                uint64_t linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
+                upper_offsets[i + 1] = upper_offsets[i] + linkListSize;
+            }
 
-            input.seekg(pos,input.beg);
+            IndexFileSection *sections = header.sections;
+            sections[SECTION_LEVEL0].offset = alignIndexFileOffset(sizeof(IndexFileHeader));
+            sections[SECTION_LEVEL0].size = cur_element_count * size_data_per_element_;
+            sections[SECTION_UPPER_OFFSETS].offset = alignIndexFileOffset(sections[SECTION_LEVEL0].offset + sections[SECTION_LEVEL0].size);
+            sections[SECTION_UPPER_OFFSETS].size = upper_offsets.size() * sizeof(uint64_t);
+            sections[SECTION_UPPER_LINKS].offset = alignIndexFileOffset(sections[SECTION_UPPER_OFFSETS].offset + sections[SECTION_UPPER_OFFSETS].size);
+            sections[SECTION_UPPER_LINKS].size = upper_offsets[cur_element_count];
+            sections[SECTION_LABELS].offset = alignIndexFileOffset(sections[SECTION_UPPER_LINKS].offset + sections[SECTION_UPPER_LINKS].size);
+            sections[SECTION_LABELS].size = cur_element_count * sizeof(labeltype);
+
+            writeBinaryPOD(output, header);
+
+            writeIndexFilePadding(output, sizeof(IndexFileHeader), sections[SECTION_LEVEL0].offset);
+            if (split_layout_) {
+                // the file keeps one record per element
+                const size_t record_chunk = 4096;
+                std::vector<char> records(record_chunk * size_data_per_element_);
+                Level0Layout file_layout = level0Layout(records.data(), record_chunk, false);
+                for (size_t first = 0; first < cur_element_count; first += record_chunk) {
+                    size_t count = std::min(record_chunk, cur_element_count - first);
+                    std::fill(records.begin(), records.end(), 0);
+                    for (size_t i = 0; i < count; i++)
+                        copyLevel0Element(level0_, first + i, file_layout, i);
+                    output.write(records.data(), count * size_data_per_element_);
+                }
+            } else {
+                output.write(data_level0_memory_, sections[SECTION_LEVEL0].size);
+            }
 
+            writeIndexFilePadding(output, sections[SECTION_LEVEL0].offset + sections[SECTION_LEVEL0].size, sections[SECTION_UPPER_OFFSETS].offset);
+            output.write((char *) upper_offsets.data(), sections[SECTION_UPPER_OFFSETS].size);
 
-            data_level0_memory_ = (char *) malloc(max_elements * size_data_per_element_);
-            if (data_level0_memory_ == nullptr)
-                throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
-            input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
+            writeIndexFilePadding(output, sections[SECTION_UPPER_OFFSETS].offset + sections[SECTION_UPPER_OFFSETS].size, sections[SECTION_UPPER_LINKS].offset);
+            for (size_t i = 0; i < cur_element_count; i++) {
+                if (upper_offsets[i + 1] != upper_offsets[i])
+                    output.write(linkLists_[i], upper_offsets[i + 1] - upper_offsets[i]);
+            }
 
-            
+            writeIndexFilePadding(output, sections[SECTION_UPPER_LINKS].offset + sections[SECTION_UPPER_LINKS].size, sections[SECTION_LABELS].offset);
+            for (size_t i = 0; i < cur_element_count; i++) {
+                writeBinaryPOD(output, getExternalLabel(i));
+            }
 
+            output.close();
+        }
 
-            size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        /**
+         * Validates the header of a sectioned index file against the space and the file size
+         * and sets up the index parameters from it.
+         */
+        void readIndexFileHeader(const IndexFileHeader &header, SpaceInterface<dist_t> *s, uint64_t total_filesize) {
+            if (header.version > INDEX_FILE_VERSION || header.header_size != sizeof(IndexFileHeader))
+                throw std::runtime_error("Unsupported index file version");
+            if (header.data_size != s->get_data_size() || header.dist_size != sizeof(dist_t))
+                throw std::runtime_error("The index was built for a different space");
+
+            const IndexFileSection *sections = header.sections;
+            for (int i = 0; i < SECTION_COUNT; i++) {
+                if (sections[i].offset > total_filesize || sections[i].size > total_filesize - sections[i].offset)
+                    throw std::runtime_error("Index seems to be corrupted or unsupported");
+            }
+            if (sections[SECTION_LEVEL0].size != header.cur_element_count * header.size_data_per_element ||
+                sections[SECTION_UPPER_OFFSETS].size != (header.cur_element_count + 1) * sizeof(uint64_t) ||
+                sections[SECTION_LABELS].size != header.cur_element_count * sizeof(labeltype) ||
+                header.size_links_per_element != header.maxM * sizeof(tableint) + sizeof(linklistsizeint))
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
 
+            offsetLevel0_ = header.offset_level0;
+            max_elements_ = header.max_elements;
+            cur_element_count = header.cur_element_count;
+            size_data_per_element_ = header.size_data_per_element;
+            label_offset_ = header.label_offset;
+            offsetData_ = header.offset_data;
+            maxlevel_ = header.maxlevel;
+            enterpoint_node_ = header.enterpoint_node;
+            maxM_ = header.maxM;
+            maxM0_ = header.maxM0;
+            M_ = header.M;
+            mult_ = header.mult;
+            ef_construction_ = header.ef_construction;
 
+            size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
             size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
-            std::vector<std::mutex>(max_elements).swap(link_list_locks_);
-
 
-            visited_list_pool_ = new VisitedListPool(1, max_elements);
+            setSpace(s);
 
-
-            linkLists_ = (char **) malloc(sizeof(void *) * max_elements);
-            if (linkLists_ == nullptr)
-                throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
-            element_levels_ = std::vector<int>(max_elements);
             revSize_ = 1.0 / mult_;
             ef_ = 10;
-            for (size_t i = 0; i < cur_element_count; i++) {
-                label_lookup_[getExternalLabel(i)]=i;
-                unsigned int linkListSize;
-                readBinaryPOD(input, linkListSize);
-                if (linkListSize == 0) {
-                    element_levels_[i] = 0;
+        }
+
+        /**
+         * Checks that the upper layer offsets table is consistent with the links section.
+         */
+        void checkUpperLayerOffsets(const uint64_t *upper_offsets, const IndexFileHeader &header) const {
+            if (upper_offsets[0] != 0 || upper_offsets[cur_element_count] != header.sections[SECTION_UPPER_LINKS].size)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            for (size_t i = 0; i < cur_element_count; i++) {
+                if (upper_offsets[i + 1] < upper_offsets[i] ||
+                    (upper_offsets[i + 1] - upper_offsets[i]) % size_links_per_element_ != 0)
+                    throw std::runtime_error("Index seems to be corrupted or unsupported");
+            }
+        }
 
+        /**
+         * Reads size bytes at file_pos into dst, splitting the range between num_threads threads with their own streams.
+         */
+        static void readFileParallel(const std::string &location, uint64_t file_pos, char *dst, size_t size, size_t num_threads) {
+            const size_t min_chunk = 1 << 20;
+            size_t chunk = std::max(min_chunk, size / (num_threads * 4) + 1);
+            size_t num_chunks = (size + chunk - 1) / chunk;
+            ParallelFor(0, num_chunks, num_threads, [&](size_t i, size_t threadId) {
+                size_t begin = i * chunk;
+                size_t len = std::min(chunk, size - begin);
+                std::ifstream input(location, std::ios::binary);
+                input.seekg(file_pos + begin, input.beg);
+                input.read(dst + begin, len);
+                if ((size_t) input.gcount() != len)
+                    throw std::runtime_error("Index seems to be corrupted or unsupported");
+            });
+        }
+
+        /**
+         * Fills level 0, the upper layers, label_lookup_ and (optionally) has_deletions_ from the index file.
+         * element_levels_ has to be set up already; upper_layers lists (internal id, file position) of every
+         * element with a level above 0, in file order. With num_threads > 1 the label lookup is built on its own
+         * thread while the remaining threads allocate and read the upper layers and scan for deleted elements.
+         */
+        void loadElements(const std::string &location, uint64_t level0_pos,
+                          const std::vector<std::pair<tableint, uint64_t>> &upper_layers,
+                          size_t num_threads, bool scan_deletions) {
+            if (num_threads == 0)
+                num_threads = std::thread::hardware_concurrency();
+
+            readFileParallel(location, level0_pos, data_level0_memory_, cur_element_count * size_data_per_element_, num_threads);
+
+            auto buildLabelLookup = [&]() {
+                label_lookup_.reserve(cur_element_count);
+                for (size_t i = 0; i < cur_element_count; i++) {
+                    label_lookup_.insert(getExternalLabel(i), i);
+                }
+            };
+            std::thread label_thread;
+            size_t worker_threads = num_threads;
+            if (num_threads > 1) {
+                label_thread = std::thread(buildLabelLookup);
+                worker_threads = num_threads - 1;
+            }
+
+            try {
+                const size_t element_chunk = 1 << 16;
+                ParallelFor(0, cur_element_count, worker_threads, [&](size_t i, size_t threadId) {
                     linkLists_[i] = nullptr;
-                } else {
-                    element_levels_[i] = linkListSize / size_links_per_element_;
-                    linkLists_[i] = (char *) malloc(linkListSize);
-                    if (linkLists_[i] == nullptr)
-                        throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-                    input.read(linkLists_[i], linkListSize);
+                }, element_chunk);
+
+                // all upper layers go into one arena block, in file order
+                size_t upper_size = 0;
+                for (size_t j = 0; j < upper_layers.size(); j++)
+                    upper_size += size_links_per_element_ * element_levels_[upper_layers[j].first];
+                char *upper_links = upper_size ? link_list_arena_.allocate(upper_size) : nullptr;
+                for (size_t j = 0; j < upper_layers.size(); j++) {
+                    tableint id = upper_layers[j].first;
+                    linkLists_[id] = upper_links;
+                    upper_links += size_links_per_element_ * element_levels_[id];
+                }
+
+                // consecutive upper layers are read with one request and then copied to their place
+                const size_t upper_chunk = 1024;
+                size_t num_chunks = (upper_layers.size() + upper_chunk - 1) / upper_chunk;
+                ParallelFor(0, num_chunks, worker_threads, [&](size_t c, size_t threadId) {
+                    size_t first = c * upper_chunk;
+                    size_t last = std::min(upper_layers.size(), first + upper_chunk) - 1;
+                    uint64_t begin = upper_layers[first].second;
+                    uint64_t end = upper_layers[last].second + size_links_per_element_ * element_levels_[upper_layers[last].first];
+
+                    std::vector<char> buffer(end - begin);
+                    std::ifstream input(location, std::ios::binary);
+                    input.seekg(begin, input.beg);
+                    input.read(buffer.data(), buffer.size());
+                    if ((size_t) input.gcount() != buffer.size())
+                        throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+                    for (size_t j = first; j <= last; j++) {
+                        tableint id = upper_layers[j].first;
+                        size_t linkListSize = size_links_per_element_ * element_levels_[id];
+                        memcpy(linkLists_[id], buffer.data() + (upper_layers[j].second - begin), linkListSize);
+                    }
+                });
+
+                if (scan_deletions) {
+                    std::atomic<bool> has_deletions(false);
+                    ParallelFor(0, cur_element_count, worker_threads, [&](size_t i, size_t threadId) {
+                        if (isMarkedDeleted(i))
+                            has_deletions = true;
+                    }, element_chunk);
+                    has_deletions_ = has_deletions.load();
                 }
+            } catch (...) {
+                if (label_thread.joinable())
+                    label_thread.join();
+                throw;
             }
 
-            has_deletions_=false;
+            if (label_thread.joinable())
+                label_thread.join();
+            else
+                buildLabelLookup();
+        }
 
+        void loadIndexSections(std::ifstream &input, const std::string &location, const IndexFileHeader &header,
+                               SpaceInterface<dist_t> *s, uint64_t total_filesize, size_t max_elements_i,
+                               size_t num_threads) {
+            readIndexFileHeader(header, s, total_filesize);
+            const IndexFileSection *sections = header.sections;
+
+            size_t max_elements = max_elements_i;
+            if (max_elements < cur_element_count)
+                max_elements = max_elements_;
+            max_elements_ = max_elements;
+
+            std::vector<uint64_t> upper_offsets(cur_element_count + 1);
+            input.seekg(sections[SECTION_UPPER_OFFSETS].offset, input.beg);
+            input.read((char *) upper_offsets.data(), sections[SECTION_UPPER_OFFSETS].size);
+            checkUpperLayerOffsets(upper_offsets.data(), header);
+
+            element_levels_ = std::vector<int>(max_elements);
+            std::vector<std::pair<tableint, uint64_t>> upper_layers;
             for (size_t i = 0; i < cur_element_count; i++) {
-                if(isMarkedDeleted(i))
-                    has_deletions_=true;
+                size_t linkListSize = upper_offsets[i + 1] - upper_offsets[i];
+                element_levels_[i] = linkListSize / size_links_per_element_;
+                if (linkListSize)
+                    upper_layers.emplace_back(i, sections[SECTION_UPPER_LINKS].offset + upper_offsets[i]);
             }
-            
+            std::vector<uint64_t>().swap(upper_offsets);
+
+            data_level0_memory_ = (char *) allocateLarge(max_elements * size_data_per_element_, huge_pages_);
+            if (data_level0_memory_ == nullptr)
+                throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
+            split_layout_ = false;
+            level0_ = level0Layout(data_level0_memory_, max_elements, false);
+
+            std::vector<std::mutex>(max_elements).swap(link_list_locks_);
+            std::vector<std::atomic<unsigned int>>(max_elements).swap(link_list_versions_);
+            createVisitedListPools(max_elements);
+
+            linkLists_ = (char **) allocateLarge(sizeof(void *) * max_elements, huge_pages_);
+            if (linkLists_ == nullptr)
+                throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
+
+            loadElements(location, sections[SECTION_LEVEL0].offset, upper_layers, num_threads, false);
+            has_deletions_ = header.has_deletions != 0;
+        }
+
+        /**
+         * Loads the index into memory. num_threads > 1 (0 means all cores) reads level 0 and the upper layers
+         * in parallel and overlaps the label lookup reconstruction with them.
+         */
+        void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i=0, size_t num_threads=1) {
+            // loaded indexes start without slot reuse, see setReplaceDeleted
+            replace_deleted_ = false;
+            deleted_elements_.clear();
+
+            std::ifstream input(location, std::ios::binary);
+
+            if (!input.is_open())
+                throw std::runtime_error("Cannot open file");
+
+
+            // get file size:
+            input.seekg(0,input.end);
+            std::streampos total_filesize=input.tellg();
+            input.seekg(0,input.beg);
+
+            IndexFileHeader header;
+            input.read((char *) &header, sizeof(header));
+            if (input.gcount() == sizeof(header) && isIndexFileHeader(header.magic)) {
+                loadIndexSections(input, location, header, s, total_filesize, max_elements_i, num_threads);
+                input.close();
+                return;
+            }
+
+            // legacy format: raw parameters followed by level 0 and a stream of upper layer link lists
+            input.clear();
+            input.seekg(0,input.beg);
+
+            readBinaryPOD(input, offsetLevel0_);
+            readBinaryPOD(input, max_elements_);
+            readBinaryPOD(input, cur_element_count);
+
+            size_t max_elements=max_elements_i;
+            if(max_elements < cur_element_count)
+                max_elements = max_elements_;
+            max_elements_ = max_elements;
+            readBinaryPOD(input, size_data_per_element_);
+            readBinaryPOD(input, label_offset_);
+            readBinaryPOD(input, offsetData_);
+            readBinaryPOD(input, maxlevel_);
+            readBinaryPOD(input, enterpoint_node_);
+
+            readBinaryPOD(input, maxM_);
+            readBinaryPOD(input, maxM0_);
+            readBinaryPOD(input, M_);
+            readBinaryPOD(input, mult_);
+            readBinaryPOD(input, ef_construction_);
+
+
+            setSpace(s);
+
+            auto pos=input.tellg();
+
+            size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+            size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+            element_levels_ = std::vector<int>(max_elements);
+
+            /// Check if index is ok, locating the upper layers on the way:
+            std::vector<std::pair<tableint, uint64_t>> upper_layers;
+
+            input.seekg(cur_element_count * size_data_per_element_,input.cur);
+            for (size_t i = 0; i < cur_element_count; i++) {
+                if(input.tellg() < 0 || input.tellg()>=total_filesize){
+                    throw std::runtime_error("Index seems to be corrupted or unsupported");
+                }
+
+                unsigned int linkListSize;
+                readBinaryPOD(input, linkListSize);
+                element_levels_[i] = linkListSize / size_links_per_element_;
+                if (linkListSize != 0) {
+                    upper_layers.emplace_back(i, (uint64_t) input.tellg());
+                    input.seekg(linkListSize,input.cur);
+                }
+            }
+
+            // throw exception if it either corrupted or old index
+            if(input.tellg()!=total_filesize)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+
             input.close();
 
+            data_level0_memory_ = (char *) allocateLarge(max_elements * size_data_per_element_, huge_pages_);
+            if (data_level0_memory_ == nullptr)
+                throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
+            split_layout_ = false;
+            level0_ = level0Layout(data_level0_memory_, max_elements, false);
+
+            std::vector<std::mutex>(max_elements).swap(link_list_locks_);
+            std::vector<std::atomic<unsigned int>>(max_elements).swap(link_list_versions_);
+
+
+            createVisitedListPools(max_elements);
+
+
+            linkLists_ = (char **) allocateLarge(sizeof(void *) * max_elements, huge_pages_);
+            if (linkLists_ == nullptr)
+                throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
+            revSize_ = 1.0 / mult_;
+            ef_ = 10;
+
+            loadElements(location, pos, upper_layers, num_threads, true);
+
             return;
         }
 
+        /**
+         * Serves the index read-only from a memory mapping of the file instead of copying it to the heap.
+         * Level 0 and the upper-layer link lists are used in place; only the label lookup, the element
+         * levels and the link list pointers are built in memory. The index cannot be modified or resized.
+         */
+        void loadIndexMmap(const std::string &location, SpaceInterface<dist_t> *s) {
+            MappedFile *mapped_file = new MappedFile(location);
+            const char *file_data = mapped_file->data();
+            size_t total_filesize = mapped_file->size();
+
+            if (total_filesize >= sizeof(IndexFileHeader) && isIndexFileHeader(file_data)) {
+                try {
+                    loadIndexSectionsMmap(mapped_file, s);
+                } catch (...) {
+                    mapped_file_ = nullptr;
+                    delete mapped_file;
+                    throw;
+                }
+                return;
+            }
+
+            // legacy format: the link list stream has to be walked to locate the upper layers
+            size_t pos = 0;
+
+            bool corrupted = false;
+            auto readMappedPOD = [&](void *podRef, size_t size) {
+                if (pos + size > total_filesize) {
+                    corrupted = true;
+                    return;
+                }
+                memcpy(podRef, file_data + pos, size);
+                pos += size;
+            };
+
+            readMappedPOD(&offsetLevel0_, sizeof(offsetLevel0_));
+            readMappedPOD(&max_elements_, sizeof(max_elements_));
+            readMappedPOD(&cur_element_count, sizeof(cur_element_count));
+            readMappedPOD(&size_data_per_element_, sizeof(size_data_per_element_));
+            readMappedPOD(&label_offset_, sizeof(label_offset_));
+            readMappedPOD(&offsetData_, sizeof(offsetData_));
+            readMappedPOD(&maxlevel_, sizeof(maxlevel_));
+            readMappedPOD(&enterpoint_node_, sizeof(enterpoint_node_));
+            readMappedPOD(&maxM_, sizeof(maxM_));
+            readMappedPOD(&maxM0_, sizeof(maxM0_));
+            readMappedPOD(&M_, sizeof(M_));
+            readMappedPOD(&mult_, sizeof(mult_));
+            readMappedPOD(&ef_construction_, sizeof(ef_construction_));
+
+            size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+            size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+
+            size_t level0_pos = pos;
+            if (!corrupted && cur_element_count * size_data_per_element_ <= total_filesize - pos)
+                pos += cur_element_count * size_data_per_element_;
+            else
+                corrupted = true;
+
+            /// Check that the link list stream covers the rest of the file before using it
+            size_t upper_layers_pos = pos;
+            for (size_t i = 0; i < cur_element_count && !corrupted; i++) {
+                unsigned int linkListSize = 0;
+                readMappedPOD(&linkListSize, sizeof(linkListSize));
+                if (linkListSize > total_filesize - pos)
+                    corrupted = true;
+                else
+                    pos += linkListSize;
+            }
+            if (corrupted || pos != total_filesize) {
+                delete mapped_file;
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            }
+
+            linkLists_ = (char **) allocateLarge(sizeof(void *) * std::max((size_t) cur_element_count, (size_t) 1), huge_pages_);
+            if (linkLists_ == nullptr) {
+                delete mapped_file;
+                throw std::runtime_error("Not enough memory: loadIndexMmap failed to allocate linklists");
+            }
+            mapped_file_ = mapped_file;
+
+            // a mapped index cannot grow
+            max_elements_ = cur_element_count;
+
+            setSpace(s);
+
+            data_level0_memory_ = (char *) file_data + level0_pos;
+            split_layout_ = false;
+            level0_ = level0Layout(data_level0_memory_, cur_element_count, false);
+
+            pos = upper_layers_pos;
+            element_levels_ = std::vector<int>(cur_element_count);
+            for (size_t i = 0; i < cur_element_count; i++) {
+                unsigned int linkListSize = 0;
+                readMappedPOD(&linkListSize, sizeof(linkListSize));
+                if (linkListSize == 0) {
+                    element_levels_[i] = 0;
+                    linkLists_[i] = nullptr;
+                } else {
+                    element_levels_[i] = linkListSize / size_links_per_element_;
+                    linkLists_[i] = (char *) file_data + pos;
+                    pos += linkListSize;
+                }
+            }
+            // cannot fail after the check of the stream above, kept so that no read of the mapping goes unchecked
+            if (corrupted) {
+                freeLarge(linkLists_);
+                linkLists_ = nullptr;
+                mapped_file_ = nullptr;
+                delete mapped_file;
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            }
+
+            // searches never take the link list locks, so they are not allocated for a read-only index
+            std::vector<std::mutex>().swap(link_list_locks_);
+            std::vector<std::atomic<unsigned int>>(cur_element_count).swap(link_list_versions_);
+            createVisitedListPools(cur_element_count);
+
+            revSize_ = 1.0 / mult_;
+            ef_ = 10;
+
+            has_deletions_ = false;
+            label_lookup_.reserve(cur_element_count);
+            for (size_t i = 0; i < cur_element_count; i++) {
+                label_lookup_.insert(getExternalLabel(i), i);
+                if (isMarkedDeleted(i))
+                    has_deletions_ = true;
+            }
+        }
+
+        void loadIndexSectionsMmap(MappedFile *mapped_file, SpaceInterface<dist_t> *s) {
+            const char *file_data = mapped_file->data();
+            IndexFileHeader header;
+            memcpy(&header, file_data, sizeof(header));
+            readIndexFileHeader(header, s, mapped_file->size());
+            const IndexFileSection *sections = header.sections;
+
+            const uint64_t *upper_offsets = (const uint64_t *) (file_data + sections[SECTION_UPPER_OFFSETS].offset);
+            const labeltype *labels = (const labeltype *) (file_data + sections[SECTION_LABELS].offset);
+            char *upper_links = (char *) file_data + sections[SECTION_UPPER_LINKS].offset;
+            checkUpperLayerOffsets(upper_offsets, header);
+
+            linkLists_ = (char **) allocateLarge(sizeof(void *) * std::max((size_t) cur_element_count, (size_t) 1), huge_pages_);
+            if (linkLists_ == nullptr)
+                throw std::runtime_error("Not enough memory: loadIndexMmap failed to allocate linklists");
+            mapped_file_ = mapped_file;
+
+            // a mapped index cannot grow
+            max_elements_ = cur_element_count;
+            data_level0_memory_ = (char *) file_data + sections[SECTION_LEVEL0].offset;
+            split_layout_ = false;
+            level0_ = level0Layout(data_level0_memory_, cur_element_count, false);
+
+            element_levels_ = std::vector<int>(cur_element_count);
+            for (size_t i = 0; i < cur_element_count; i++) {
+                size_t linkListSize = upper_offsets[i + 1] - upper_offsets[i];
+                element_levels_[i] = linkListSize / size_links_per_element_;
+                linkLists_[i] = linkListSize ? upper_links + upper_offsets[i] : nullptr;
+            }
+
+            std::vector<std::mutex>().swap(link_list_locks_);
+            std::vector<std::atomic<unsigned int>>(cur_element_count).swap(link_list_versions_);
+            createVisitedListPools(cur_element_count);
+
+            // the label table and the deletion flag spare touching level 0 at load time
+            label_lookup_.reserve(cur_element_count);
+            for (size_t i = 0; i < cur_element_count; i++) {
+                label_lookup_.insert(labels[i], i);
+            }
+            has_deletions_ = header.has_deletions != 0;
+        }
+
+        bool isReadOnly() const {
+            return mapped_file_ != nullptr;
+        }
+
+        // how the level 0 memory ended up being backed, huge pages may not be available
+        PageBacking getPageBacking() const {
+            if (mapped_file_ != nullptr)
+                return PAGES_FILE_MAPPING;
+            return largeBacking(data_level0_memory_);
+        }
+
+        void checkWritable() const {
+            if (mapped_file_ != nullptr)
+                throw std::runtime_error("The index is memory-mapped read-only and cannot be modified");
+        }
+
         template<typename data_t>
         std::vector<data_t> getDataByLabel(labeltype label)
         {
             tableint label_c;
-            auto search = label_lookup_.find(label);
-            if (search == label_lookup_.end() || isMarkedDeleted(search->second)) {
+            if (!label_lookup_.find(label, label_c) || isMarkedDeleted(label_c)) {
                 throw std::runtime_error("Label not found");
             }
-            label_c = search->second;
 
             char* data_ptrv = getDataByInternalId(label_c);
-            size_t dim = *((size_t *) dist_func_param_);
+            if (has_encoder_) {
+                std::vector<data_t> data(input_size_ / sizeof(data_t));
+                space_->decode(data_ptrv, data.data());
+                return data;
+            }
+            size_t dim = space_->get_dim();
             std::vector<data_t> data;
             data_t* data_ptr = (data_t*) data_ptrv;
-            for (int i = 0; i < dim; i++) {
+            for (size_t i = 0; i < dim; i++) {
                 data.push_back(*data_ptr);
                 data_ptr += 1;
             }
@@ -746,12 +1871,132 @@ namespace hnswlib {
          */
         void markDelete(labeltype label)
         {
-            has_deletions_=true;
-            auto search = label_lookup_.find(label);
-            if (search == label_lookup_.end()) {
+            checkWritable();
+            std::unique_lock <std::mutex> lock(cur_element_count_guard_, std::defer_lock);
+            if (replace_deleted_)
+                lock.lock();
+            tableint internal_id;
+            if (!label_lookup_.find(label, internal_id)) {
                 throw std::runtime_error("Label not found");
             }
-            markDeletedInternal(search->second);
+            // waits for an insert of the element that is still running
+            std::unique_lock <std::mutex> lock_el(link_list_locks_[internal_id]);
+            markDeletedElement(internal_id);
+        }
+
+        /**
+         * Marks an element deleted and, with replace_deleted_, hands its slot to a later insert. The caller holds
+         * the lock of the element and, with replace_deleted_, cur_element_count_guard_.
+         */
+        void markDeletedElement(tableint internal_id) {
+            if (isMarkedDeleted(internal_id))
+                return;
+            has_deletions_ = true;
+            markDeletedInternal(internal_id);
+            if (replace_deleted_)
+                deleted_elements_.push_back(internal_id);
+        }
+
+        /**
+         * With replace_deleted inserts of new elements take the slots of deleted elements first and the index
+         * stops growing under churn. When a slot is taken the elements linking to the deleted one are linked
+         * around it (repairNeighborsOfDeleted) and the slot is linked in again for the new vector, keeping its
+         * level. Only the elements within two links of the deleted one are repaired, a rare one further away keeps
+         * a link that leads to the new vector. Turning it on collects the elements deleted so far. Must not be called while inserts are running.
+         * Searches passing the slot while it is replaced may compute a distance to the partly written vector, that
+         * only steers their walk: the element stays marked deleted until it is linked again.
+         */
+        void setReplaceDeleted(bool replace_deleted) {
+            checkWritable();
+            replace_deleted_ = replace_deleted;
+            deleted_elements_.clear();
+            if (!replace_deleted)
+                return;
+            for (tableint i = 0; i < cur_element_count; i++) {
+                if (isMarkedDeleted(i))
+                    deleted_elements_.push_back(i);
+            }
+        }
+
+        bool isReplaceDeleted() const {
+            return replace_deleted_;
+        }
+
+        /**
+         * Takes the element out of the lists of the elements linking to it before its slot is reused. They are
+         * looked for among its neighbors and their neighbors, where the heuristic keeps nearly all of them; one
+         * further away keeps its link, which leads to the new vector of the slot afterwards. Each one found gets a
+         * new list, chosen by the heuristic from its own neighbors and those of the deleted element, so paths
+         * through the deleted element are kept. The caller holds no link list lock: the lists of the element
+         * are read like a search reads them, and every other element is locked alone, waiting for an insert
+         * that holds it.
+         */
+        void repairNeighborsOfDeleted(tableint internal_id) {
+            std::vector<tableint> removed_links(maxM0_);
+            std::vector<tableint> links(maxM0_);
+            std::vector<tableint> linking;
+            std::vector<tableint> seen;
+            for (int level = 0; level <= element_levels_[internal_id]; level++) {
+                removed_links.resize(maxM0_);
+                removed_links.resize(readLinkList(internal_id, level, removed_links.data()));
+                size_t Mcurmax = level ? maxM_ : maxM0_;
+
+                linking = removed_links;
+                for (tableint neighbor : removed_links) {
+                    if (level > element_levels_[neighbor])
+                        continue;
+                    size_t size = readLinkList(neighbor, level, links.data());
+                    linking.insert(linking.end(), links.begin(), links.begin() + size);
+                }
+                std::sort(linking.begin(), linking.end());
+                linking.erase(std::unique(linking.begin(), linking.end()), linking.end());
+
+                for (tableint neighbor : linking) {
+                    if (neighbor == internal_id || isMarkedDeleted(neighbor) || level > element_levels_[neighbor])
+                        continue;
+                    std::unique_lock <std::mutex> lock(link_list_locks_[neighbor]);
+                    linklistsizeint *ll_other = level == 0 ? get_linklist0(neighbor) : get_linklist(neighbor, level);
+                    size_t sz_link_list_other = getListCount(ll_other);
+                    tableint *data = (tableint *) (ll_other + 1);
+                    if (std::find(data, data + sz_link_list_other, internal_id) == data + sz_link_list_other)
+                        continue;
+
+                    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+                    seen.assign(data, data + sz_link_list_other);
+                    seen.insert(seen.end(), removed_links.begin(), removed_links.end());
+                    std::sort(seen.begin(), seen.end());
+                    seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+                    for (tableint cand : seen) {
+                        if (cand == internal_id || cand == neighbor)
+                            continue;
+                        candidates.emplace(elementDistance(getDataByInternalId(cand), getDataByInternalId(neighbor)), cand);
+                    }
+                    getNeighborsByHeuristic2(candidates, Mcurmax);
+
+                    beginLinkListWrite(neighbor);
+                    int indx = 0;
+                    while (candidates.size() > 0) {
+                        storeRelaxed(data + indx, candidates.top().second);
+                        candidates.pop();
+                        indx++;
+                    }
+                    setListCount(ll_other, indx);
+                    endLinkListWrite(neighbor);
+                }
+            }
+        }
+
+        // empties a list of an element whose slot is reused, the deletion mark stays
+        void clearLinkList(tableint internal_id, int level) {
+            linklistsizeint *ll = level == 0 ? get_linklist0(internal_id) : get_linklist(internal_id, level);
+            tableint *data = (tableint *) (ll + 1);
+            size_t Mcurmax = level ? maxM_ : maxM0_;
+            beginLinkListWrite(internal_id);
+            // past the count too, shortened lists leave old entries behind
+            for (size_t j = 0; j < Mcurmax; j++)
+                storeRelaxed(data + j, (tableint) 0);
+            setListCount(ll, 0);
+            endLinkListWrite(internal_id);
         }
 
         /**
@@ -761,7 +2006,7 @@ namespace hnswlib {
          */
         void markDeletedInternal(tableint internalId) {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId))+2;
-            *ll_cur |= DELETE_MARK;
+            storeRelaxed(ll_cur, (unsigned char) (loadRelaxed(ll_cur) | DELETE_MARK));
         }
 
         /**
@@ -770,7 +2015,7 @@ namespace hnswlib {
          */
         void unmarkDeletedInternal(tableint internalId) {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId))+2;
-            *ll_cur &= ~DELETE_MARK;
+            storeRelaxed(ll_cur, (unsigned char) (loadRelaxed(ll_cur) & ~DELETE_MARK));
         }
 
         /**
@@ -780,7 +2025,7 @@ namespace hnswlib {
          */
         bool isMarkedDeleted(tableint internalId) const {
             unsigned char *ll_cur = ((unsigned char*)get_linklist0(internalId))+2;
-            return *ll_cur & DELETE_MARK;
+            return loadRelaxed(ll_cur) & DELETE_MARK;
         }
 
         unsigned short int getListCount(linklistsizeint * ptr) const {
@@ -788,7 +2033,60 @@ namespace hnswlib {
         }
 
         void setListCount(linklistsizeint * ptr, unsigned short int size) const {
-            *((unsigned short int*)(ptr))=*((unsigned short int *)&size);
+            storeRelaxed((unsigned short int *) ptr, size);
+        }
+
+        // writers hold link_list_locks_[internal_id] and change the lists of the element in between
+        void beginLinkListWrite(tableint internal_id) {
+            std::atomic<unsigned int> &version = link_list_versions_[internal_id];
+            version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        void endLinkListWrite(tableint internal_id) {
+            std::atomic<unsigned int> &version = link_list_versions_[internal_id];
+            version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        /**
+         * Copies the link list of internal_id at level to links (room for maxM0_ ids) and returns its size.
+         * Searches do not take link_list_locks_: the copy is retried while an insert changes the lists of the
+         * element, so a search always sees a complete list and every element it reaches is fully written.
+         */
+        size_t readLinkList(tableint internal_id, int level, tableint *links) const {
+            const std::atomic<unsigned int> &version = link_list_versions_[internal_id];
+            linklistsizeint *ll = level == 0 ? get_linklist0(internal_id) : get_linklist(internal_id, level);
+            const tableint *data = (const tableint *) (ll + 1);
+            size_t max_size = level == 0 ? maxM0_ : maxM_;
+            while (true) {
+                unsigned int before = version.load(std::memory_order_acquire);
+                if ((before & 1) == 0) {
+                    size_t size = loadRelaxed((const unsigned short int *) ll);
+                    if (size <= max_size) {
+                        for (size_t j = 0; j < size; j++)
+                            links[j] = loadRelaxed(data + j);
+                        std::atomic_thread_fence(std::memory_order_acquire);
+                        if (version.load(std::memory_order_relaxed) == before)
+                            return size;
+                    }
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        /**
+         * Takes n slots after the last element and returns the first. Their level 0 lists, which hold the delete
+         * marks, are cleared.
+         */
+        tableint reserveElements(size_t n) {
+            size_t first = cur_element_count;
+            do {
+                if (first + n > max_elements_)
+                    throw std::runtime_error("The number of elements exceeds the specified limit");
+            } while (!cur_element_count.compare_exchange_weak(first, first + n));
+            for (size_t i = first; i < first + n; i++)
+                memset(get_linklist0(i), 0, size_links_level0_);
+            return first;
         }
 
         void addPoint(const void *data_point, labeltype label) {
@@ -796,108 +2094,130 @@ namespace hnswlib {
         }
 
         tableint addPoint(const void *data_point, labeltype label, int level) {
+            checkWritable();
             tableint cur_c = 0;
+            int curlevel;
+            // the slot of a deleted element is taken, see setReplaceDeleted
+            bool replacing = false;
             {
-                std::unique_lock <std::mutex> lock(cur_element_count_guard_);
-                if (cur_element_count >= max_elements_) {
-                    throw std::runtime_error("The number of elements exceeds the specified limit");
-                };
-
-                cur_c = cur_element_count;
-                cur_element_count++;
-
-                auto search = label_lookup_.find(label);
-                if (search != label_lookup_.end()) {
-                    std::unique_lock <std::mutex> lock_el(link_list_locks_[search->second]);
-                    has_deletions_ = true;
-                    markDeletedInternal(search->second);
+                std::unique_lock <std::mutex> lock_el;
+                // no lock shared by all inserts without replace_deleted: the slot is taken with an atomic add
+                std::unique_lock <std::mutex> lock(cur_element_count_guard_, std::defer_lock);
+                tableint previous;
+                if (replace_deleted_) {
+                    lock.lock();
+                    // the element replaced by the label may give its own slot, the label is gone until the new
+                    // element is linked
+                    if (label_lookup_.find(label, previous)) {
+                        std::unique_lock <std::mutex> lock_old(link_list_locks_[previous]);
+                        markDeletedElement(previous);
+                        label_lookup_.erase(label, previous);
+                    }
+                }
+                if (replace_deleted_ && !deleted_elements_.empty()) {
+                    cur_c = deleted_elements_.back();
+                    deleted_elements_.pop_back();
+                    replacing = true;
+                    // the old label is gone, unless it was added again and points elsewhere
+                    label_lookup_.erase(getExternalLabel(cur_c), cur_c);
+                    curlevel = element_levels_[cur_c];
+                } else {
+                    cur_c = reserveElements(1);
+                    curlevel = level > 0 ? level : getRandomLevel(mult_);
+                    element_levels_[cur_c] = curlevel;
                 }
-                label_lookup_[label] = cur_c;
+                if (lock.owns_lock())
+                    lock.unlock();
+                // before the slot is locked: the repair waits for the lock of each neighbor, holding no other
+                if (replacing)
+                    repairNeighborsOfDeleted(cur_c);
+                lock_el = std::unique_lock <std::mutex>(link_list_locks_[cur_c]);
+                insertElement(cur_c, curlevel, data_point, label, replacing);
             }
+            publishLabel(label, cur_c);
+            return cur_c;
+        };
 
-            std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
-            int curlevel = getRandomLevel(mult_);
-            if (level > 0)
-                curlevel = level;
-
-            element_levels_[cur_c] = curlevel;
-
+        /**
+         * Points label at the element id once insertElement has stored its vector and links, a lookup never finds
+         * a partly written element. The element the label pointed at before is marked deleted.
+         */
+        void publishLabel(labeltype label, tableint id) {
+            tableint previous;
+            if (!label_lookup_.exchange(label, id, previous))
+                return;
+            std::unique_lock <std::mutex> lock_deleted(cur_element_count_guard_, std::defer_lock);
+            if (replace_deleted_)
+                lock_deleted.lock();
+            std::unique_lock <std::mutex> lock_old(link_list_locks_[previous]);
+            markDeletedElement(previous);
+        }
 
-            std::unique_lock <std::mutex> templock(global);
+        /**
+         * Links the element in slot cur_c into the graph, its level and label are assigned and the caller holds
+         * its lock. With replacing the slot belonged to a deleted element whose neighbors were repaired
+         * (repairNeighborsOfDeleted); its lists stay until each level is linked again, searches may still pass
+         * through the slot.
+         */
+        void insertElement(tableint cur_c, int curlevel, const void *data_point, labeltype label, bool replacing) {
+            // only an element raising the top level holds global, until it is linked
+            std::unique_lock <std::mutex> templock(global, std::defer_lock);
             int maxlevelcopy = maxlevel_;
-            if (curlevel <= maxlevelcopy)
-                templock.unlock();
+            if (curlevel > maxlevelcopy) {
+                templock.lock();
+                maxlevelcopy = maxlevel_;
+                if (curlevel <= maxlevelcopy)
+                    templock.unlock();
+            }
             tableint currObj = enterpoint_node_;
             tableint enterpoint_copy = enterpoint_node_;
 
-
-            memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
+            memset(getDataByInternalId(cur_c), 0, data_size_);
 
             // Initialisation of the data and label
             memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
-            memcpy(getDataByInternalId(cur_c), data_point, data_size_);
+            if (has_encoder_) {
+                space_->encode(data_point, getDataByInternalId(cur_c));
+                // the graph is built on the stored codes
+                data_point = getDataByInternalId(cur_c);
+            } else {
+                memcpy(getDataByInternalId(cur_c), data_point, data_size_);
+            }
 
 
-            if (curlevel) {
-                linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * curlevel + 1);
-                if (linkLists_[cur_c] == nullptr)
-                    throw std::runtime_error("Not enough memory: addPoint failed to allocate linklist");
-                memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
+            if (curlevel && !replacing) {
+                linkLists_[cur_c] = link_list_arena_.allocate(size_links_per_element_ * curlevel);
+                memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel);
             }
 
             if ((signed)currObj != -1) {
 
-                if (curlevel < maxlevelcopy) {
-
-                    dist_t curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
-                    for (int level = maxlevelcopy; level > curlevel; level--) {
-
-
-                        bool changed = true;
-                        while (changed) {
-                            changed = false;
-                            unsigned int *data;
-                            std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
-                            data = get_linklist(currObj,level);
-                            int size = getListCount(data);
-
-                            tableint *datal = (tableint *) (data + 1);
-                            for (int i = 0; i < size; i++) {
-                                tableint cand = datal[i];
-                                if (cand < 0 || cand > max_elements_)
-                                    throw std::runtime_error("cand error");
-                                dist_t d = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
-                                if (d < curdist) {
-                                    curdist = d;
-                                    currObj = cand;
-                                    changed = true;
-                                }
-                            }
-                        }
-                    }
-                }
-
                 bool epDeleted = isMarkedDeleted(enterpoint_copy);
                 for (int level = std::min(curlevel, maxlevelcopy); level >= 0; level--) {
                     if (level > maxlevelcopy || level < 0)  // possible?
                         throw std::runtime_error("Level error");
 
+                    // the first search descends from the top of the index to the level of the new element
                     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates = searchBaseLayer(
-                            currObj, data_point, level);
-                    if (epDeleted) {
-                        top_candidates.emplace(fstdistfunc_(data_point, getDataByInternalId(enterpoint_copy), dist_func_param_), enterpoint_copy);
+                            currObj, data_point, level, level == std::min(curlevel, maxlevelcopy) ? maxlevelcopy : level);
+                    if (epDeleted && enterpoint_copy != cur_c) {
+                        top_candidates.emplace(elementDistance(data_point, getDataByInternalId(enterpoint_copy)), enterpoint_copy);
                         if (top_candidates.size() > ef_construction_)
                             top_candidates.pop();
                     }
+                    if (replacing)
+                        clearLinkList(cur_c, level);
                     mutuallyConnectNewElement(data_point, cur_c, top_candidates, level);
 
-                    currObj = top_candidates.top().second;
+                    // only a replaced element can be left without candidates, when all the others are deleted
+                    if (!top_candidates.empty())
+                        currObj = top_candidates.top().second;
                 }
 
 
             } else {
                 // Do nothing for the first element
-                enterpoint_node_ = 0;
+                enterpoint_node_ = cur_c;
                 maxlevel_ = curlevel;
 
             }
@@ -907,31 +2227,252 @@ namespace hnswlib {
                 enterpoint_node_ = cur_c;
                 maxlevel_ = curlevel;
             }
-            return cur_c;
-        };
+            if (replacing) {
+                // the vector and the label are visible before the element can be a result
+                std::atomic_thread_fence(std::memory_order_release);
+                unmarkDeletedInternal(cur_c);
+            }
+        }
 
-        std::priority_queue<std::pair<dist_t, labeltype >>
-        searchKnn(const void *query_data, size_t k) const {
-            std::priority_queue<std::pair<dist_t, labeltype >> result;
-            if (cur_element_count == 0) return result;
+        /**
+         * Inserts n vectors stored one after another at data, in the format addPoint takes, with labels[i]
+         * (nullptr: consecutive labels from the current element count) on num_threads threads (0 means all
+         * cores). Scales better than addPoint called from several threads: slots and levels are assigned in
+         * one pass, the elements with upper layers are inserted first, the highest one alone, and the level 0
+         * elements after them only contend on the link lists they change. A label is looked up only once its
+         * element is linked; existing labels are replaced like in addPoint. With replace_deleted while deleted
+         * slots are free the elements go through addPoint.
+         */
+        void buildFrom(const void *data, const labeltype *labels, size_t n, size_t num_threads = 0) {
+            checkWritable();
+            const char *input = (const char *) data;
+            std::unique_lock <std::mutex> lock(cur_element_count_guard_, std::defer_lock);
+            if (replace_deleted_) {
+                lock.lock();
+                if (!deleted_elements_.empty()) {
+                    lock.unlock();
+                    labeltype first_label = cur_element_count;
+                    ParallelFor(0, n, num_threads, [&](size_t i, size_t threadId) {
+                        addPoint(input + i * input_size_, labels ? labels[i] : first_label + i);
+                    });
+                    return;
+                }
+            }
+
+            tableint first = reserveElements(n);
+            if (lock.owns_lock())
+                lock.unlock();
+            for (size_t i = 0; i < n; i++)
+                element_levels_[first + i] = getRandomLevel(mult_);
+            auto labelOf = [&](tableint id) {
+                return labels ? labels[id - first] : (labeltype) id;
+            };
+
+            // of elements of the batch with the same label only the last one gets it, the earlier ones are
+            // inserted and marked deleted like after addPoint called for each
+            std::vector<tableint> superseded;
+            if (labels) {
+                std::vector<std::pair<labeltype, tableint>> by_label(n);
+                for (size_t i = 0; i < n; i++)
+                    by_label[i] = std::make_pair(labels[i], first + i);
+                std::sort(by_label.begin(), by_label.end());
+                for (size_t i = 0; i + 1 < n; i++) {
+                    if (by_label[i].first == by_label[i + 1].first)
+                        superseded.push_back(by_label[i].second);
+                }
+                std::sort(superseded.begin(), superseded.end());
+            }
+            label_lookup_.reserve(label_lookup_.size() + n);
+
+            auto insert = [&](tableint id) {
+                {
+                    std::unique_lock <std::mutex> lock_el(link_list_locks_[id]);
+                    insertElement(id, element_levels_[id], input + (id - first) * input_size_, labelOf(id), false);
+                }
+                if (!std::binary_search(superseded.begin(), superseded.end(), id))
+                    publishLabel(labelOf(id), id);
+            };
+            std::vector<tableint> upper;
+            for (tableint id = first; id < first + n; id++) {
+                if (element_levels_[id] > 0)
+                    upper.push_back(id);
+            }
+            std::stable_sort(upper.begin(), upper.end(), [&](tableint a, tableint b) {
+                return element_levels_[a] > element_levels_[b];
+            });
+            if (!upper.empty()) {
+                insert(upper[0]);
+                ParallelFor(1, upper.size(), num_threads, [&](size_t i, size_t threadId) {
+                    insert(upper[i]);
+                });
+            }
+            ParallelFor(0, n, num_threads, [&](size_t i, size_t threadId) {
+                if (element_levels_[first + i] == 0)
+                    insert(first + i);
+            }, 64);
+
+            if (!superseded.empty()) {
+                if (replace_deleted_)
+                    lock.lock();
+                for (tableint id : superseded) {
+                    std::unique_lock <std::mutex> lock_el(link_list_locks_[id]);
+                    markDeletedElement(id);
+                }
+            }
+        }
 
+        /**
+         * Replaces the vector of label in place and rewires its neighborhood on every level: its own lists are
+         * chosen by the heuristic among its neighbors and their neighbors, and the neighbors it links or is
+         * linked by select their lists again with the new distance. The index does not grow and no tombstone is
+         * left, at a fraction of the cost of an insert. Meant for vectors that move a little, one that moves far
+         * is linked better by markDelete and addPoint. Searches next to an update may see the old or a partly
+         * written vector of the element.
+         */
+        void updatePoint(const void *data_point, labeltype label) {
+            checkWritable();
+            tableint internal_id;
+            std::unique_lock <std::mutex> lock_el;
+            {
+                std::unique_lock <std::mutex> lock(cur_element_count_guard_, std::defer_lock);
+                if (replace_deleted_)
+                    lock.lock();
+                if (!label_lookup_.find(label, internal_id))
+                    throw std::runtime_error("Label not found");
+                // waits for an insert or update of the element that is still running
+                lock_el = std::unique_lock <std::mutex>(link_list_locks_[internal_id]);
+                if (isMarkedDeleted(internal_id))
+                    throw std::runtime_error("Label not found");
+            }
+
+            char *stored = getDataByInternalId(internal_id);
+            if (has_encoder_) {
+                space_->encode(data_point, stored);
+                data_point = stored;
+            } else {
+                memcpy(stored, data_point, data_size_);
+            }
+
+            // room for a list and the neighbor itself
+            std::vector<tableint> links(maxM0_ + 1);
+            std::vector<tableint> neighbors;
+            std::unordered_set<tableint> seen;
+            for (int level = 0; level <= element_levels_[internal_id]; level++) {
+                linklistsizeint *ll = level == 0 ? get_linklist0(internal_id) : get_linklist(internal_id, level);
+                tableint *data = (tableint *) (ll + 1);
+                size_t size = getListCount(ll);
+                size_t Mcurmax = level ? maxM_ : maxM0_;
+                if (size == 0)
+                    continue;
+                neighbors.assign(data, data + size);
+
+                // the own list, from the neighbors and their neighbors
+                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
+                seen.clear();
+                seen.insert(internal_id);
+                for (size_t i = 0; i < size; i++) {
+                    size_t size_neighbor = readLinkList(neighbors[i], level, links.data());
+                    links[size_neighbor++] = neighbors[i];
+                    for (size_t j = 0; j < size_neighbor; j++) {
+                        tableint cand = links[j];
+                        if (!seen.insert(cand).second || isMarkedDeleted(cand))
+                            continue;
+                        top_candidates.emplace(elementDistance(data_point, getDataByInternalId(cand)), cand);
+                        if (top_candidates.size() > ef_construction_)
+                            top_candidates.pop();
+                    }
+                }
+                getNeighborsByHeuristic2(top_candidates, Mcurmax);
+
+                beginLinkListWrite(internal_id);
+                size_t indx = 0;
+                while (top_candidates.size() > 0) {
+                    tableint cand = top_candidates.top().second;
+                    storeRelaxed(data + indx, cand);
+                    top_candidates.pop();
+                    indx++;
+                    if (std::find(neighbors.begin(), neighbors.end(), cand) == neighbors.end())
+                        neighbors.push_back(cand);
+                }
+                setListCount(ll, indx);
+                endLinkListWrite(internal_id);
+
+                // the old and the new neighbors select again
+                for (tableint neighbor : neighbors) {
+                    if (level > element_levels_[neighbor] || isMarkedDeleted(neighbor))
+                        continue;
+                    // a neighbor held by another writer keeps its list, waiting could deadlock with an update of it
+                    std::unique_lock <std::mutex> lock(link_list_locks_[neighbor], std::try_to_lock);
+                    if (!lock.owns_lock())
+                        continue;
+                    linklistsizeint *ll_other = level == 0 ? get_linklist0(neighbor) : get_linklist(neighbor, level);
+                    size_t sz_link_list_other = getListCount(ll_other);
+                    tableint *data_other = (tableint *) (ll_other + 1);
+                    bool linked = std::find(data_other, data_other + sz_link_list_other, internal_id) != data_other + sz_link_list_other;
+                    bool links_back = std::find(data, data + indx, neighbor) != data + indx;
+                    if (!linked && !links_back)
+                        continue;
+                    // lists with room are not pruned, the changed distance matters only for full ones
+                    if (sz_link_list_other < Mcurmax) {
+                        if (!linked) {
+                            beginLinkListWrite(neighbor);
+                            storeRelaxed(data_other + sz_link_list_other, internal_id);
+                            setListCount(ll_other, sz_link_list_other + 1);
+                            endLinkListWrite(neighbor);
+                        }
+                        continue;
+                    }
+
+                    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+                    if (!linked)
+                        candidates.emplace(elementDistance(data_point, getDataByInternalId(neighbor)), internal_id);
+                    for (size_t j = 0; j < sz_link_list_other; j++) {
+                        candidates.emplace(
+                                elementDistance(getDataByInternalId(data_other[j]), getDataByInternalId(neighbor)), data_other[j]);
+                    }
+                    getNeighborsByHeuristic2(candidates, Mcurmax);
+
+                    beginLinkListWrite(neighbor);
+                    int indx_other = 0;
+                    while (candidates.size() > 0) {
+                        storeRelaxed(data_other + indx_other, candidates.top().second);
+                        candidates.pop();
+                        indx_other++;
+                    }
+                    setListCount(ll_other, indx_other);
+                    endLinkListWrite(neighbor);
+                }
+            }
+        }
+
+        /**
+         * False until the first element is linked in. Inserts count their element before, so searches running
+         * next to inserts check this rather than cur_element_count.
+         */
+        bool hasEntryPoint() const {
+            return enterpoint_node_ != (tableint) -1;
+        }
+
+        /**
+         * Greedy descent through the upper layers, returns the level 0 entry point for the query. links has
+         * room for maxM_ ids.
+         */
+        tableint searchUpperLayers(const void *query_data, tableint *links) const {
+            // an entry point read after maxlevel_ has at least that many levels
+            int maxlevel = maxlevel_;
             tableint currObj = enterpoint_node_;
-            dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+            dist_t curdist = queryDistance(query_data, getDataByInternalId(currObj));
 
-            for (int level = maxlevel_; level > 0; level--) {
+            for (int level = maxlevel; level > 0; level--) {
                 bool changed = true;
                 while (changed) {
                     changed = false;
-                    unsigned int *data;
-
-                    data = (unsigned int *) get_linklist(currObj, level);
-                    int size = getListCount(data);
-                    tableint *datal = (tableint *) (data + 1);
-                    for (int i = 0; i < size; i++) {
-                        tableint cand = datal[i];
-                        if (cand < 0 || cand > max_elements_)
+                    size_t size = readLinkList(currObj, level, links);
+                    for (size_t i = 0; i < size; i++) {
+                        tableint cand = links[i];
+                        if (cand >= max_elements_)
                             throw std::runtime_error("cand error");
-                        dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
+                        dist_t d = queryDistance(query_data, getDataByInternalId(cand));
 
                         if (d < curdist) {
                             curdist = d;
@@ -941,18 +2482,66 @@ namespace hnswlib {
                     }
                 }
             }
+            return currObj;
+        }
+
+        // greedy descent of an element being inserted from level from to level to + 1, see searchUpperLayers
+        tableint descendGreedily(tableint currObj, const void *data_point, int from, int to, tableint *links) const {
+            dist_t curdist = elementDistance(data_point, getDataByInternalId(currObj));
+            for (int level = from; level > to; level--) {
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    size_t size = readLinkList(currObj, level, links);
+                    for (size_t i = 0; i < size; i++) {
+                        tableint cand = links[i];
+                        if (cand >= max_elements_)
+                            throw std::runtime_error("cand error");
+                        dist_t d = elementDistance(data_point, getDataByInternalId(cand));
+                        if (d < curdist) {
+                            curdist = d;
+                            currObj = cand;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+            return currObj;
+        }
+
+        std::priority_queue<std::pair<dist_t, labeltype >>
+        searchKnn(const void *query_data, size_t k) const {
+            std::priority_queue<std::pair<dist_t, labeltype >> result;
+            if (!hasEntryPoint()) return result;
+
+            std::vector<char> query_buffer;
+            const void *query = encodeQuery(query_data, query_buffer);
+            // the base layer search starts with the upper layers
+            tableint currObj = -1;
 
             std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
             if (has_deletions_) {
                 std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates1=searchBaseLayerST<true>(
-                        currObj, query_data, std::max(ef_, k));
+                        currObj, query, searchEf(k));
                 top_candidates.swap(top_candidates1);
             }
             else{
                 std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates1=searchBaseLayerST<false>(
-                        currObj, query_data, std::max(ef_, k));
+                        currObj, query, searchEf(k));
                 top_candidates.swap(top_candidates1);
             }
+            if (rerank_vectors_ != nullptr) {
+                std::vector<std::pair<dist_t, tableint>> candidates;
+                candidates.reserve(top_candidates.size());
+                while (!top_candidates.empty()) {
+                    candidates.push_back(top_candidates.top());
+                    top_candidates.pop();
+                }
+                rerankCandidates(query_data, candidates, k);
+                for (const std::pair<dist_t, tableint> &rez : candidates)
+                    result.push(std::pair<dist_t, labeltype>(rez.first, getExternalLabel(rez.second)));
+                return result;
+            }
             while (top_candidates.size() > k) {
                 top_candidates.pop();
             }
@@ -968,7 +2557,7 @@ namespace hnswlib {
         std::vector<std::pair<dist_t, labeltype>>
         searchKnn(const void* query_data, size_t k, Comp comp) {
             std::vector<std::pair<dist_t, labeltype>> result;
-            if (cur_element_count == 0) return result;
+            if (!hasEntryPoint()) return result;
 
             auto ret = searchKnn(query_data, k);
 
@@ -982,6 +2571,278 @@ namespace hnswlib {
             return result;
         }
 
+        /**
+         * Reusable per-thread search state: the candidate and result heaps (plain vectors driven by
+         * std::push_heap/pop_heap with CompareByFirst), the neighbors waiting for distances and a visited list.
+         * Passing the same context to searchKnn again reuses all of its memory, so steady-state queries do not
+         * allocate. A context must not be shared between threads; it can be used with several indexes.
+         */
+        class SearchContext {
+        public:
+            SearchContext() : vl(nullptr), hash_vl(nullptr) {}
+
+            ~SearchContext() {
+                delete vl;
+                delete hash_vl;
+            }
+
+            SearchContext(const SearchContext &) = delete;
+            SearchContext &operator=(const SearchContext &) = delete;
+
+            SearchContext(SearchContext &&other) : SearchContext() {
+                std::swap(vl, other.vl);
+                std::swap(hash_vl, other.hash_vl);
+                result.swap(other.result);
+                top_candidates.swap(other.top_candidates);
+                candidate_set.swap(other.candidate_set);
+                links.swap(other.links);
+                pending.swap(other.pending);
+                pending_data.swap(other.pending_data);
+                pending_dists.swap(other.pending_dists);
+                query_buffer.swap(other.query_buffer);
+            }
+
+            // results of the last searchKnn call, closest first
+            std::vector<std::pair<dist_t, labeltype>> result;
+
+            // only the visited set of the index's VisitedSetType is allocated
+            VisitedList *vl;
+            VisitedHashSet *hash_vl;
+            std::vector<std::pair<dist_t, tableint>> top_candidates;
+            std::vector<std::pair<dist_t, tableint>> candidate_set;
+            // the link list of current_node and its unvisited neighbors, their vectors and distances
+            std::vector<tableint> links;
+            std::vector<tableint> pending;
+            std::vector<const void *> pending_data;
+            std::vector<dist_t> pending_dists;
+            // the encoded query for spaces with an encoder
+            std::vector<char> query_buffer;
+
+            const void *query;
+            tableint current_node;
+            dist_t lowerBound;
+            bool active;
+        };
+
+        /**
+         * Allocation-free variant of searchKnn: the k nearest neighbors are left in context.result, closest first.
+         */
+        const std::vector<std::pair<dist_t, labeltype>> &
+        searchKnn(const void *query_data, size_t k, SearchContext &context) const {
+            context.result.clear();
+            if (!hasEntryPoint())
+                return context.result;
+
+            if (visited_set_type_ == VISITED_HASH_SET) {
+                if (context.hash_vl == nullptr)
+                    context.hash_vl = new VisitedHashSet(max_elements_);
+                context.hash_vl->reset();
+                searchBaseLayerBatch<VisitedHashSet>((const char *) query_data, 1, searchEf(k), &context);
+            } else {
+                if (context.vl == nullptr || context.vl->numelements < max_elements_) {
+                    delete context.vl;
+                    context.vl = nullptr;
+                    context.vl = new VisitedList(max_elements_);
+                }
+                context.vl->reset();
+                searchBaseLayerBatch<VisitedList>((const char *) query_data, 1, searchEf(k), &context);
+            }
+
+            std::vector<std::pair<dist_t, tableint>> &top_candidates = context.top_candidates;
+            sortCandidates(query_data, top_candidates, k);
+            for (const std::pair<dist_t, tableint> &rez : top_candidates) {
+                context.result.emplace_back(rez.first, getExternalLabel(rez.second));
+            }
+            return context.result;
+        }
+
+        // non-const overload, otherwise the templated Comp overload wins for non-const indexes
+        const std::vector<std::pair<dist_t, labeltype>> &
+        searchKnn(const void *query_data, size_t k, SearchContext &context) {
+            return static_cast<const HierarchicalNSW *>(this)->searchKnn(query_data, k, context);
+        }
+
+        /**
+         * Searches n queries stored one after another (input_size_ bytes each) and writes the k nearest labels
+         * and distances of query i, closest first, to labels[i * k] and distances[i * k].
+         * The base layer walks of group_size queries advance in lockstep one expansion at a time: the link lists
+         * of all current nodes are prefetched first, then the unvisited neighbors of every query are collected
+         * and their vectors prefetched, and only then distances are computed. The memory latency of one query
+         * is hidden behind the work of the others. Queries with fewer than k results are padded with label -1
+         * and the maximum distance; the number of such queries is returned.
+         */
+        size_t searchKnnBatch(const void *queries, size_t n, size_t k, labeltype *labels, dist_t *distances,
+                              size_t group_size = 4) const {
+            if (group_size == 0)
+                group_size = 1;
+            size_t incomplete = 0;
+            std::vector<SearchContext> contexts(std::min(group_size, std::max(n, (size_t) 1)));
+            for (size_t start = 0; start < n; start += group_size) {
+                size_t group = std::min(group_size, n - start);
+                const char *group_queries = (const char *) queries + start * input_size_;
+                bool searchable = hasEntryPoint();
+                if (searchable) {
+                    if (visited_set_type_ == VISITED_HASH_SET)
+                        searchBaseLayerBatch(group_queries, group, searchEf(k), contexts.data(), visited_hash_pool_);
+                    else
+                        searchBaseLayerBatch(group_queries, group, searchEf(k), contexts.data(), visited_list_pool_);
+                }
+
+                for (size_t q = 0; q < group; q++) {
+                    std::vector<std::pair<dist_t, tableint>> &top_candidates = contexts[q].top_candidates;
+                    if (!searchable)
+                        top_candidates.clear();
+                    sortCandidates(group_queries + q * input_size_, top_candidates, k);
+
+                    labeltype *query_labels = labels + (start + q) * k;
+                    dist_t *query_distances = distances + (start + q) * k;
+                    for (size_t i = 0; i < k; i++) {
+                        if (i < top_candidates.size()) {
+                            query_labels[i] = getExternalLabel(top_candidates[i].second);
+                            query_distances[i] = top_candidates[i].first;
+                        } else {
+                            query_labels[i] = (labeltype) -1;
+                            query_distances[i] = std::numeric_limits<dist_t>::max();
+                        }
+                    }
+                    if (top_candidates.size() < k)
+                        incomplete++;
+                }
+            }
+            return incomplete;
+        }
+
+        static VisitedList *&visitedOf(SearchContext &context, VisitedList *) {
+            return context.vl;
+        }
+
+        static VisitedHashSet *&visitedOf(SearchContext &context, VisitedHashSet *) {
+            return context.hash_vl;
+        }
+
+        // runs searchBaseLayerBatch with visited sets borrowed from pool, the contexts must not own any
+        template <typename VisitedT>
+        void searchBaseLayerBatch(const char *queries, size_t group, size_t ef, SearchContext *contexts,
+                                  BasicVisitedListPool<VisitedT> *pool) const {
+            for (size_t q = 0; q < group; q++)
+                visitedOf(contexts[q], (VisitedT *) nullptr) = pool->getFreeVisitedList();
+            searchBaseLayerBatch<VisitedT>(queries, group, ef, contexts);
+            for (size_t q = 0; q < group; q++) {
+                pool->releaseVisitedList(visitedOf(contexts[q], (VisitedT *) nullptr));
+                visitedOf(contexts[q], (VisitedT *) nullptr) = nullptr;
+            }
+        }
+
+        template <typename VisitedT>
+        void searchBaseLayerBatch(const char *queries, size_t group, size_t ef, SearchContext *contexts) const {
+            if (has_deletions_)
+                searchBaseLayerBatch<true, VisitedT>(queries, group, ef, contexts);
+            else
+                searchBaseLayerBatch<false, VisitedT>(queries, group, ef, contexts);
+        }
+
+        /**
+         * Base layer search of group queries advancing in lockstep, see searchKnnBatch.
+         * The contexts need reset visited sets of type VisitedT; the results are left in their top_candidates heaps.
+         */
+        template <bool has_deletions, typename VisitedT>
+        void searchBaseLayerBatch(const char *queries, size_t group, size_t ef, SearchContext *contexts) const {
+            size_t active = 0;
+            for (size_t q = 0; q < group; q++) {
+                SearchContext &st = contexts[q];
+                st.query = encodeQuery(queries + q * input_size_, st.query_buffer);
+                st.top_candidates.clear();
+                st.candidate_set.clear();
+                st.active = true;
+                active++;
+
+                st.links.resize(maxM0_);
+                tableint ep_id = searchUpperLayers(st.query, st.links.data());
+                visitedOf(st, (VisitedT *) nullptr)->visit(ep_id);
+                if (!has_deletions || !isMarkedDeleted(ep_id)) {
+                    dist_t dist = queryDistance(st.query, getDataByInternalId(ep_id));
+                    st.lowerBound = dist;
+                    st.top_candidates.emplace_back(dist, ep_id);
+                    st.candidate_set.emplace_back(-dist, ep_id);
+                } else {
+                    st.lowerBound = std::numeric_limits<dist_t>::max();
+                    st.candidate_set.emplace_back(-st.lowerBound, ep_id);
+                }
+            }
+
+            while (active > 0) {
+                // pick the next node of every query and prefetch its link list
+                for (size_t q = 0; q < group; q++) {
+                    SearchContext &st = contexts[q];
+                    if (!st.active)
+                        continue;
+                    if (st.candidate_set.empty() || (-st.candidate_set.front().first) > st.lowerBound) {
+                        st.active = false;
+                        active--;
+                        continue;
+                    }
+                    st.current_node = st.candidate_set.front().second;
+                    std::pop_heap(st.candidate_set.begin(), st.candidate_set.end(), CompareByFirst());
+                    st.candidate_set.pop_back();
+#ifdef USE_SSE
+                    _mm_prefetch((char *) get_linklist0(st.current_node), _MM_HINT_T0);
+#endif
+                }
+
+                // collect the unvisited neighbors and prefetch their vectors
+                for (size_t q = 0; q < group; q++) {
+                    SearchContext &st = contexts[q];
+                    if (!st.active)
+                        continue;
+                    size_t size = readLinkList(st.current_node, 0, st.links.data());
+                    VisitedT *vl = visitedOf(st, (VisitedT *) nullptr);
+                    st.pending.clear();
+                    st.pending_data.clear();
+                    for (size_t j = 0; j < size; j++) {
+                        tableint candidate_id = st.links[j];
+                        if (!vl->visit(candidate_id))
+                            continue;
+                        char *currObj1 = getDataByInternalId(candidate_id);
+                        st.pending.push_back(candidate_id);
+                        st.pending_data.push_back(currObj1);
+#ifdef USE_SSE
+                        _mm_prefetch(currObj1, _MM_HINT_T0);
+#endif
+                    }
+                }
+
+                // compute the distances and update the heaps
+                for (size_t q = 0; q < group; q++) {
+                    SearchContext &st = contexts[q];
+                    if (!st.active)
+                        continue;
+                    st.pending_dists.resize(st.pending.size());
+                    queryDistances(st.query, st.pending_data.data(), st.pending.size(), st.pending_dists.data());
+                    for (size_t j = 0; j < st.pending.size(); j++) {
+                        tableint candidate_id = st.pending[j];
+                        dist_t dist = st.pending_dists[j];
+                        if (st.top_candidates.size() < ef || st.lowerBound > dist) {
+                            st.candidate_set.emplace_back(-dist, candidate_id);
+                            std::push_heap(st.candidate_set.begin(), st.candidate_set.end(), CompareByFirst());
+
+                            if (!has_deletions || !isMarkedDeleted(candidate_id)) {
+                                st.top_candidates.emplace_back(dist, candidate_id);
+                                std::push_heap(st.top_candidates.begin(), st.top_candidates.end(), CompareByFirst());
+                            }
+
+                            if (st.top_candidates.size() > ef) {
+                                std::pop_heap(st.top_candidates.begin(), st.top_candidates.end(), CompareByFirst());
+                                st.top_candidates.pop_back();
+                            }
+
+                            if (!st.top_candidates.empty())
+                                st.lowerBound = st.top_candidates.front().first;
+                        }
+                    }
+                }
+            }
+        }
+
     };
 
 }
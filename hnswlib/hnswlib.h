@@ -21,9 +21,19 @@
 #else
 #define PORTABLE_ALIGN32 __declspec(align(32))
 #endif
+
+// AVX2 and AVX-512 kernels are built regardless of the -m flags and selected at runtime (see cpu_features.h)
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__clang__) && __clang_major__ >= 6) || (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 8))
+#define USE_RUNTIME_DISPATCH
+#define PORTABLE_TARGET(features) __attribute__((target(features)))
+#endif
 #endif
 
+#include "cpu_features.h"
+
 #include <queue>
+#include <stdexcept>
 #include <vector>
 
 #include <string.h>
@@ -52,6 +62,10 @@ namespace hnswlib {
     template<typename MTYPE>
     using DISTFUNC = MTYPE(*)(const void *, const void *, const void *);
 
+    // distances of one vector to n others: dists[i] = distance(vector, vectors[i])
+    template<typename MTYPE>
+    using BATCHDISTFUNC = void(*)(const void *, const void *const *, size_t, MTYPE *, const void *);
+
 
     template<typename MTYPE>
     class SpaceInterface {
@@ -63,9 +77,114 @@ namespace hnswlib {
 
         virtual void *get_dist_func_param() = 0;
 
+        /*
+         * Spaces that store vectors in another representation than the one they are given (e.g. quantized codes)
+         * override the methods below. get_data_size() is then the size of the stored representation, get_dist_func()
+         * compares two stored vectors and get_query_dist_func() compares a query prepared by encode_query with a
+         * stored vector. encode, decode and encode_query are called concurrently and must not modify the space.
+         */
+        virtual bool has_encoder() {
+            return false;
+        }
+
+        // size of the vectors passed to addPoint and searchKnn
+        virtual size_t get_input_size() {
+            return get_data_size();
+        }
+
+        virtual void encode(const void *vector, void *code) {
+            memcpy(code, vector, get_data_size());
+        }
+
+        virtual void decode(const void *code, void *vector) {
+            memcpy(vector, code, get_data_size());
+        }
+
+        virtual size_t get_query_size() {
+            return get_input_size();
+        }
+
+        virtual void encode_query(const void *query, void *encoded) {
+            memcpy(encoded, query, get_query_size());
+        }
+
+        virtual DISTFUNC<MTYPE> get_query_dist_func() {
+            return get_dist_func();
+        }
+
+        // exact distance between two vectors in the input representation, used to re-rank results
+        virtual DISTFUNC<MTYPE> get_input_dist_func() {
+            return get_dist_func();
+        }
+
+        virtual void *get_input_dist_func_param() {
+            return get_dist_func_param();
+        }
+
+        // number of dimensions of the input vectors, the distance parameter of the plain spaces
+        virtual size_t get_dim() {
+            return *((size_t *) get_dist_func_param());
+        }
+
+        /*
+         * One-to-many forms of get_dist_func() and get_query_dist_func(). The search loops gather the unvisited
+         * neighbors of a node and compute all their distances in one call; nullptr makes them call the
+         * single distance function in a loop.
+         */
+        virtual BATCHDISTFUNC<MTYPE> get_batch_dist_func() {
+            return nullptr;
+        }
+
+        virtual BATCHDISTFUNC<MTYPE> get_query_batch_dist_func() {
+            return has_encoder() ? nullptr : get_batch_dist_func();
+        }
+
         virtual ~SpaceInterface() {}
     };
 
+    /*
+     * Calls a distance function of a space through its pointer or, when StaticDistance is not void, through
+     * StaticDistance::distance, which the compiler can inline (see HierarchicalNSW).
+     */
+    template<typename dist_t, typename StaticDistance>
+    struct DistanceCall {
+        static void checkSpace(SpaceInterface<dist_t> *s) {
+            if (s->has_encoder())
+                throw std::runtime_error("A static distance needs a space without an encoder");
+            if (s->get_dim() != StaticDistance::static_dim)
+                throw std::runtime_error("The static distance does not match the dimension of the space");
+        }
+
+        static inline dist_t call(DISTFUNC<dist_t> func, const void *data1, const void *data2, const void *param) {
+            return StaticDistance::distance(data1, data2, param);
+        }
+
+        static inline void callBatch(BATCHDISTFUNC<dist_t> batch_func, DISTFUNC<dist_t> func, const void *data,
+                                     const void *const *vectors, size_t n, dist_t *dists, const void *param) {
+            for (size_t i = 0; i < n; i++)
+                dists[i] = StaticDistance::distance(data, vectors[i], param);
+        }
+    };
+
+    template<typename dist_t>
+    struct DistanceCall<dist_t, void> {
+        static void checkSpace(SpaceInterface<dist_t> *s) {}
+
+        static inline dist_t call(DISTFUNC<dist_t> func, const void *data1, const void *data2, const void *param) {
+            return func(data1, data2, param);
+        }
+
+        static inline void callBatch(BATCHDISTFUNC<dist_t> batch_func, DISTFUNC<dist_t> func, const void *data,
+                                     const void *const *vectors, size_t n, dist_t *dists, const void *param) {
+            if (batch_func) {
+                batch_func(data, vectors, n, dists, param);
+                return;
+            }
+            for (size_t i = 0; i < n; i++)
+                dists[i] = func(data, vectors[i], param);
+        }
+    };
+
     template<typename dist_t>
     class AlgorithmInterface {
     public:
@@ -84,5 +203,7 @@ namespace hnswlib {
 
 #include "space_l2.h"
 #include "space_ip.h"
+#include "space_half.h"
+#include "space_pq.h"
 #include "bruteforce.h"
 #include "hnswalg.h"
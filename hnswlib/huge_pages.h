@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <unordered_map>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace hnswlib {
+///////////////////////////////////////////////////////////
+//
+// Allocation of the large arrays of an index (level 0, the
+// link list table, visited lists) with optional huge pages.
+// Graph traversal touches these at random, with 4 KB pages
+// most accesses of a big index miss the TLB. Huge pages are
+// tried in the order 1 GB, 2 MB (both need pages reserved
+// through vm.nr_hugepages), transparent huge pages
+// (madvise), and the allocation falls back to malloc. The
+// blocks start at the mapping, so they are aligned to the
+// huge page size; the mapped ones are remembered in a table.
+//
+/////////////////////////////////////////////////////////
+
+    enum PageBacking {
+        PAGES_MALLOC,
+        PAGES_TRANSPARENT_HUGE,
+        PAGES_HUGE_2MB,
+        PAGES_HUGE_1GB,
+        // memory of an index loaded with use_mmap, see MappedFile
+        PAGES_FILE_MAPPING
+    };
+
+    inline const char *pageBackingName(PageBacking backing) {
+        switch (backing) {
+            case PAGES_TRANSPARENT_HUGE: return "transparent huge pages";
+            case PAGES_HUGE_2MB: return "2 MB huge pages";
+            case PAGES_HUGE_1GB: return "1 GB huge pages";
+            case PAGES_FILE_MAPPING: return "file mapping";
+            default: return "malloc";
+        }
+    }
+
+    struct LargeBlock {
+        size_t mapped_size;
+        PageBacking backing;
+    };
+
+    // the mapped blocks by address, blocks not listed come from malloc
+    struct LargeBlockTable {
+        std::mutex guard;
+        std::unordered_map<const void *, LargeBlock> blocks;
+    };
+
+    // one table for all translation units; never destroyed, indexes may be freed during static destruction
+    inline LargeBlockTable &largeBlockTable() {
+        static LargeBlockTable *table = new LargeBlockTable();
+        return *table;
+    }
+
+    static const size_t HUGE_PAGE_2MB = (size_t) 1 << 21;
+    static const size_t HUGE_PAGE_1GB = (size_t) 1 << 30;
+
+#if defined(__linux__)
+    inline char *mapAnonymous(size_t size, int flags) {
+        void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+        return addr == MAP_FAILED ? nullptr : (char *) addr;
+    }
+
+    inline char *mapHugePages(size_t size, PageBacking &backing, size_t &mapped_size) {
+        size_t size_2mb = (size + HUGE_PAGE_2MB - 1) & ~(HUGE_PAGE_2MB - 1);
+        char *block = nullptr;
+#if defined(MAP_HUGETLB)
+        const int huge_shift = 26;  // MAP_HUGE_SHIFT
+        size_t size_1gb = (size + HUGE_PAGE_1GB - 1) & ~(HUGE_PAGE_1GB - 1);
+        // 1 GB pages only when rounding up wastes little
+        if (size >= HUGE_PAGE_1GB && size_1gb - size <= size / 8) {
+            block = mapAnonymous(size_1gb, MAP_HUGETLB | (30 << huge_shift));
+            if (block != nullptr) {
+                backing = PAGES_HUGE_1GB;
+                mapped_size = size_1gb;
+                return block;
+            }
+        }
+        block = mapAnonymous(size_2mb, MAP_HUGETLB | (21 << huge_shift));
+        if (block != nullptr) {
+            backing = PAGES_HUGE_2MB;
+            mapped_size = size_2mb;
+            return block;
+        }
+#endif
+#if defined(MADV_HUGEPAGE)
+        // transparent huge pages need a 2 MB aligned range: map more and trim both ends
+        char *region = mapAnonymous(size_2mb + HUGE_PAGE_2MB, 0);
+        if (region == nullptr)
+            return nullptr;
+        block = (char *) (((size_t) region + HUGE_PAGE_2MB - 1) & ~(HUGE_PAGE_2MB - 1));
+        if (block > region)
+            munmap(region, block - region);
+        munmap(block + size_2mb, region + HUGE_PAGE_2MB - block);
+        madvise(block, size_2mb, MADV_HUGEPAGE);
+        backing = PAGES_TRANSPARENT_HUGE;
+        mapped_size = size_2mb;
+#endif
+        return block;
+    }
+#endif
+
+    /*
+     * malloc replacement for the large arrays: with huge_pages the memory is backed by huge pages where the
+     * system provides them. Blocks have to be released with freeLarge.
+     */
+    inline void *allocateLarge(size_t size, bool huge_pages) {
+#if defined(__linux__)
+        // smaller blocks would not fill a huge page
+        if (huge_pages && size >= HUGE_PAGE_2MB) {
+            LargeBlock block;
+            char *memory = mapHugePages(size, block.backing, block.mapped_size);
+            if (memory != nullptr) {
+                LargeBlockTable &table = largeBlockTable();
+                std::unique_lock <std::mutex> lock(table.guard);
+                table.blocks[memory] = block;
+                return memory;
+            }
+        }
+#endif
+        return malloc(size);
+    }
+
+    inline void freeLarge(void *ptr) {
+        if (ptr == nullptr)
+            return;
+#if defined(__linux__)
+        LargeBlockTable &table = largeBlockTable();
+        std::unique_lock <std::mutex> lock(table.guard);
+        std::unordered_map<const void *, LargeBlock>::iterator it = table.blocks.find(ptr);
+        if (it != table.blocks.end()) {
+            munmap(ptr, it->second.mapped_size);
+            table.blocks.erase(it);
+            return;
+        }
+#endif
+        free(ptr);
+    }
+
+    inline PageBacking largeBacking(const void *ptr) {
+        LargeBlockTable &table = largeBlockTable();
+        std::unique_lock <std::mutex> lock(table.guard);
+        std::unordered_map<const void *, LargeBlock>::const_iterator it = table.blocks.find(ptr);
+        return it == table.blocks.end() ? PAGES_MALLOC : it->second.backing;
+    }
+}
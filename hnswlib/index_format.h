@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <ostream>
+#include <algorithm>
+
+namespace hnswlib {
+///////////////////////////////////////////////////////////
+//
+// Versioned on-disk layout of HierarchicalNSW indexes:
+//
+//   header | level 0 | upper layer offsets | upper layer links | labels
+//
+// Every section starts at a page boundary, so it can be used straight
+// from a memory mapping. The upper layer offsets table holds
+// cur_element_count + 1 byte offsets into the upper layer links
+// section; the link lists of element i span [offsets[i], offsets[i + 1]).
+//
+/////////////////////////////////////////////////////////
+
+    static const char INDEX_FILE_MAGIC[8] = {'H', 'N', 'S', 'W', 'L', 'I', 'B', '\0'};
+    static const uint32_t INDEX_FILE_VERSION = 1;
+    static const uint64_t INDEX_FILE_ALIGNMENT = 4096;
+
+    enum IndexFileSectionId {
+        SECTION_LEVEL0 = 0,
+        SECTION_UPPER_OFFSETS,
+        SECTION_UPPER_LINKS,
+        SECTION_LABELS,
+        SECTION_COUNT
+    };
+
+    struct IndexFileSection {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct IndexFileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size;
+
+        // space descriptor
+        uint64_t data_size;
+        uint64_t dim;
+        uint64_t dist_size;
+
+        // graph parameters
+        uint64_t max_elements;
+        uint64_t cur_element_count;
+        uint64_t size_data_per_element;
+        uint64_t size_links_per_element;
+        uint64_t label_offset;
+        uint64_t offset_data;
+        uint64_t offset_level0;
+        uint64_t maxM;
+        uint64_t maxM0;
+        uint64_t M;
+        uint64_t ef_construction;
+        double mult;
+        int32_t maxlevel;
+        uint32_t enterpoint_node;
+        uint32_t has_deletions;
+        uint32_t reserved;
+
+        IndexFileSection sections[SECTION_COUNT];
+    };
+
+    static inline uint64_t alignIndexFileOffset(uint64_t offset) {
+        return (offset + INDEX_FILE_ALIGNMENT - 1) / INDEX_FILE_ALIGNMENT * INDEX_FILE_ALIGNMENT;
+    }
+
+    static inline bool isIndexFileHeader(const char *magic) {
+        return memcmp(magic, INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC)) == 0;
+    }
+
+    static inline void writeIndexFilePadding(std::ostream &out, uint64_t from, uint64_t to) {
+        static const char zeros[INDEX_FILE_ALIGNMENT] = {0};
+        while (from < to) {
+            uint64_t chunk = std::min<uint64_t>(to - from, INDEX_FILE_ALIGNMENT);
+            out.write(zeros, chunk);
+            from += chunk;
+        }
+    }
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdint.h>
+
+namespace hnswlib {
+///////////////////////////////////////////////////////////
+//
+// Map from labels to internal ids that threads can change at
+// the same time. The labels are spread over shards by a hash,
+// each shard is an open-addressing table with linear probing
+// and its own lock, so inserts of different labels rarely wait
+// for each other. Keys and values are kept in two arrays, 12
+// bytes per slot for 64-bit labels, without the node and bucket
+// allocations of std::unordered_map. The largest value_t marks
+// a free slot and cannot be stored.
+//
+/////////////////////////////////////////////////////////
+
+    template<typename key_t, typename value_t>
+    class LabelMap {
+        static const size_t shard_bits = 6;
+        static const size_t shard_count = (size_t) 1 << shard_bits;
+        static const size_t min_capacity = 16;
+
+        struct Shard {
+            std::mutex guard;
+            std::vector<key_t> keys;
+            std::vector<value_t> values;
+            size_t size = 0;
+        };
+
+        static const value_t empty = std::numeric_limits<value_t>::max();
+
+        mutable Shard shards_[shard_count];
+
+        // splitmix64 finalizer, labels are often consecutive
+        static uint64_t hash(key_t key) {
+            uint64_t h = (uint64_t) key;
+            h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+            return h ^ (h >> 31);
+        }
+
+        // the high bits select the shard, the low bits the slot in it
+        Shard &shardOf(uint64_t h) const {
+            return shards_[h >> (64 - shard_bits)];
+        }
+
+        // slot holding key or the free slot ending its probe sequence, the shard has a free slot
+        static size_t findSlot(const Shard &shard, key_t key, uint64_t h) {
+            size_t mask = shard.values.size() - 1;
+            size_t slot = h & mask;
+            while (shard.values[slot] != empty && shard.keys[slot] != key)
+                slot = (slot + 1) & mask;
+            return slot;
+        }
+
+        static void rehash(Shard &shard, size_t capacity) {
+            std::vector<key_t> keys(capacity);
+            std::vector<value_t> values(capacity, empty);
+            keys.swap(shard.keys);
+            values.swap(shard.values);
+            for (size_t i = 0; i < values.size(); i++) {
+                if (values[i] == empty)
+                    continue;
+                size_t slot = findSlot(shard, keys[i], hash(keys[i]));
+                shard.keys[slot] = keys[i];
+                shard.values[slot] = values[i];
+            }
+        }
+
+        // keeps the load at most 3/4, probe sequences stay short
+        static size_t capacityFor(size_t size) {
+            size_t capacity = min_capacity;
+            while (capacity * 3 < size * 4)
+                capacity *= 2;
+            return capacity;
+        }
+
+        // stores value for key in the locked shard, returns whether key had a value, then in previous
+        static bool put(Shard &shard, key_t key, uint64_t h, value_t value, value_t &previous) {
+            if (shard.values.size() < capacityFor(shard.size + 1))
+                rehash(shard, capacityFor(shard.size + 1));
+            size_t slot = findSlot(shard, key, h);
+            bool found = shard.values[slot] != empty;
+            if (found) {
+                previous = shard.values[slot];
+            } else {
+                shard.keys[slot] = key;
+                shard.size++;
+            }
+            shard.values[slot] = value;
+            return found;
+        }
+
+    public:
+        LabelMap() = default;
+        LabelMap(const LabelMap &) = delete;
+        LabelMap &operator=(const LabelMap &) = delete;
+
+        bool find(key_t key, value_t &value) const {
+            uint64_t h = hash(key);
+            Shard &shard = shardOf(h);
+            std::unique_lock <std::mutex> lock(shard.guard);
+            if (shard.size == 0)
+                return false;
+            size_t slot = findSlot(shard, key, h);
+            if (shard.values[slot] == empty)
+                return false;
+            value = shard.values[slot];
+            return true;
+        }
+
+        void insert(key_t key, value_t value) {
+            uint64_t h = hash(key);
+            Shard &shard = shardOf(h);
+            std::unique_lock <std::mutex> lock(shard.guard);
+            value_t previous;
+            put(shard, key, h, value, previous);
+        }
+
+        /**
+         * Stores value for key and returns whether key already had a value, which is then in previous. Two
+         * threads exchanging the same key see each other's value, exactly one of them gets the older one.
+         */
+        bool exchange(key_t key, value_t value, value_t &previous) {
+            uint64_t h = hash(key);
+            Shard &shard = shardOf(h);
+            std::unique_lock <std::mutex> lock(shard.guard);
+            return put(shard, key, h, value, previous);
+        }
+
+        // removes key if it maps to value
+        bool erase(key_t key, value_t value) {
+            uint64_t h = hash(key);
+            Shard &shard = shardOf(h);
+            std::unique_lock <std::mutex> lock(shard.guard);
+            if (shard.size == 0)
+                return false;
+            size_t slot = findSlot(shard, key, h);
+            if (shard.values[slot] != value)
+                return false;
+            // moves the following entries of the probe sequence back, no tombstones are left
+            size_t mask = shard.values.size() - 1;
+            size_t next = slot;
+            while (true) {
+                next = (next + 1) & mask;
+                if (shard.values[next] == empty)
+                    break;
+                size_t home = hash(shard.keys[next]) & mask;
+                // the entry can move to slot if slot lies between its home and its position
+                if (((next - home) & mask) >= ((next - slot) & mask)) {
+                    shard.keys[slot] = shard.keys[next];
+                    shard.values[slot] = shard.values[next];
+                    slot = next;
+                }
+            }
+            shard.values[slot] = empty;
+            shard.size--;
+            return true;
+        }
+
+        // makes room for size keys in total, spread evenly over the shards
+        void reserve(size_t size) {
+            size_t per_shard = size / shard_count;
+            // hashing fills the shards unevenly
+            per_shard += per_shard / 16 + 16;
+            for (Shard &shard : shards_) {
+                std::unique_lock <std::mutex> lock(shard.guard);
+                if (shard.values.size() < capacityFor(per_shard))
+                    rehash(shard, capacityFor(std::max(per_shard, shard.size)));
+            }
+        }
+
+        size_t size() const {
+            size_t total = 0;
+            for (Shard &shard : shards_) {
+                std::unique_lock <std::mutex> lock(shard.guard);
+                total += shard.size;
+            }
+            return total;
+        }
+
+        void clear() {
+            for (Shard &shard : shards_) {
+                std::unique_lock <std::mutex> lock(shard.guard);
+                std::vector<key_t>().swap(shard.keys);
+                std::vector<value_t>().swap(shard.values);
+                shard.size = 0;
+            }
+        }
+
+        // calls fn(key, value) for every entry, fn may change the value, one shard is locked at a time
+        template<typename Function>
+        void forEach(Function fn) {
+            for (Shard &shard : shards_) {
+                std::unique_lock <std::mutex> lock(shard.guard);
+                for (size_t i = 0; i < shard.values.size(); i++) {
+                    if (shard.values[i] != empty)
+                        fn(shard.keys[i], shard.values[i]);
+                }
+            }
+        }
+
+        // bytes of the tables
+        size_t allocatedBytes() const {
+            size_t bytes = 0;
+            for (Shard &shard : shards_) {
+                std::unique_lock <std::mutex> lock(shard.guard);
+                bytes += shard.keys.capacity() * sizeof(key_t) + shard.values.capacity() * sizeof(value_t);
+            }
+            return bytes;
+        }
+    };
+
+    template<typename key_t, typename value_t>
+    const value_t LabelMap<key_t, value_t>::empty;
+}
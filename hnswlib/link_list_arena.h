@@ -0,0 +1,113 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "huge_pages.h"
+
+namespace hnswlib {
+///////////////////////////////////////////////////////////
+//
+// Storage of the upper-layer link lists. Only about one element
+// in M has upper layers, their lists are a few hundred bytes, so
+// a heap allocation each means millions of tiny blocks for a
+// large index. The arena hands out consecutive pieces of a few
+// big chunks instead: elements inserted or loaded together end up
+// next to each other and the whole storage is released at once.
+// Pieces are never returned individually.
+//
+/////////////////////////////////////////////////////////
+
+    class LinkListArena {
+        std::vector<char *> chunks_;
+        char *next_;
+        size_t available_;
+        size_t next_chunk_size_;
+        size_t allocated_;
+        bool huge_pages_;
+        std::mutex guard_;
+
+        static const size_t min_chunk_size = (size_t) 64 << 10;
+        static const size_t max_chunk_size = (size_t) 4 << 20;
+
+        // keeps the link lists aligned for their tableint entries
+        static size_t alignSize(size_t size) {
+            return (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+        }
+
+        void addChunk(size_t size) {
+            char *chunk = (char *) allocateLarge(size, huge_pages_);
+            if (chunk == nullptr)
+                throw std::runtime_error("Not enough memory: LinkListArena failed to allocate a chunk");
+            chunks_.push_back(chunk);
+            next_ = chunk;
+            available_ = size;
+            allocated_ += size;
+        }
+
+    public:
+        LinkListArena(bool huge_pages = false) {
+            next_ = nullptr;
+            available_ = 0;
+            next_chunk_size_ = min_chunk_size;
+            allocated_ = 0;
+            huge_pages_ = huge_pages;
+        }
+
+        LinkListArena(const LinkListArena &) = delete;
+        LinkListArena &operator=(const LinkListArena &) = delete;
+
+        ~LinkListArena() {
+            clear();
+        }
+
+        void setHugePages(bool huge_pages) {
+            huge_pages_ = huge_pages;
+        }
+
+        /**
+         * Returns size bytes of uninitialized memory that stay valid until clear(). Safe to call from several
+         * threads. A request larger than the next chunk gets a chunk of its own, loading an index takes all
+         * its link lists with one request.
+         */
+        char *allocate(size_t size) {
+            size = alignSize(size);
+            std::unique_lock <std::mutex> lock(guard_);
+            if (size > available_) {
+                // chunks grow with the index so that small indexes stay small
+                addChunk(std::max(size, next_chunk_size_));
+                next_chunk_size_ = std::min(2 * next_chunk_size_, max_chunk_size);
+            }
+            char *block = next_;
+            next_ += size;
+            available_ -= size;
+            return block;
+        }
+
+        // bytes held by the arena, including the unused end of the last chunk
+        size_t allocatedBytes() const {
+            return allocated_;
+        }
+
+        // exchanges the memory of two arenas, neither may be in use by other threads
+        void swap(LinkListArena &other) {
+            chunks_.swap(other.chunks_);
+            std::swap(next_, other.next_);
+            std::swap(available_, other.available_);
+            std::swap(next_chunk_size_, other.next_chunk_size_);
+            std::swap(allocated_, other.allocated_);
+            std::swap(huge_pages_, other.huge_pages_);
+        }
+
+        void clear() {
+            for (char *chunk : chunks_)
+                freeLarge(chunk);
+            chunks_.clear();
+            next_ = nullptr;
+            available_ = 0;
+            next_chunk_size_ = min_chunk_size;
+            allocated_ = 0;
+        }
+    };
+}
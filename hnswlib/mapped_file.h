@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace hnswlib {
+///////////////////////////////////////////////////////////
+//
+// Read-only memory mapping of an index file. The pages are
+// shared through the OS page cache, so several processes
+// mapping the same index keep a single physical copy.
+//
+/////////////////////////////////////////////////////////
+
+    class MappedFile {
+        char *data_;
+        size_t size_;
+
+    public:
+        MappedFile(const std::string &location) {
+#if defined(_WIN32)
+            throw std::runtime_error("Memory-mapped indexes are not supported on this platform");
+#else
+            int fd = open(location.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("Cannot open file");
+
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                close(fd);
+                throw std::runtime_error("Cannot stat file");
+            }
+            size_ = st.st_size;
+            if (size_ == 0) {
+                close(fd);
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            }
+
+            void *addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            // the mapping keeps its own reference to the file
+            close(fd);
+            if (addr == MAP_FAILED)
+                throw std::runtime_error("Cannot memory-map file");
+            data_ = (char *) addr;
+#endif
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const char *data() const {
+            return data_;
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        ~MappedFile() {
+#if !defined(_WIN32)
+            munmap(data_, size_);
+#endif
+        }
+    };
+}
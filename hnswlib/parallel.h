@@ -0,0 +1,69 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+namespace hnswlib {
+    /*
+     * Runs fn(id, threadId) for ids from start (inclusive) to end (EXCLUSIVE) on numThreads threads,
+     * a replacement for '#pragma omp parallel for' that does not need openmp.
+     * Threads grab chunk_size consecutive ids at a time; short per-id work (e.g. a loop over all
+     * elements of the index) should use a large chunk to keep the shared counter off the profile.
+     * The first exception thrown by fn stops the loop and is rethrown in the calling thread.
+     */
+    template<class Function>
+    inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn, size_t chunk_size = 1) {
+        if (numThreads <= 0) {
+            numThreads = std::thread::hardware_concurrency();
+        }
+        if (chunk_size == 0)
+            chunk_size = 1;
+
+        if (numThreads == 1 || end <= start + chunk_size) {
+            for (size_t id = start; id < end; id++) {
+                fn(id, 0);
+            }
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        std::atomic<size_t> current(start);
+
+        std::exception_ptr lastException = nullptr;
+        std::mutex lastExceptMutex;
+
+        for (size_t threadId = 0; threadId < numThreads; ++threadId) {
+            threads.push_back(std::thread([&, threadId] {
+                while (true) {
+                    size_t chunk_start = current.fetch_add(chunk_size);
+                    // also stops when the counter wraps around after an exception set it to end
+                    if (chunk_start >= end || chunk_start < start) {
+                        break;
+                    }
+                    size_t chunk_end = std::min(end, chunk_start + chunk_size);
+
+                    try {
+                        for (size_t id = chunk_start; id < chunk_end; id++) {
+                            fn(id, threadId);
+                        }
+                    } catch (...) {
+                        std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
+                        lastException = std::current_exception();
+                        current = end;
+                        break;
+                    }
+                }
+            }));
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        if (lastException) {
+            std::rethrow_exception(lastException);
+        }
+    }
+}
@@ -0,0 +1,517 @@
+#pragma once
+#include "hnswlib.h"
+#include "space_l2.h"
+#include "space_ip.h"
+#include <stdint.h>
+
+// dpbf16 needs a compiler that knows the avx512bf16 target
+#if defined(USE_RUNTIME_DISPATCH) && \
+    ((defined(__clang__) && __clang_major__ >= 9) || (!defined(__clang__) && __GNUC__ >= 10))
+#define USE_AVX512_BF16
+#endif
+
+namespace hnswlib {
+///////////////////////////////////////////////////////////
+//
+// Half-precision storage: 2 bytes per dimension instead of 4.
+// fp16 (IEEE binary16) keeps 11 bits of mantissa over a small
+// range, bfloat16 keeps the float exponent and 8 bits of mantissa.
+// The kernels widen both to floats and accumulate in float.
+//
+/////////////////////////////////////////////////////////
+
+    static inline float halfToFloat(uint16_t h) {
+        uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+        uint32_t exponent = (h >> 10) & 0x1f;
+        uint32_t mantissa = h & 0x3ff;
+        uint32_t bits;
+        if (exponent == 0x1f) {
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        } else if (exponent == 0) {
+            // zero or subnormal: mantissa * 2^-24
+            float value = mantissa * 5.9604644775390625e-8f;
+            return sign ? -value : value;
+        } else {
+            bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+        }
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // rounds to the nearest half, ties to even
+    static inline uint16_t floatToHalf(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = (bits >> 16) & 0x8000;
+        uint32_t abs = bits & 0x7fffffff;
+        if (abs > 0x7f800000)
+            return (uint16_t) (sign | 0x7e00);
+        if (abs >= 0x47800000)
+            return (uint16_t) (sign | 0x7c00);
+        if (abs < 0x33000000)
+            return (uint16_t) sign;
+
+        uint32_t h, rest, halfway;
+        if (abs < 0x38800000) {
+            // below the smallest normal half
+            uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+            uint32_t shift = 126 - (abs >> 23);
+            h = mantissa >> shift;
+            rest = mantissa & ((1u << shift) - 1);
+            halfway = 1u << (shift - 1);
+        } else {
+            h = (abs >> 13) - ((127 - 15) << 10);
+            rest = abs & 0x1fff;
+            halfway = 0x1000;
+        }
+        // a carry out of the mantissa correctly bumps the exponent (up to infinity)
+        if (rest > halfway || (rest == halfway && (h & 1)))
+            h++;
+        return (uint16_t) (sign | h);
+    }
+
+    static inline float bfloat16ToFloat(uint16_t h) {
+        uint32_t bits = (uint32_t) h << 16;
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // rounds to the nearest bfloat16, ties to even
+    static inline uint16_t floatToBFloat16(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        if ((bits & 0x7fffffff) > 0x7f800000)
+            return (uint16_t) ((bits >> 16) | 0x40);
+        bits += 0x7fff + ((bits >> 16) & 1);
+        return (uint16_t) (bits >> 16);
+    }
+
+    /*
+     * The two formats differ only in how a value is widened to a float; the kernels below are
+     * templates over these.
+     */
+    struct FP16Format {
+        static float toFloat(uint16_t h) {
+            return halfToFloat(h);
+        }
+
+#if defined(USE_RUNTIME_DISPATCH)
+        PORTABLE_TARGET("avx2,fma,f16c") static __m256 load8(const uint16_t *p) {
+            return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) p));
+        }
+
+        PORTABLE_TARGET("avx512f") static __m512 load16(const uint16_t *p) {
+            return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) p));
+        }
+#endif
+    };
+
+    struct BF16Format {
+        static float toFloat(uint16_t h) {
+            return bfloat16ToFloat(h);
+        }
+
+#if defined(USE_RUNTIME_DISPATCH)
+        PORTABLE_TARGET("avx2,fma,f16c") static __m256 load8(const uint16_t *p) {
+            __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) p));
+            return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+        }
+
+        PORTABLE_TARGET("avx512f") static __m512 load16(const uint16_t *p) {
+            __m512i wide = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *) p));
+            return _mm512_castsi512_ps(_mm512_slli_epi32(wide, 16));
+        }
+#endif
+    };
+
+    template<typename Format>
+    static float
+    L2SqrHalf(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+        const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+        size_t qty = *((size_t *) qty_ptr);
+
+        float res = 0;
+        for (size_t i = 0; i < qty; i++) {
+            float t = Format::toFloat(pVect1[i]) - Format::toFloat(pVect2[i]);
+            res += t * t;
+        }
+        return (res);
+    }
+
+    template<typename Format>
+    static float
+    InnerProductHalf(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+        const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+        size_t qty = *((size_t *) qty_ptr);
+
+        float res = 0;
+        for (size_t i = 0; i < qty; i++)
+            res += Format::toFloat(pVect1[i]) * Format::toFloat(pVect2[i]);
+        return (1.0f - res);
+    }
+
+#if defined(USE_RUNTIME_DISPATCH)
+    template<typename Format>
+    PORTABLE_TARGET("avx2,fma,f16c") static float
+    L2SqrHalfAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+        const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        for (; i + 16 <= qty; i += 16) {
+            __m256 diff0 = _mm256_sub_ps(Format::load8(pVect1 + i), Format::load8(pVect2 + i));
+            __m256 diff1 = _mm256_sub_ps(Format::load8(pVect1 + i + 8), Format::load8(pVect2 + i + 8));
+            sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+            sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+        }
+        if (i + 8 <= qty) {
+            __m256 diff = _mm256_sub_ps(Format::load8(pVect1 + i), Format::load8(pVect2 + i));
+            sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+            i += 8;
+        }
+        sum0 = _mm256_add_ps(sum0, sum1);
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+        sum = _mm_hadd_ps(sum, sum);
+        sum = _mm_hadd_ps(sum, sum);
+        float res = _mm_cvtss_f32(sum);
+
+        for (; i < qty; i++) {
+            float t = Format::toFloat(pVect1[i]) - Format::toFloat(pVect2[i]);
+            res += t * t;
+        }
+        return (res);
+    }
+
+    template<typename Format>
+    PORTABLE_TARGET("avx2,fma,f16c") static float
+    InnerProductHalfAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+        const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        for (; i + 16 <= qty; i += 16) {
+            sum0 = _mm256_fmadd_ps(Format::load8(pVect1 + i), Format::load8(pVect2 + i), sum0);
+            sum1 = _mm256_fmadd_ps(Format::load8(pVect1 + i + 8), Format::load8(pVect2 + i + 8), sum1);
+        }
+        if (i + 8 <= qty) {
+            sum0 = _mm256_fmadd_ps(Format::load8(pVect1 + i), Format::load8(pVect2 + i), sum0);
+            i += 8;
+        }
+        sum0 = _mm256_add_ps(sum0, sum1);
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+        sum = _mm_hadd_ps(sum, sum);
+        sum = _mm_hadd_ps(sum, sum);
+        float res = _mm_cvtss_f32(sum);
+
+        for (; i < qty; i++)
+            res += Format::toFloat(pVect1[i]) * Format::toFloat(pVect2[i]);
+        return (1.0f - res);
+    }
+
+    template<typename Format>
+    PORTABLE_TARGET("avx512f") static float
+    L2SqrHalfAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+        const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m512 sum0 = _mm512_setzero_ps();
+        __m512 sum1 = _mm512_setzero_ps();
+        for (; i + 32 <= qty; i += 32) {
+            __m512 diff0 = _mm512_sub_ps(Format::load16(pVect1 + i), Format::load16(pVect2 + i));
+            __m512 diff1 = _mm512_sub_ps(Format::load16(pVect1 + i + 16), Format::load16(pVect2 + i + 16));
+            sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
+            sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+        }
+        if (i + 16 <= qty) {
+            __m512 diff = _mm512_sub_ps(Format::load16(pVect1 + i), Format::load16(pVect2 + i));
+            sum0 = _mm512_fmadd_ps(diff, diff, sum0);
+            i += 16;
+        }
+        float res = _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+
+        for (; i < qty; i++) {
+            float t = Format::toFloat(pVect1[i]) - Format::toFloat(pVect2[i]);
+            res += t * t;
+        }
+        return (res);
+    }
+
+    template<typename Format>
+    PORTABLE_TARGET("avx512f") static float
+    InnerProductHalfAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+        const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m512 sum0 = _mm512_setzero_ps();
+        __m512 sum1 = _mm512_setzero_ps();
+        for (; i + 32 <= qty; i += 32) {
+            sum0 = _mm512_fmadd_ps(Format::load16(pVect1 + i), Format::load16(pVect2 + i), sum0);
+            sum1 = _mm512_fmadd_ps(Format::load16(pVect1 + i + 16), Format::load16(pVect2 + i + 16), sum1);
+        }
+        if (i + 16 <= qty) {
+            sum0 = _mm512_fmadd_ps(Format::load16(pVect1 + i), Format::load16(pVect2 + i), sum0);
+            i += 16;
+        }
+        float res = _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+
+        for (; i < qty; i++)
+            res += Format::toFloat(pVect1[i]) * Format::toFloat(pVect2[i]);
+        return (1.0f - res);
+    }
+#endif
+
+#if defined(USE_AVX512_BF16)
+    // bfloat16 products are exact in float, dpbf16 multiplies and accumulates 32 pairs at once
+    PORTABLE_TARGET("avx512f,avx512bf16") static float
+    InnerProductBF16AVX512BF16(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+        const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m512 sum0 = _mm512_setzero_ps();
+        __m512 sum1 = _mm512_setzero_ps();
+        for (; i + 64 <= qty; i += 64) {
+            sum0 = _mm512_dpbf16_ps(sum0, (__m512bh) _mm512_loadu_si512(pVect1 + i),
+                                    (__m512bh) _mm512_loadu_si512(pVect2 + i));
+            sum1 = _mm512_dpbf16_ps(sum1, (__m512bh) _mm512_loadu_si512(pVect1 + i + 32),
+                                    (__m512bh) _mm512_loadu_si512(pVect2 + i + 32));
+        }
+        if (i + 32 <= qty) {
+            sum0 = _mm512_dpbf16_ps(sum0, (__m512bh) _mm512_loadu_si512(pVect1 + i),
+                                    (__m512bh) _mm512_loadu_si512(pVect2 + i));
+            i += 32;
+        }
+        float res = _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+
+        for (; i < qty; i++)
+            res += bfloat16ToFloat(pVect1[i]) * bfloat16ToFloat(pVect2[i]);
+        return (1.0f - res);
+    }
+#endif
+
+    template<typename Format>
+    static DISTFUNC<float> selectL2SqrHalf(size_t dim) {
+    #if defined(USE_RUNTIME_DISPATCH)
+        if (getCpuFeatures().avx512f && dim >= 16)
+            return L2SqrHalfAVX512<Format>;
+        if (getCpuFeatures().avx2 && getCpuFeatures().fma && getCpuFeatures().f16c && dim >= 8)
+            return L2SqrHalfAVX2<Format>;
+    #endif
+        return L2SqrHalf<Format>;
+    }
+
+    template<typename Format>
+    static DISTFUNC<float> selectInnerProductHalf(size_t dim) {
+    #if defined(USE_RUNTIME_DISPATCH)
+        if (getCpuFeatures().avx512f && dim >= 16)
+            return InnerProductHalfAVX512<Format>;
+        if (getCpuFeatures().avx2 && getCpuFeatures().fma && getCpuFeatures().f16c && dim >= 8)
+            return InnerProductHalfAVX2<Format>;
+    #endif
+        return InnerProductHalf<Format>;
+    }
+
+    /*
+     * L2 over fp16 vectors. Vectors and queries are passed as fp16 (e.g. numpy float16 arrays),
+     * floatToHalf converts float data.
+     */
+    class L2SpaceFP16 : public SpaceInterface<float> {
+
+        DISTFUNC<float> fstdistfunc_;
+        size_t data_size_;
+        size_t dim_;
+    public:
+        L2SpaceFP16(size_t dim) {
+            fstdistfunc_ = selectL2SqrHalf<FP16Format>(dim);
+            dim_ = dim;
+            data_size_ = dim * sizeof(uint16_t);
+        }
+
+        size_t get_data_size() {
+            return data_size_;
+        }
+
+        DISTFUNC<float> get_dist_func() {
+            return fstdistfunc_;
+        }
+
+        void *get_dist_func_param() {
+            return &dim_;
+        }
+
+        ~L2SpaceFP16() {}
+    };
+
+    /*
+     * Inner product over fp16 vectors, the counterpart of L2SpaceFP16.
+     */
+    class InnerProductSpaceFP16 : public SpaceInterface<float> {
+
+        DISTFUNC<float> fstdistfunc_;
+        size_t data_size_;
+        size_t dim_;
+    public:
+        InnerProductSpaceFP16(size_t dim) {
+            fstdistfunc_ = selectInnerProductHalf<FP16Format>(dim);
+            dim_ = dim;
+            data_size_ = dim * sizeof(uint16_t);
+        }
+
+        size_t get_data_size() {
+            return data_size_;
+        }
+
+        DISTFUNC<float> get_dist_func() {
+            return fstdistfunc_;
+        }
+
+        void *get_dist_func_param() {
+            return &dim_;
+        }
+
+        ~InnerProductSpaceFP16() {}
+    };
+
+    /*
+     * L2 over bfloat16 vectors. Vectors and queries are passed as floats and rounded to bfloat16,
+     * the exact float distance is kept for HierarchicalNSW::setRerank.
+     */
+    class L2SpaceBF16 : public SpaceInterface<float> {
+
+        L2Space exact_;
+        DISTFUNC<float> fstdistfunc_;
+        size_t data_size_;
+        size_t dim_;
+    public:
+        L2SpaceBF16(size_t dim) : exact_(dim) {
+            fstdistfunc_ = selectL2SqrHalf<BF16Format>(dim);
+            dim_ = dim;
+            data_size_ = dim * sizeof(uint16_t);
+        }
+
+        size_t get_data_size() {
+            return data_size_;
+        }
+
+        DISTFUNC<float> get_dist_func() {
+            return fstdistfunc_;
+        }
+
+        void *get_dist_func_param() {
+            return &dim_;
+        }
+
+        bool has_encoder() {
+            return true;
+        }
+
+        size_t get_input_size() {
+            return dim_ * sizeof(float);
+        }
+
+        void encode(const void *vector, void *code) {
+            for (size_t i = 0; i < dim_; i++)
+                ((uint16_t *) code)[i] = floatToBFloat16(((const float *) vector)[i]);
+        }
+
+        void decode(const void *code, void *vector) {
+            for (size_t i = 0; i < dim_; i++)
+                ((float *) vector)[i] = bfloat16ToFloat(((const uint16_t *) code)[i]);
+        }
+
+        size_t get_query_size() {
+            return data_size_;
+        }
+
+        void encode_query(const void *query, void *encoded) {
+            encode(query, encoded);
+        }
+
+        DISTFUNC<float> get_input_dist_func() {
+            return exact_.get_dist_func();
+        }
+
+        ~L2SpaceBF16() {}
+    };
+
+    /*
+     * Inner product over bfloat16 vectors, the counterpart of L2SpaceBF16.
+     * Uses the AVX-512 BF16 dot product instructions where the CPU has them.
+     */
+    class InnerProductSpaceBF16 : public SpaceInterface<float> {
+
+        InnerProductSpace exact_;
+        DISTFUNC<float> fstdistfunc_;
+        size_t data_size_;
+        size_t dim_;
+    public:
+        InnerProductSpaceBF16(size_t dim) : exact_(dim) {
+            fstdistfunc_ = selectInnerProductHalf<BF16Format>(dim);
+        #if defined(USE_AVX512_BF16)
+            if (getCpuFeatures().avx512bf16 && dim >= 32)
+                fstdistfunc_ = InnerProductBF16AVX512BF16;
+        #endif
+            dim_ = dim;
+            data_size_ = dim * sizeof(uint16_t);
+        }
+
+        size_t get_data_size() {
+            return data_size_;
+        }
+
+        DISTFUNC<float> get_dist_func() {
+            return fstdistfunc_;
+        }
+
+        void *get_dist_func_param() {
+            return &dim_;
+        }
+
+        bool has_encoder() {
+            return true;
+        }
+
+        size_t get_input_size() {
+            return dim_ * sizeof(float);
+        }
+
+        void encode(const void *vector, void *code) {
+            for (size_t i = 0; i < dim_; i++)
+                ((uint16_t *) code)[i] = floatToBFloat16(((const float *) vector)[i]);
+        }
+
+        void decode(const void *code, void *vector) {
+            for (size_t i = 0; i < dim_; i++)
+                ((float *) vector)[i] = bfloat16ToFloat(((const uint16_t *) code)[i]);
+        }
+
+        size_t get_query_size() {
+            return data_size_;
+        }
+
+        void encode_query(const void *query, void *encoded) {
+            encode(query, encoded);
+        }
+
+        DISTFUNC<float> get_input_dist_func() {
+            return exact_.get_dist_func();
+        }
+
+        ~InnerProductSpaceBF16() {}
+    };
+}
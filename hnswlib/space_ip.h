@@ -1,5 +1,6 @@
 #pragma once
 #include "hnswlib.h"
+#include "space_l2.h"
 
 namespace hnswlib {
 
@@ -241,14 +242,189 @@ namespace hnswlib {
     }
 #endif
 
+#if defined(USE_RUNTIME_DISPATCH)
+    template<size_t qty_static>
+    PORTABLE_TARGET("avx2,fma") static float
+    InnerProductAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        float *pVect1 = (float *) pVect1v;
+        float *pVect2 = (float *) pVect2v;
+        size_t qty = qty_static ? qty_static : *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        for (; i + 16 <= qty; i += 16) {
+            sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i), sum0);
+            sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + i + 8), _mm256_loadu_ps(pVect2 + i + 8), sum1);
+        }
+        if (i + 8 <= qty) {
+            sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i), sum0);
+            i += 8;
+        }
+        sum0 = _mm256_add_ps(sum0, sum1);
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+        sum = _mm_hadd_ps(sum, sum);
+        sum = _mm_hadd_ps(sum, sum);
+        float res = _mm_cvtss_f32(sum);
+
+        for (; i < qty; i++)
+            res += pVect1[i] * pVect2[i];
+        return (1.0f - res);
+    }
+
+    template<size_t qty_static>
+    PORTABLE_TARGET("avx512f") static float
+    InnerProductAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        float *pVect1 = (float *) pVect1v;
+        float *pVect2 = (float *) pVect2v;
+        size_t qty = qty_static ? qty_static : *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m512 sum0 = _mm512_setzero_ps();
+        __m512 sum1 = _mm512_setzero_ps();
+        for (; i + 32 <= qty; i += 32) {
+            sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i), sum0);
+            sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + i + 16), _mm512_loadu_ps(pVect2 + i + 16), sum1);
+        }
+        if (i + 16 <= qty) {
+            sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i), sum0);
+            i += 16;
+        }
+        if (i < qty) {
+            __mmask16 mask = (__mmask16) ((1u << (qty - i)) - 1);
+            sum1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, pVect1 + i), _mm512_maskz_loadu_ps(mask, pVect2 + i), sum1);
+        }
+        return (1.0f - _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1)));
+    }
+
+    static DISTFUNC<float> InnerProductAVX2ForDim(size_t dim) {
+        switch (dim) {
+            case 96: return InnerProductAVX2<96>;
+            case 128: return InnerProductAVX2<128>;
+            case 384: return InnerProductAVX2<384>;
+            case 768: return InnerProductAVX2<768>;
+            case 1536: return InnerProductAVX2<1536>;
+            default: return InnerProductAVX2<0>;
+        }
+    }
+
+    static DISTFUNC<float> InnerProductAVX512ForDim(size_t dim) {
+        switch (dim) {
+            case 96: return InnerProductAVX512<96>;
+            case 128: return InnerProductAVX512<128>;
+            case 384: return InnerProductAVX512<384>;
+            case 768: return InnerProductAVX512<768>;
+            case 1536: return InnerProductAVX512<1536>;
+            default: return InnerProductAVX512<0>;
+        }
+    }
+
+    // one query against n vectors, see L2SqrBatchAVX512
+    template<size_t qty_static>
+    PORTABLE_TARGET("avx2,fma") static void
+    InnerProductBatchAVX2(const void *query, const void *const *vectors, size_t n, float *dists, const void *qty_ptr) {
+        const float *pQuery = (const float *) query;
+        size_t qty = qty_static ? qty_static : *((size_t *) qty_ptr);
+        size_t qty8 = qty / 8 * 8;
+        size_t c = 0;
+
+        for (; c + 4 <= n; c += 4) {
+            const float *vector[4];
+            __m256 sum[4];
+            for (size_t v = 0; v < 4; v++) {
+                vector[v] = (const float *) vectors[c + v];
+                sum[v] = _mm256_setzero_ps();
+            }
+            for (size_t i = 0; i < qty8; i += 8) {
+                __m256 query_part = _mm256_loadu_ps(pQuery + i);
+                for (size_t v = 0; v < 4; v++) {
+                    sum[v] = _mm256_fmadd_ps(query_part, _mm256_loadu_ps(vector[v] + i), sum[v]);
+                }
+            }
+            for (size_t v = 0; v < 4; v++) {
+                __m128 part = _mm_add_ps(_mm256_castps256_ps128(sum[v]), _mm256_extractf128_ps(sum[v], 1));
+                part = _mm_hadd_ps(part, part);
+                part = _mm_hadd_ps(part, part);
+                float res = _mm_cvtss_f32(part);
+                for (size_t j = qty8; j < qty; j++) {
+                    res += pQuery[j] * vector[v][j];
+                }
+                dists[c + v] = 1.0f - res;
+            }
+        }
+        for (; c < n; c++)
+            dists[c] = InnerProductAVX2<qty_static>(query, vectors[c], qty_ptr);
+    }
+
+    template<size_t qty_static>
+    PORTABLE_TARGET("avx512f") static void
+    InnerProductBatchAVX512(const void *query, const void *const *vectors, size_t n, float *dists, const void *qty_ptr) {
+        const float *pQuery = (const float *) query;
+        size_t qty = qty_static ? qty_static : *((size_t *) qty_ptr);
+        size_t qty16 = qty / 16 * 16;
+        __mmask16 mask = (__mmask16) ((1u << (qty - qty16)) - 1);
+        size_t c = 0;
+
+        for (; c + 4 <= n; c += 4) {
+            const float *vector[4];
+            __m512 sum[4];
+            for (size_t v = 0; v < 4; v++) {
+                vector[v] = (const float *) vectors[c + v];
+                sum[v] = _mm512_setzero_ps();
+            }
+            for (size_t i = 0; i < qty16; i += 16) {
+                __m512 query_part = _mm512_loadu_ps(pQuery + i);
+                for (size_t v = 0; v < 4; v++) {
+                    sum[v] = _mm512_fmadd_ps(query_part, _mm512_loadu_ps(vector[v] + i), sum[v]);
+                }
+            }
+            if (qty16 < qty) {
+                size_t i = qty16;
+                __m512 query_part = _mm512_maskz_loadu_ps(mask, pQuery + i);
+                for (size_t v = 0; v < 4; v++) {
+                    sum[v] = _mm512_fmadd_ps(query_part, _mm512_maskz_loadu_ps(mask, vector[v] + i), sum[v]);
+                }
+            }
+            for (size_t v = 0; v < 4; v++)
+                dists[c + v] = 1.0f - _mm512_reduce_add_ps(sum[v]);
+        }
+        for (; c < n; c++)
+            dists[c] = InnerProductAVX512<qty_static>(query, vectors[c], qty_ptr);
+    }
+
+    static BATCHDISTFUNC<float> InnerProductBatchAVX2ForDim(size_t dim) {
+        switch (dim) {
+            case 96: return InnerProductBatchAVX2<96>;
+            case 128: return InnerProductBatchAVX2<128>;
+            case 384: return InnerProductBatchAVX2<384>;
+            case 768: return InnerProductBatchAVX2<768>;
+            case 1536: return InnerProductBatchAVX2<1536>;
+            default: return InnerProductBatchAVX2<0>;
+        }
+    }
+
+    static BATCHDISTFUNC<float> InnerProductBatchAVX512ForDim(size_t dim) {
+        switch (dim) {
+            case 96: return InnerProductBatchAVX512<96>;
+            case 128: return InnerProductBatchAVX512<128>;
+            case 384: return InnerProductBatchAVX512<384>;
+            case 768: return InnerProductBatchAVX512<768>;
+            case 1536: return InnerProductBatchAVX512<1536>;
+            default: return InnerProductBatchAVX512<0>;
+        }
+    }
+#endif
+
     class InnerProductSpace : public SpaceInterface<float> {
 
         DISTFUNC<float> fstdistfunc_;
+        BATCHDISTFUNC<float> batchdistfunc_;
         size_t data_size_;
         size_t dim_;
     public:
         InnerProductSpace(size_t dim) {
             fstdistfunc_ = InnerProduct;
+            batchdistfunc_ = nullptr;
     #if defined(USE_AVX) || defined(USE_SSE)
             if (dim % 16 == 0)
                 fstdistfunc_ = InnerProductSIMD16Ext;
@@ -258,6 +434,15 @@ namespace hnswlib {
                 fstdistfunc_ = InnerProductSIMD16ExtResiduals;
             else if (dim > 4)
                 fstdistfunc_ = InnerProductSIMD4ExtResiduals;
+    #endif
+    #if defined(USE_RUNTIME_DISPATCH)
+            if (getCpuFeatures().avx512f && dim >= 16) {
+                fstdistfunc_ = InnerProductAVX512ForDim(dim);
+                batchdistfunc_ = InnerProductBatchAVX512ForDim(dim);
+            } else if (getCpuFeatures().avx2 && getCpuFeatures().fma && dim >= 8) {
+                fstdistfunc_ = InnerProductAVX2ForDim(dim);
+                batchdistfunc_ = InnerProductBatchAVX2ForDim(dim);
+            }
     #endif
             dim_ = dim;
             data_size_ = dim * sizeof(float);
@@ -275,8 +460,350 @@ namespace hnswlib {
             return &dim_;
         }
 
+        BATCHDISTFUNC<float> get_batch_dist_func() {
+            return batchdistfunc_;
+        }
+
     ~InnerProductSpace() {}
     };
 
+    /*
+     * InnerProductSpace with the dimension known at compile time, see L2SqrStatic.
+     */
+    template<size_t dim>
+    struct InnerProductStatic {
+        static const size_t static_dim = dim;
+
+        static float distance(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+            // the kernel is picked on the first call
+            static const DISTFUNC<float> kernel = pickKernel();
+            return kernel(pVect1, pVect2, qty_ptr);
+        }
+
+        static DISTFUNC<float> pickKernel() {
+        #if defined(USE_RUNTIME_DISPATCH)
+            if (getCpuFeatures().avx512f && dim >= 16)
+                return InnerProductAVX512<dim>;
+            if (getCpuFeatures().avx2 && getCpuFeatures().fma && dim >= 8)
+                return InnerProductAVX2<dim>;
+        #endif
+        #if defined(USE_SSE) || defined(USE_AVX)
+            if (dim % 16 == 0)
+                return InnerProductSIMD16Ext;
+            if (dim % 4 == 0)
+                return InnerProductSIMD4Ext;
+        #endif
+            return InnerProduct;
+        }
+    };
+
+    // cosine distance of two vectors that are not normalized, used to re-rank CosineSpace results
+    static float
+    CosineDistance(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+        size_t qty = *((size_t *) qty_ptr);
+        float dot = 0, norm1 = 0, norm2 = 0;
+        for (size_t i = 0; i < qty; i++) {
+            float v1 = ((float *) pVect1)[i];
+            float v2 = ((float *) pVect2)[i];
+            dot += v1 * v2;
+            norm1 += v1 * v1;
+            norm2 += v2 * v2;
+        }
+        return (1.0f - dot / (sqrtf(norm1 * norm2) + 1e-30f));
+    }
+
+    /*
+     * Cosine distance, 1 - cos(a, b). Vectors are normalized once when they are added and queries once per
+     * search, the distances are then inner products with the SIMD kernels of InnerProductSpace.
+     * The index stores (and getDataByLabel returns) the normalized vectors.
+     */
+    class CosineSpace : public SpaceInterface<float> {
+
+        InnerProductSpace ip_;
+        DISTFUNC<float> fstdistfunc_;
+        size_t data_size_;
+        size_t dim_;
+    public:
+        CosineSpace(size_t dim) : ip_(dim) {
+            fstdistfunc_ = ip_.get_dist_func();
+            dim_ = dim;
+            data_size_ = dim * sizeof(float);
+        }
+
+        size_t get_data_size() {
+            return data_size_;
+        }
+
+        DISTFUNC<float> get_dist_func() {
+            return fstdistfunc_;
+        }
+
+        void *get_dist_func_param() {
+            return &dim_;
+        }
+
+        bool has_encoder() {
+            return true;
+        }
+
+        void encode(const void *vector, void *code) {
+            const float *in = (const float *) vector;
+            float *out = (float *) code;
+            float norm = 0;
+            for (size_t i = 0; i < dim_; i++)
+                norm += in[i] * in[i];
+            float inv_norm = 1.0f / (sqrtf(norm) + 1e-30f);
+            for (size_t i = 0; i < dim_; i++)
+                out[i] = in[i] * inv_norm;
+        }
+
+        void encode_query(const void *query, void *encoded) {
+            encode(query, encoded);
+        }
+
+        BATCHDISTFUNC<float> get_batch_dist_func() {
+            return ip_.get_batch_dist_func();
+        }
+
+        // the encoded query is a normalized vector, the batch kernel applies as well
+        BATCHDISTFUNC<float> get_query_batch_dist_func() {
+            return ip_.get_batch_dist_func();
+        }
+
+        DISTFUNC<float> get_input_dist_func() {
+            return CosineDistance;
+        }
+
+        ~CosineSpace() {}
+    };
+
+    // float query against an SQ8 vector (see space_l2.h)
+    static float
+    InnerProductSQ8(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const float *pVect1 = (const float *) pVect1v;
+        const SQ8Header *header = (const SQ8Header *) pVect2v;
+        const unsigned char *codes = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+        float res = 0;
+
+#if defined(USE_SSE)
+        float PORTABLE_ALIGN32 TmpRes[8];
+        __m128 offset = _mm_set1_ps(header->offset);
+        __m128 scale = _mm_set1_ps(header->scale);
+        __m128 sum = _mm_set1_ps(0);
+        for (; i + 4 <= qty; i += 4) {
+            __m128 v2 = _mm_add_ps(offset, _mm_mul_ps(scale, loadSQ8Codes(codes + i)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(pVect1 + i), v2));
+        }
+        _mm_store_ps(TmpRes, sum);
+        res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+#endif
+        for (; i < qty; i++)
+            res += pVect1[i] * (header->offset + header->scale * codes[i]);
+        return (1.0f - res);
+    }
+
+    // two SQ8 vectors, used while building the index
+    static float
+    InnerProductSQ8Codes(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const SQ8Header *header1 = (const SQ8Header *) pVect1v;
+        const SQ8Header *header2 = (const SQ8Header *) pVect2v;
+        const unsigned char *codes1 = (const unsigned char *) pVect1v + sizeof(SQ8Header);
+        const unsigned char *codes2 = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+        float res = 0;
+
+#if defined(USE_SSE)
+        float PORTABLE_ALIGN32 TmpRes[8];
+        __m128 offset1 = _mm_set1_ps(header1->offset);
+        __m128 offset2 = _mm_set1_ps(header2->offset);
+        __m128 scale1 = _mm_set1_ps(header1->scale);
+        __m128 scale2 = _mm_set1_ps(header2->scale);
+        __m128 sum = _mm_set1_ps(0);
+        for (; i + 4 <= qty; i += 4) {
+            __m128 v1 = _mm_add_ps(offset1, _mm_mul_ps(scale1, loadSQ8Codes(codes1 + i)));
+            __m128 v2 = _mm_add_ps(offset2, _mm_mul_ps(scale2, loadSQ8Codes(codes2 + i)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(v1, v2));
+        }
+        _mm_store_ps(TmpRes, sum);
+        res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+#endif
+        for (; i < qty; i++)
+            res += (header1->offset + header1->scale * codes1[i]) * (header2->offset + header2->scale * codes2[i]);
+        return (1.0f - res);
+    }
+
+#if defined(USE_RUNTIME_DISPATCH)
+    PORTABLE_TARGET("avx2,fma") static float
+    InnerProductSQ8AVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const float *pVect1 = (const float *) pVect1v;
+        const SQ8Header *header = (const SQ8Header *) pVect2v;
+        const unsigned char *codes = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m256 offset = _mm256_set1_ps(header->offset);
+        __m256 scale = _mm256_set1_ps(header->scale);
+        __m256 sum = _mm256_setzero_ps();
+        for (; i + 8 <= qty; i += 8) {
+            __m256 v2 = _mm256_fmadd_ps(scale, loadSQ8CodesAVX2(codes + i), offset);
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + i), v2, sum);
+        }
+        __m128 part = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        part = _mm_hadd_ps(part, part);
+        part = _mm_hadd_ps(part, part);
+        float res = _mm_cvtss_f32(part);
+
+        for (; i < qty; i++)
+            res += pVect1[i] * (header->offset + header->scale * codes[i]);
+        return (1.0f - res);
+    }
+
+    PORTABLE_TARGET("avx2,fma") static float
+    InnerProductSQ8CodesAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const SQ8Header *header1 = (const SQ8Header *) pVect1v;
+        const SQ8Header *header2 = (const SQ8Header *) pVect2v;
+        const unsigned char *codes1 = (const unsigned char *) pVect1v + sizeof(SQ8Header);
+        const unsigned char *codes2 = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m256 offset1 = _mm256_set1_ps(header1->offset);
+        __m256 offset2 = _mm256_set1_ps(header2->offset);
+        __m256 scale1 = _mm256_set1_ps(header1->scale);
+        __m256 scale2 = _mm256_set1_ps(header2->scale);
+        __m256 sum = _mm256_setzero_ps();
+        for (; i + 8 <= qty; i += 8) {
+            __m256 v1 = _mm256_fmadd_ps(scale1, loadSQ8CodesAVX2(codes1 + i), offset1);
+            __m256 v2 = _mm256_fmadd_ps(scale2, loadSQ8CodesAVX2(codes2 + i), offset2);
+            sum = _mm256_fmadd_ps(v1, v2, sum);
+        }
+        __m128 part = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        part = _mm_hadd_ps(part, part);
+        part = _mm_hadd_ps(part, part);
+        float res = _mm_cvtss_f32(part);
+
+        for (; i < qty; i++)
+            res += (header1->offset + header1->scale * codes1[i]) * (header2->offset + header2->scale * codes2[i]);
+        return (1.0f - res);
+    }
+
+    PORTABLE_TARGET("avx512f") static float
+    InnerProductSQ8AVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const float *pVect1 = (const float *) pVect1v;
+        const SQ8Header *header = (const SQ8Header *) pVect2v;
+        const unsigned char *codes = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m512 offset = _mm512_set1_ps(header->offset);
+        __m512 scale = _mm512_set1_ps(header->scale);
+        __m512 sum = _mm512_setzero_ps();
+        for (; i + 16 <= qty; i += 16) {
+            __m512 v2 = _mm512_fmadd_ps(scale, loadSQ8CodesAVX512(codes + i), offset);
+            sum = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + i), v2, sum);
+        }
+        float res = _mm512_reduce_add_ps(sum);
+
+        for (; i < qty; i++)
+            res += pVect1[i] * (header->offset + header->scale * codes[i]);
+        return (1.0f - res);
+    }
+
+    PORTABLE_TARGET("avx512f") static float
+    InnerProductSQ8CodesAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const SQ8Header *header1 = (const SQ8Header *) pVect1v;
+        const SQ8Header *header2 = (const SQ8Header *) pVect2v;
+        const unsigned char *codes1 = (const unsigned char *) pVect1v + sizeof(SQ8Header);
+        const unsigned char *codes2 = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m512 offset1 = _mm512_set1_ps(header1->offset);
+        __m512 offset2 = _mm512_set1_ps(header2->offset);
+        __m512 scale1 = _mm512_set1_ps(header1->scale);
+        __m512 scale2 = _mm512_set1_ps(header2->scale);
+        __m512 sum = _mm512_setzero_ps();
+        for (; i + 16 <= qty; i += 16) {
+            __m512 v1 = _mm512_fmadd_ps(scale1, loadSQ8CodesAVX512(codes1 + i), offset1);
+            __m512 v2 = _mm512_fmadd_ps(scale2, loadSQ8CodesAVX512(codes2 + i), offset2);
+            sum = _mm512_fmadd_ps(v1, v2, sum);
+        }
+        float res = _mm512_reduce_add_ps(sum);
+
+        for (; i < qty; i++)
+            res += (header1->offset + header1->scale * codes1[i]) * (header2->offset + header2->scale * codes2[i]);
+        return (1.0f - res);
+    }
+#endif
+
+    /*
+     * Inner product over SQ8 vectors, the counterpart of L2SpaceSQ8.
+     */
+    class InnerProductSpaceSQ8 : public SpaceInterface<float> {
+
+        InnerProductSpace exact_;
+        DISTFUNC<float> fstdistfunc_;
+        DISTFUNC<float> querydistfunc_;
+        size_t data_size_;
+        size_t dim_;
+    public:
+        InnerProductSpaceSQ8(size_t dim) : exact_(dim) {
+            fstdistfunc_ = InnerProductSQ8Codes;
+            querydistfunc_ = InnerProductSQ8;
+        #if defined(USE_RUNTIME_DISPATCH)
+            if (getCpuFeatures().avx512f && dim >= 16) {
+                fstdistfunc_ = InnerProductSQ8CodesAVX512;
+                querydistfunc_ = InnerProductSQ8AVX512;
+            } else if (getCpuFeatures().avx2 && getCpuFeatures().fma && dim >= 8) {
+                fstdistfunc_ = InnerProductSQ8CodesAVX2;
+                querydistfunc_ = InnerProductSQ8AVX2;
+            }
+        #endif
+            dim_ = dim;
+            data_size_ = sizeof(SQ8Header) + dim * sizeof(unsigned char);
+        }
+
+        size_t get_data_size() {
+            return data_size_;
+        }
+
+        DISTFUNC<float> get_dist_func() {
+            return fstdistfunc_;
+        }
+
+        void *get_dist_func_param() {
+            return &dim_;
+        }
+
+        bool has_encoder() {
+            return true;
+        }
+
+        size_t get_input_size() {
+            return dim_ * sizeof(float);
+        }
+
+        void encode(const void *vector, void *code) {
+            encodeSQ8((const float *) vector, dim_, code);
+        }
+
+        void decode(const void *code, void *vector) {
+            decodeSQ8(code, dim_, (float *) vector);
+        }
+
+        DISTFUNC<float> get_query_dist_func() {
+            return querydistfunc_;
+        }
+
+        DISTFUNC<float> get_input_dist_func() {
+            return exact_.get_dist_func();
+        }
+
+        ~InnerProductSpaceSQ8() {}
+    };
+
 
 }
@@ -1,5 +1,7 @@
 #pragma once
 #include "hnswlib.h"
+#include <cmath>
+#include <algorithm>
 
 namespace hnswlib {
 
@@ -166,14 +168,208 @@ namespace hnswlib {
     }
 #endif
 
+#if defined(USE_RUNTIME_DISPATCH)
+    // a non-zero qty_static fixes the dimension at compile time, the loops then have constant trip counts and unroll
+    template<size_t qty_static>
+    PORTABLE_TARGET("avx2,fma") static float
+    L2SqrAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        float *pVect1 = (float *) pVect1v;
+        float *pVect2 = (float *) pVect2v;
+        size_t qty = qty_static ? qty_static : *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        for (; i + 16 <= qty; i += 16) {
+            __m256 diff0 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i));
+            __m256 diff1 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i + 8), _mm256_loadu_ps(pVect2 + i + 8));
+            sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+            sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+        }
+        if (i + 8 <= qty) {
+            __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i), _mm256_loadu_ps(pVect2 + i));
+            sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+            i += 8;
+        }
+        sum0 = _mm256_add_ps(sum0, sum1);
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+        sum = _mm_hadd_ps(sum, sum);
+        sum = _mm_hadd_ps(sum, sum);
+        float res = _mm_cvtss_f32(sum);
+
+        for (; i < qty; i++) {
+            float t = pVect1[i] - pVect2[i];
+            res += t * t;
+        }
+        return (res);
+    }
+
+    template<size_t qty_static>
+    PORTABLE_TARGET("avx512f") static float
+    L2SqrAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        float *pVect1 = (float *) pVect1v;
+        float *pVect2 = (float *) pVect2v;
+        size_t qty = qty_static ? qty_static : *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m512 sum0 = _mm512_setzero_ps();
+        __m512 sum1 = _mm512_setzero_ps();
+        for (; i + 32 <= qty; i += 32) {
+            __m512 diff0 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i));
+            __m512 diff1 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i + 16), _mm512_loadu_ps(pVect2 + i + 16));
+            sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
+            sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+        }
+        if (i + 16 <= qty) {
+            __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i), _mm512_loadu_ps(pVect2 + i));
+            sum0 = _mm512_fmadd_ps(diff, diff, sum0);
+            i += 16;
+        }
+        if (i < qty) {
+            // the tail is loaded under a mask, masked-off lanes read as zero
+            __mmask16 mask = (__mmask16) ((1u << (qty - i)) - 1);
+            __m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, pVect1 + i), _mm512_maskz_loadu_ps(mask, pVect2 + i));
+            sum1 = _mm512_fmadd_ps(diff, diff, sum1);
+        }
+        return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+    }
+
+    // the common embedding sizes get specialized kernels, other dimensions the generic loop
+    static DISTFUNC<float> L2SqrAVX2ForDim(size_t dim) {
+        switch (dim) {
+            case 96: return L2SqrAVX2<96>;
+            case 128: return L2SqrAVX2<128>;
+            case 384: return L2SqrAVX2<384>;
+            case 768: return L2SqrAVX2<768>;
+            case 1536: return L2SqrAVX2<1536>;
+            default: return L2SqrAVX2<0>;
+        }
+    }
+
+    static DISTFUNC<float> L2SqrAVX512ForDim(size_t dim) {
+        switch (dim) {
+            case 96: return L2SqrAVX512<96>;
+            case 128: return L2SqrAVX512<128>;
+            case 384: return L2SqrAVX512<384>;
+            case 768: return L2SqrAVX512<768>;
+            case 1536: return L2SqrAVX512<1536>;
+            default: return L2SqrAVX512<0>;
+        }
+    }
+
+    /*
+     * One query against n vectors (see BATCHDISTFUNC): four vectors are compared at a time, every part of the
+     * query is loaded once for the four and the independent sums keep the FMA units busy.
+     */
+    template<size_t qty_static>
+    PORTABLE_TARGET("avx2,fma") static void
+    L2SqrBatchAVX2(const void *query, const void *const *vectors, size_t n, float *dists, const void *qty_ptr) {
+        const float *pQuery = (const float *) query;
+        size_t qty = qty_static ? qty_static : *((size_t *) qty_ptr);
+        size_t qty8 = qty / 8 * 8;
+        size_t c = 0;
+
+        for (; c + 4 <= n; c += 4) {
+            const float *vector[4];
+            __m256 sum[4];
+            for (size_t v = 0; v < 4; v++) {
+                vector[v] = (const float *) vectors[c + v];
+                sum[v] = _mm256_setzero_ps();
+            }
+            for (size_t i = 0; i < qty8; i += 8) {
+                __m256 query_part = _mm256_loadu_ps(pQuery + i);
+                for (size_t v = 0; v < 4; v++) {
+                    __m256 diff = _mm256_sub_ps(query_part, _mm256_loadu_ps(vector[v] + i));
+                    sum[v] = _mm256_fmadd_ps(diff, diff, sum[v]);
+                }
+            }
+            for (size_t v = 0; v < 4; v++) {
+                __m128 part = _mm_add_ps(_mm256_castps256_ps128(sum[v]), _mm256_extractf128_ps(sum[v], 1));
+                part = _mm_hadd_ps(part, part);
+                part = _mm_hadd_ps(part, part);
+                float res = _mm_cvtss_f32(part);
+                for (size_t j = qty8; j < qty; j++) {
+                    float t = pQuery[j] - vector[v][j];
+                    res += t * t;
+                }
+                dists[c + v] = res;
+            }
+        }
+        for (; c < n; c++)
+            dists[c] = L2SqrAVX2<qty_static>(query, vectors[c], qty_ptr);
+    }
+
+    template<size_t qty_static>
+    PORTABLE_TARGET("avx512f") static void
+    L2SqrBatchAVX512(const void *query, const void *const *vectors, size_t n, float *dists, const void *qty_ptr) {
+        const float *pQuery = (const float *) query;
+        size_t qty = qty_static ? qty_static : *((size_t *) qty_ptr);
+        size_t qty16 = qty / 16 * 16;
+        __mmask16 mask = (__mmask16) ((1u << (qty - qty16)) - 1);
+        size_t c = 0;
+
+        for (; c + 4 <= n; c += 4) {
+            const float *vector[4];
+            __m512 sum[4];
+            for (size_t v = 0; v < 4; v++) {
+                vector[v] = (const float *) vectors[c + v];
+                sum[v] = _mm512_setzero_ps();
+            }
+            for (size_t i = 0; i < qty16; i += 16) {
+                __m512 query_part = _mm512_loadu_ps(pQuery + i);
+                for (size_t v = 0; v < 4; v++) {
+                    __m512 diff = _mm512_sub_ps(query_part, _mm512_loadu_ps(vector[v] + i));
+                    sum[v] = _mm512_fmadd_ps(diff, diff, sum[v]);
+                }
+            }
+            if (qty16 < qty) {
+                size_t i = qty16;
+                __m512 query_part = _mm512_maskz_loadu_ps(mask, pQuery + i);
+                for (size_t v = 0; v < 4; v++) {
+                    __m512 diff = _mm512_sub_ps(query_part, _mm512_maskz_loadu_ps(mask, vector[v] + i));
+                    sum[v] = _mm512_fmadd_ps(diff, diff, sum[v]);
+                }
+            }
+            for (size_t v = 0; v < 4; v++)
+                dists[c + v] = _mm512_reduce_add_ps(sum[v]);
+        }
+        for (; c < n; c++)
+            dists[c] = L2SqrAVX512<qty_static>(query, vectors[c], qty_ptr);
+    }
+
+    static BATCHDISTFUNC<float> L2SqrBatchAVX2ForDim(size_t dim) {
+        switch (dim) {
+            case 96: return L2SqrBatchAVX2<96>;
+            case 128: return L2SqrBatchAVX2<128>;
+            case 384: return L2SqrBatchAVX2<384>;
+            case 768: return L2SqrBatchAVX2<768>;
+            case 1536: return L2SqrBatchAVX2<1536>;
+            default: return L2SqrBatchAVX2<0>;
+        }
+    }
+
+    static BATCHDISTFUNC<float> L2SqrBatchAVX512ForDim(size_t dim) {
+        switch (dim) {
+            case 96: return L2SqrBatchAVX512<96>;
+            case 128: return L2SqrBatchAVX512<128>;
+            case 384: return L2SqrBatchAVX512<384>;
+            case 768: return L2SqrBatchAVX512<768>;
+            case 1536: return L2SqrBatchAVX512<1536>;
+            default: return L2SqrBatchAVX512<0>;
+        }
+    }
+#endif
+
     class L2Space : public SpaceInterface<float> {
 
         DISTFUNC<float> fstdistfunc_;
+        BATCHDISTFUNC<float> batchdistfunc_;
         size_t data_size_;
         size_t dim_;
     public:
         L2Space(size_t dim) {
             fstdistfunc_ = L2Sqr;
+            batchdistfunc_ = nullptr;
         #if defined(USE_SSE) || defined(USE_AVX)
             if (dim % 16 == 0)
                 fstdistfunc_ = L2SqrSIMD16Ext;
@@ -183,6 +379,15 @@ namespace hnswlib {
                 fstdistfunc_ = L2SqrSIMD16ExtResiduals;
             else if (dim > 4)
                 fstdistfunc_ = L2SqrSIMD4ExtResiduals;
+        #endif
+        #if defined(USE_RUNTIME_DISPATCH)
+            if (getCpuFeatures().avx512f && dim >= 16) {
+                fstdistfunc_ = L2SqrAVX512ForDim(dim);
+                batchdistfunc_ = L2SqrBatchAVX512ForDim(dim);
+            } else if (getCpuFeatures().avx2 && getCpuFeatures().fma && dim >= 8) {
+                fstdistfunc_ = L2SqrAVX2ForDim(dim);
+                batchdistfunc_ = L2SqrBatchAVX2ForDim(dim);
+            }
         #endif
             dim_ = dim;
             data_size_ = dim * sizeof(float);
@@ -200,9 +405,346 @@ namespace hnswlib {
             return &dim_;
         }
 
+        BATCHDISTFUNC<float> get_batch_dist_func() {
+            return batchdistfunc_;
+        }
+
         ~L2Space() {}
     };
 
+    /*
+     * L2Space with the dimension known at compile time, for HierarchicalNSW<float, L2SqrStatic<dim>>: the search
+     * loops call distance() directly instead of through the function pointer of the space, and the kernel for
+     * the dimension is picked at runtime like that of L2Space.
+     */
+    template<size_t dim>
+    struct L2SqrStatic {
+        static const size_t static_dim = dim;
+
+        static float distance(const void *pVect1, const void *pVect2, const void *qty_ptr) {
+            // the kernel is picked on the first call
+            static const DISTFUNC<float> kernel = pickKernel();
+            return kernel(pVect1, pVect2, qty_ptr);
+        }
+
+        static DISTFUNC<float> pickKernel() {
+        #if defined(USE_RUNTIME_DISPATCH)
+            if (getCpuFeatures().avx512f && dim >= 16)
+                return L2SqrAVX512<dim>;
+            if (getCpuFeatures().avx2 && getCpuFeatures().fma && dim >= 8)
+                return L2SqrAVX2<dim>;
+        #endif
+        #if defined(USE_SSE) || defined(USE_AVX)
+            if (dim % 16 == 0)
+                return L2SqrSIMD16Ext;
+            if (dim % 4 == 0)
+                return L2SqrSIMD4Ext;
+        #endif
+            return L2Sqr;
+        }
+    };
+
+    /*
+     * SQ8 vectors: a float offset and scale followed by one uint8 code per dimension,
+     * x[i] ~ offset + scale * code[i]. The range is fitted to every vector, so no training is needed.
+     */
+    struct SQ8Header {
+        float offset;
+        float scale;
+    };
+
+    static void
+    encodeSQ8(const float *vector, size_t dim, void *code) {
+        SQ8Header *header = (SQ8Header *) code;
+        unsigned char *codes = (unsigned char *) code + sizeof(SQ8Header);
+
+        float min_v = dim > 0 ? vector[0] : 0;
+        float max_v = min_v;
+        for (size_t i = 1; i < dim; i++) {
+            min_v = std::min(min_v, vector[i]);
+            max_v = std::max(max_v, vector[i]);
+        }
+        header->offset = min_v;
+        header->scale = (max_v - min_v) / 255;
+        float inv_scale = header->scale > 0 ? 1 / header->scale : 0;
+        for (size_t i = 0; i < dim; i++) {
+            float c = std::round((vector[i] - min_v) * inv_scale);
+            codes[i] = (unsigned char) std::min(255.0f, std::max(0.0f, c));
+        }
+    }
+
+    static void
+    decodeSQ8(const void *code, size_t dim, float *vector) {
+        const SQ8Header *header = (const SQ8Header *) code;
+        const unsigned char *codes = (const unsigned char *) code + sizeof(SQ8Header);
+        for (size_t i = 0; i < dim; i++)
+            vector[i] = header->offset + header->scale * codes[i];
+    }
+
+#if defined(USE_SSE)
+    static inline __m128
+    loadSQ8Codes(const unsigned char *codes) {
+        int packed;
+        memcpy(&packed, codes, sizeof(packed));
+        __m128i zero = _mm_setzero_si128();
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero));
+    }
+#endif
+
+    // float query against an SQ8 vector
+    static float
+    L2SqrSQ8(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const float *pVect1 = (const float *) pVect1v;
+        const SQ8Header *header = (const SQ8Header *) pVect2v;
+        const unsigned char *codes = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+        float res = 0;
+
+#if defined(USE_SSE)
+        float PORTABLE_ALIGN32 TmpRes[8];
+        __m128 offset = _mm_set1_ps(header->offset);
+        __m128 scale = _mm_set1_ps(header->scale);
+        __m128 sum = _mm_set1_ps(0);
+        for (; i + 4 <= qty; i += 4) {
+            __m128 v2 = _mm_add_ps(offset, _mm_mul_ps(scale, loadSQ8Codes(codes + i)));
+            __m128 diff = _mm_sub_ps(_mm_loadu_ps(pVect1 + i), v2);
+            sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+        }
+        _mm_store_ps(TmpRes, sum);
+        res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+#endif
+        for (; i < qty; i++) {
+            float t = pVect1[i] - (header->offset + header->scale * codes[i]);
+            res += t * t;
+        }
+        return (res);
+    }
+
+    // two SQ8 vectors, used while building the index
+    static float
+    L2SqrSQ8Codes(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const SQ8Header *header1 = (const SQ8Header *) pVect1v;
+        const SQ8Header *header2 = (const SQ8Header *) pVect2v;
+        const unsigned char *codes1 = (const unsigned char *) pVect1v + sizeof(SQ8Header);
+        const unsigned char *codes2 = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        float offset_diff = header1->offset - header2->offset;
+        size_t i = 0;
+        float res = 0;
+
+#if defined(USE_SSE)
+        float PORTABLE_ALIGN32 TmpRes[8];
+        __m128 offset = _mm_set1_ps(offset_diff);
+        __m128 scale1 = _mm_set1_ps(header1->scale);
+        __m128 scale2 = _mm_set1_ps(header2->scale);
+        __m128 sum = _mm_set1_ps(0);
+        for (; i + 4 <= qty; i += 4) {
+            __m128 diff = _mm_add_ps(offset, _mm_sub_ps(_mm_mul_ps(scale1, loadSQ8Codes(codes1 + i)),
+                                                        _mm_mul_ps(scale2, loadSQ8Codes(codes2 + i))));
+            sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+        }
+        _mm_store_ps(TmpRes, sum);
+        res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+#endif
+        for (; i < qty; i++) {
+            float t = offset_diff + header1->scale * codes1[i] - header2->scale * codes2[i];
+            res += t * t;
+        }
+        return (res);
+    }
+
+#if defined(USE_RUNTIME_DISPATCH)
+    PORTABLE_TARGET("avx2") static inline __m256
+    loadSQ8CodesAVX2(const unsigned char *codes) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) codes)));
+    }
+
+    PORTABLE_TARGET("avx512f") static inline __m512
+    loadSQ8CodesAVX512(const unsigned char *codes) {
+        return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) codes)));
+    }
+
+    PORTABLE_TARGET("avx2,fma") static float
+    L2SqrSQ8AVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const float *pVect1 = (const float *) pVect1v;
+        const SQ8Header *header = (const SQ8Header *) pVect2v;
+        const unsigned char *codes = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m256 offset = _mm256_set1_ps(header->offset);
+        __m256 scale = _mm256_set1_ps(header->scale);
+        __m256 sum = _mm256_setzero_ps();
+        for (; i + 8 <= qty; i += 8) {
+            __m256 v2 = _mm256_fmadd_ps(scale, loadSQ8CodesAVX2(codes + i), offset);
+            __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + i), v2);
+            sum = _mm256_fmadd_ps(diff, diff, sum);
+        }
+        __m128 part = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        part = _mm_hadd_ps(part, part);
+        part = _mm_hadd_ps(part, part);
+        float res = _mm_cvtss_f32(part);
+
+        for (; i < qty; i++) {
+            float t = pVect1[i] - (header->offset + header->scale * codes[i]);
+            res += t * t;
+        }
+        return (res);
+    }
+
+    PORTABLE_TARGET("avx2,fma") static float
+    L2SqrSQ8CodesAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const SQ8Header *header1 = (const SQ8Header *) pVect1v;
+        const SQ8Header *header2 = (const SQ8Header *) pVect2v;
+        const unsigned char *codes1 = (const unsigned char *) pVect1v + sizeof(SQ8Header);
+        const unsigned char *codes2 = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        float offset_diff = header1->offset - header2->offset;
+        size_t i = 0;
+
+        __m256 offset = _mm256_set1_ps(offset_diff);
+        __m256 scale1 = _mm256_set1_ps(header1->scale);
+        __m256 scale2 = _mm256_set1_ps(header2->scale);
+        __m256 sum = _mm256_setzero_ps();
+        for (; i + 8 <= qty; i += 8) {
+            __m256 diff = _mm256_fmadd_ps(scale1, loadSQ8CodesAVX2(codes1 + i), offset);
+            diff = _mm256_fnmadd_ps(scale2, loadSQ8CodesAVX2(codes2 + i), diff);
+            sum = _mm256_fmadd_ps(diff, diff, sum);
+        }
+        __m128 part = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        part = _mm_hadd_ps(part, part);
+        part = _mm_hadd_ps(part, part);
+        float res = _mm_cvtss_f32(part);
+
+        for (; i < qty; i++) {
+            float t = offset_diff + header1->scale * codes1[i] - header2->scale * codes2[i];
+            res += t * t;
+        }
+        return (res);
+    }
+
+    PORTABLE_TARGET("avx512f") static float
+    L2SqrSQ8AVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const float *pVect1 = (const float *) pVect1v;
+        const SQ8Header *header = (const SQ8Header *) pVect2v;
+        const unsigned char *codes = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        size_t i = 0;
+
+        __m512 offset = _mm512_set1_ps(header->offset);
+        __m512 scale = _mm512_set1_ps(header->scale);
+        __m512 sum = _mm512_setzero_ps();
+        for (; i + 16 <= qty; i += 16) {
+            __m512 v2 = _mm512_fmadd_ps(scale, loadSQ8CodesAVX512(codes + i), offset);
+            __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + i), v2);
+            sum = _mm512_fmadd_ps(diff, diff, sum);
+        }
+        float res = _mm512_reduce_add_ps(sum);
+
+        for (; i < qty; i++) {
+            float t = pVect1[i] - (header->offset + header->scale * codes[i]);
+            res += t * t;
+        }
+        return (res);
+    }
+
+    PORTABLE_TARGET("avx512f") static float
+    L2SqrSQ8CodesAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+        const SQ8Header *header1 = (const SQ8Header *) pVect1v;
+        const SQ8Header *header2 = (const SQ8Header *) pVect2v;
+        const unsigned char *codes1 = (const unsigned char *) pVect1v + sizeof(SQ8Header);
+        const unsigned char *codes2 = (const unsigned char *) pVect2v + sizeof(SQ8Header);
+        size_t qty = *((size_t *) qty_ptr);
+        float offset_diff = header1->offset - header2->offset;
+        size_t i = 0;
+
+        __m512 offset = _mm512_set1_ps(offset_diff);
+        __m512 scale1 = _mm512_set1_ps(header1->scale);
+        __m512 scale2 = _mm512_set1_ps(header2->scale);
+        __m512 sum = _mm512_setzero_ps();
+        for (; i + 16 <= qty; i += 16) {
+            __m512 diff = _mm512_fmadd_ps(scale1, loadSQ8CodesAVX512(codes1 + i), offset);
+            diff = _mm512_fnmadd_ps(scale2, loadSQ8CodesAVX512(codes2 + i), diff);
+            sum = _mm512_fmadd_ps(diff, diff, sum);
+        }
+        float res = _mm512_reduce_add_ps(sum);
+
+        for (; i < qty; i++) {
+            float t = offset_diff + header1->scale * codes1[i] - header2->scale * codes2[i];
+            res += t * t;
+        }
+        return (res);
+    }
+#endif
+
+    /*
+     * L2 over SQ8 vectors: a quarter of the memory of L2Space plus 8 bytes per vector.
+     * Vectors are passed to the index as floats and quantized on insertion; queries stay floats.
+     */
+    class L2SpaceSQ8 : public SpaceInterface<float> {
+
+        L2Space exact_;
+        DISTFUNC<float> fstdistfunc_;
+        DISTFUNC<float> querydistfunc_;
+        size_t data_size_;
+        size_t dim_;
+    public:
+        L2SpaceSQ8(size_t dim) : exact_(dim) {
+            fstdistfunc_ = L2SqrSQ8Codes;
+            querydistfunc_ = L2SqrSQ8;
+        #if defined(USE_RUNTIME_DISPATCH)
+            if (getCpuFeatures().avx512f && dim >= 16) {
+                fstdistfunc_ = L2SqrSQ8CodesAVX512;
+                querydistfunc_ = L2SqrSQ8AVX512;
+            } else if (getCpuFeatures().avx2 && getCpuFeatures().fma && dim >= 8) {
+                fstdistfunc_ = L2SqrSQ8CodesAVX2;
+                querydistfunc_ = L2SqrSQ8AVX2;
+            }
+        #endif
+            dim_ = dim;
+            data_size_ = sizeof(SQ8Header) + dim * sizeof(unsigned char);
+        }
+
+        size_t get_data_size() {
+            return data_size_;
+        }
+
+        DISTFUNC<float> get_dist_func() {
+            return fstdistfunc_;
+        }
+
+        void *get_dist_func_param() {
+            return &dim_;
+        }
+
+        bool has_encoder() {
+            return true;
+        }
+
+        size_t get_input_size() {
+            return dim_ * sizeof(float);
+        }
+
+        void encode(const void *vector, void *code) {
+            encodeSQ8((const float *) vector, dim_, code);
+        }
+
+        void decode(const void *code, void *vector) {
+            decodeSQ8(code, dim_, (float *) vector);
+        }
+
+        DISTFUNC<float> get_query_dist_func() {
+            return querydistfunc_;
+        }
+
+        DISTFUNC<float> get_input_dist_func() {
+            return exact_.get_dist_func();
+        }
+
+        ~L2SpaceSQ8() {}
+    };
+
     static int
     L2SqrI(const void *__restrict pVect1, const void *__restrict pVect2, const void *__restrict qty_ptr) {
 
@@ -211,8 +753,8 @@ namespace hnswlib {
         unsigned char *a = (unsigned char *) pVect1;
         unsigned char *b = (unsigned char *) pVect2;
 
-        qty = qty >> 2;
-        for (size_t i = 0; i < qty; i++) {
+        size_t qty4 = qty >> 2;
+        for (size_t i = 0; i < qty4; i++) {
 
             res += ((*a) - (*b)) * ((*a) - (*b));
             a++;
@@ -229,11 +771,139 @@ namespace hnswlib {
 
 
         }
+        for (size_t i = qty4 << 2; i < qty; i++) {
+            res += ((*a) - (*b)) * ((*a) - (*b));
+            a++;
+            b++;
+        }
 
         return (res);
 
     }
 
+#if defined(USE_SSE) && defined(__SSE2__)
+    static int
+    L2SqrISSE(const void *__restrict pVect1, const void *__restrict pVect2, const void *__restrict qty_ptr) {
+        size_t qty = *((size_t *) qty_ptr);
+        const unsigned char *a = (const unsigned char *) pVect1;
+        const unsigned char *b = (const unsigned char *) pVect2;
+        size_t i = 0;
+
+        __m128i zero = _mm_setzero_si128();
+        __m128i sum = _mm_setzero_si128();
+        for (; i + 16 <= qty; i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+            // |a - b| with saturating subtractions, then squared and summed in pairs as 16 bit values
+            __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            __m128i lo = _mm_unpacklo_epi8(diff, zero);
+            __m128i hi = _mm_unpackhi_epi8(diff, zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(lo, lo));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(hi, hi));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        int res = _mm_cvtsi128_si32(sum);
+
+        for (; i < qty; i++) {
+            int t = (int) a[i] - (int) b[i];
+            res += t * t;
+        }
+        return (res);
+    }
+#endif
+
+#if defined(USE_RUNTIME_DISPATCH)
+    PORTABLE_TARGET("avx2") static int
+    L2SqrIAVX2(const void *__restrict pVect1, const void *__restrict pVect2, const void *__restrict qty_ptr) {
+        size_t qty = *((size_t *) qty_ptr);
+        const unsigned char *a = (const unsigned char *) pVect1;
+        const unsigned char *b = (const unsigned char *) pVect2;
+        size_t i = 0;
+
+        __m256i zero = _mm256_setzero_si256();
+        __m256i sum = _mm256_setzero_si256();
+        for (; i + 32 <= qty; i += 32) {
+            __m256i va = _mm256_loadu_si256((const __m256i *) (a + i));
+            __m256i vb = _mm256_loadu_si256((const __m256i *) (b + i));
+            // |a - b| with saturating subtractions, then squared and summed in pairs as 16 bit values
+            __m256i diff = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+            __m256i lo = _mm256_unpacklo_epi8(diff, zero);
+            __m256i hi = _mm256_unpackhi_epi8(diff, zero);
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(lo, lo));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(hi, hi));
+        }
+        __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        sum128 = _mm_hadd_epi32(sum128, sum128);
+        sum128 = _mm_hadd_epi32(sum128, sum128);
+        int res = _mm_cvtsi128_si32(sum128);
+
+        for (; i < qty; i++) {
+            int t = (int) a[i] - (int) b[i];
+            res += t * t;
+        }
+        return (res);
+    }
+
+    PORTABLE_TARGET("avx512f,avx512bw") static int
+    L2SqrIAVX512(const void *__restrict pVect1, const void *__restrict pVect2, const void *__restrict qty_ptr) {
+        size_t qty = *((size_t *) qty_ptr);
+        const unsigned char *a = (const unsigned char *) pVect1;
+        const unsigned char *b = (const unsigned char *) pVect2;
+        size_t i = 0;
+
+        __m512i zero = _mm512_setzero_si512();
+        __m512i sum = _mm512_setzero_si512();
+        for (; i < qty; i += 64) {
+            __m512i va, vb;
+            if (i + 64 <= qty) {
+                va = _mm512_loadu_si512((const void *) (a + i));
+                vb = _mm512_loadu_si512((const void *) (b + i));
+            } else {
+                __mmask64 mask = ((__mmask64) 1 << (qty - i)) - 1;
+                va = _mm512_maskz_loadu_epi8(mask, a + i);
+                vb = _mm512_maskz_loadu_epi8(mask, b + i);
+            }
+            __m512i diff = _mm512_or_si512(_mm512_subs_epu8(va, vb), _mm512_subs_epu8(vb, va));
+            __m512i lo = _mm512_unpacklo_epi8(diff, zero);
+            __m512i hi = _mm512_unpackhi_epi8(diff, zero);
+            sum = _mm512_add_epi32(sum, _mm512_madd_epi16(lo, lo));
+            sum = _mm512_add_epi32(sum, _mm512_madd_epi16(hi, hi));
+        }
+        return _mm512_reduce_add_epi32(sum);
+    }
+
+    // as L2SqrIAVX512, but vpdpwssd squares and accumulates the 16 bit pairs in one instruction
+    PORTABLE_TARGET("avx512f,avx512bw,avx512vnni") static int
+    L2SqrIVNNI(const void *__restrict pVect1, const void *__restrict pVect2, const void *__restrict qty_ptr) {
+        size_t qty = *((size_t *) qty_ptr);
+        const unsigned char *a = (const unsigned char *) pVect1;
+        const unsigned char *b = (const unsigned char *) pVect2;
+        size_t i = 0;
+
+        __m512i zero = _mm512_setzero_si512();
+        __m512i sum0 = _mm512_setzero_si512();
+        __m512i sum1 = _mm512_setzero_si512();
+        for (; i < qty; i += 64) {
+            __m512i va, vb;
+            if (i + 64 <= qty) {
+                va = _mm512_loadu_si512((const void *) (a + i));
+                vb = _mm512_loadu_si512((const void *) (b + i));
+            } else {
+                __mmask64 mask = ((__mmask64) 1 << (qty - i)) - 1;
+                va = _mm512_maskz_loadu_epi8(mask, a + i);
+                vb = _mm512_maskz_loadu_epi8(mask, b + i);
+            }
+            __m512i diff = _mm512_or_si512(_mm512_subs_epu8(va, vb), _mm512_subs_epu8(vb, va));
+            __m512i lo = _mm512_unpacklo_epi8(diff, zero);
+            __m512i hi = _mm512_unpackhi_epi8(diff, zero);
+            sum0 = _mm512_dpwssd_epi32(sum0, lo, lo);
+            sum1 = _mm512_dpwssd_epi32(sum1, hi, hi);
+        }
+        return _mm512_reduce_add_epi32(_mm512_add_epi32(sum0, sum1));
+    }
+#endif
+
     class L2SpaceI : public SpaceInterface<int> {
 
         DISTFUNC<int> fstdistfunc_;
@@ -242,6 +912,18 @@ namespace hnswlib {
     public:
         L2SpaceI(size_t dim) {
             fstdistfunc_ = L2SqrI;
+        #if defined(USE_SSE) && defined(__SSE2__)
+            if (dim >= 16)
+                fstdistfunc_ = L2SqrISSE;
+        #endif
+        #if defined(USE_RUNTIME_DISPATCH)
+            if (getCpuFeatures().avx512vnni && getCpuFeatures().avx512bw && dim >= 64)
+                fstdistfunc_ = L2SqrIVNNI;
+            else if (getCpuFeatures().avx512bw && dim >= 64)
+                fstdistfunc_ = L2SqrIAVX512;
+            else if (getCpuFeatures().avx2 && dim >= 32)
+                fstdistfunc_ = L2SqrIAVX2;
+        #endif
             dim_ = dim;
             data_size_ = dim * sizeof(unsigned char);
         }
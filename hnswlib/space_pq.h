@@ -0,0 +1,302 @@
+#pragma once
+#include "hnswlib.h"
+#include "parallel.h"
+#include <random>
+#include <fstream>
+#include <stdexcept>
+#include <numeric>
+#include <limits>
+
+namespace hnswlib {
+///////////////////////////////////////////////////////////
+//
+// Product quantization: the vector is split into m subvectors
+// of dim / m dimensions and every subvector is replaced by the
+// index of its closest centroid out of PQ_KSUB, one byte each.
+// Queries are turned into a table of their distances to all
+// centroids (asymmetric distance), the codes stored in the
+// index are compared with each other through precomputed
+// centroid-to-centroid tables (symmetric distance).
+//
+/////////////////////////////////////////////////////////
+
+    static const size_t PQ_KSUB = 256;
+
+    struct PQDistParam {
+        size_t m;
+        // m tables of PQ_KSUB * PQ_KSUB squared distances between the centroids of a subspace
+        const float *sdc_tables;
+    };
+
+    // query distance table (m * PQ_KSUB floats, see PQSpace::encode_query) against a code
+    static float
+    PQDistanceTable(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+        const float *table = (const float *) pVect1v;
+        const unsigned char *code = (const unsigned char *) pVect2v;
+        size_t m = ((const PQDistParam *) param_ptr)->m;
+
+        float res = 0;
+        size_t i = 0;
+        for (; i + 4 <= m; i += 4) {
+            res += table[code[i] + (i + 0) * PQ_KSUB] + table[code[i + 1] + (i + 1) * PQ_KSUB] +
+                   table[code[i + 2] + (i + 2) * PQ_KSUB] + table[code[i + 3] + (i + 3) * PQ_KSUB];
+        }
+        for (; i < m; i++)
+            res += table[code[i] + i * PQ_KSUB];
+        return (res);
+    }
+
+    // two codes, used while building the index
+    static float
+    PQDistanceSymmetric(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+        const unsigned char *code1 = (const unsigned char *) pVect1v;
+        const unsigned char *code2 = (const unsigned char *) pVect2v;
+        const PQDistParam *param = (const PQDistParam *) param_ptr;
+
+        float res = 0;
+        const float *table = param->sdc_tables;
+        for (size_t i = 0; i < param->m; i++) {
+            res += table[code1[i] * PQ_KSUB + code2[i]];
+            table += PQ_KSUB * PQ_KSUB;
+        }
+        return (res);
+    }
+
+    /*
+     * Squared L2 over product quantized vectors: m bytes per vector. The space has to be trained on a
+     * sample of the data (or its codebooks loaded) before vectors are added. Vectors and queries are
+     * passed as floats. The distances are approximate; HierarchicalNSW::setRerank can reorder the results
+     * by exact distances to the original vectors, e.g. kept in a memory-mapped file.
+     */
+    class PQSpace : public SpaceInterface<float> {
+
+        L2Space exact_;
+        L2Space sub_space_;
+        PQDistParam param_;
+        size_t dim_;
+        size_t dsub_;
+        bool trained_;
+
+        // m * PQ_KSUB centroids of dsub_ floats
+        std::vector<float> centroids_;
+        std::vector<float> sdc_tables_;
+
+        const float *centroid(size_t sub, size_t k) const {
+            return centroids_.data() + (sub * PQ_KSUB + k) * dsub_;
+        }
+
+        float *centroid(size_t sub, size_t k) {
+            return centroids_.data() + (sub * PQ_KSUB + k) * dsub_;
+        }
+
+        PQSpace(const std::pair<size_t, size_t> &shape) : PQSpace(shape.first, shape.second) {}
+
+        size_t closestCentroid(size_t sub, const float *subvector) {
+            DISTFUNC<float> distfunc = sub_space_.get_dist_func();
+            void *dist_param = sub_space_.get_dist_func_param();
+            size_t best = 0;
+            float best_dist = std::numeric_limits<float>::max();
+            for (size_t k = 0; k < PQ_KSUB; k++) {
+                float dist = distfunc(subvector, centroid(sub, k), dist_param);
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = k;
+                }
+            }
+            return best;
+        }
+
+        void trainSubspace(const float *data, size_t n, size_t sub, size_t iterations, unsigned int seed) {
+            std::vector<float> points(n * dsub_);
+            for (size_t i = 0; i < n; i++)
+                memcpy(points.data() + i * dsub_, data + i * dim_ + sub * dsub_, dsub_ * sizeof(float));
+
+            // start from distinct random points of the sample
+            std::mt19937 rng(seed + sub);
+            std::vector<size_t> perm(n);
+            std::iota(perm.begin(), perm.end(), 0);
+            for (size_t k = 0; k < PQ_KSUB; k++) {
+                std::swap(perm[k], perm[k + rng() % (n - k)]);
+                memcpy(centroid(sub, k), points.data() + perm[k] * dsub_, dsub_ * sizeof(float));
+            }
+
+            std::vector<size_t> counts(PQ_KSUB);
+            std::vector<double> sums(PQ_KSUB * dsub_);
+            for (size_t iteration = 0; iteration < iterations; iteration++) {
+                std::fill(counts.begin(), counts.end(), 0);
+                std::fill(sums.begin(), sums.end(), 0);
+                for (size_t i = 0; i < n; i++) {
+                    size_t k = closestCentroid(sub, points.data() + i * dsub_);
+                    counts[k]++;
+                    for (size_t j = 0; j < dsub_; j++)
+                        sums[k * dsub_ + j] += points[i * dsub_ + j];
+                }
+                for (size_t k = 0; k < PQ_KSUB; k++) {
+                    float *c = centroid(sub, k);
+                    if (counts[k] == 0) {
+                        // an empty cluster restarts from a random point
+                        memcpy(c, points.data() + (rng() % n) * dsub_, dsub_ * sizeof(float));
+                        continue;
+                    }
+                    for (size_t j = 0; j < dsub_; j++)
+                        c[j] = (float) (sums[k * dsub_ + j] / counts[k]);
+                }
+            }
+        }
+
+        void computeTables() {
+            DISTFUNC<float> distfunc = sub_space_.get_dist_func();
+            void *dist_param = sub_space_.get_dist_func_param();
+            sdc_tables_.resize(param_.m * PQ_KSUB * PQ_KSUB);
+            for (size_t sub = 0; sub < param_.m; sub++) {
+                float *table = sdc_tables_.data() + sub * PQ_KSUB * PQ_KSUB;
+                for (size_t k1 = 0; k1 < PQ_KSUB; k1++) {
+                    for (size_t k2 = 0; k2 < PQ_KSUB; k2++)
+                        table[k1 * PQ_KSUB + k2] = distfunc(centroid(sub, k1), centroid(sub, k2), dist_param);
+                }
+            }
+            param_.sdc_tables = sdc_tables_.data();
+            trained_ = true;
+        }
+
+        void checkTrained() const {
+            if (!trained_)
+                throw std::runtime_error("PQSpace has to be trained or loaded before use");
+        }
+
+    public:
+        PQSpace(size_t dim, size_t m) : exact_(dim), sub_space_(m > 0 ? dim / m : 0) {
+            if (m == 0 || dim % m != 0)
+                throw std::runtime_error("PQSpace: the dimension has to be a multiple of the number of subquantizers");
+            dim_ = dim;
+            param_.m = m;
+            param_.sdc_tables = nullptr;
+            dsub_ = dim / m;
+            trained_ = false;
+            centroids_.resize(m * PQ_KSUB * dsub_);
+        }
+
+        // loads codebooks written by saveCodebooks
+        PQSpace(const std::string &location) : PQSpace(readCodebookShape(location)) {
+            loadCodebooks(location);
+        }
+
+        /**
+         * Runs k-means with PQ_KSUB centroids in every subspace on n sample vectors (n * dim floats),
+         * the subspaces are trained on num_threads threads (0 uses all cores).
+         */
+        void train(const float *data, size_t n, size_t iterations = 25, size_t num_threads = 0, unsigned int seed = 100) {
+            if (n < PQ_KSUB)
+                throw std::runtime_error("PQSpace: training needs at least 256 vectors");
+            ParallelFor(0, param_.m, num_threads, [&](size_t sub, size_t threadId) {
+                trainSubspace(data, n, sub, iterations, seed);
+            });
+            computeTables();
+        }
+
+        bool isTrained() const {
+            return trained_;
+        }
+
+        static std::pair<size_t, size_t> readCodebookShape(const std::string &location) {
+            std::ifstream input(location, std::ios::binary);
+            if (!input.is_open())
+                throw std::runtime_error("Cannot open file");
+            size_t dim, m, ksub;
+            readBinaryPOD(input, dim);
+            readBinaryPOD(input, m);
+            readBinaryPOD(input, ksub);
+            if (!input || ksub != PQ_KSUB)
+                throw std::runtime_error("Not a PQSpace codebook file");
+            return std::make_pair(dim, m);
+        }
+
+        void saveCodebooks(const std::string &location) const {
+            checkTrained();
+            std::ofstream output(location, std::ios::binary);
+            writeBinaryPOD(output, dim_);
+            writeBinaryPOD(output, param_.m);
+            writeBinaryPOD(output, PQ_KSUB);
+            output.write((const char *) centroids_.data(), centroids_.size() * sizeof(float));
+            output.close();
+        }
+
+        void loadCodebooks(const std::string &location) {
+            std::pair<size_t, size_t> shape = readCodebookShape(location);
+            if (shape.first != dim_ || shape.second != param_.m)
+                throw std::runtime_error("The codebooks were trained for a different space");
+            std::ifstream input(location, std::ios::binary);
+            input.seekg(3 * sizeof(size_t));
+            input.read((char *) centroids_.data(), centroids_.size() * sizeof(float));
+            if (!input)
+                throw std::runtime_error("Truncated PQSpace codebook file");
+            computeTables();
+        }
+
+        size_t get_data_size() {
+            return param_.m;
+        }
+
+        DISTFUNC<float> get_dist_func() {
+            return PQDistanceSymmetric;
+        }
+
+        void *get_dist_func_param() {
+            return &param_;
+        }
+
+        bool has_encoder() {
+            return true;
+        }
+
+        size_t get_input_size() {
+            return dim_ * sizeof(float);
+        }
+
+        void encode(const void *vector, void *code) {
+            checkTrained();
+            for (size_t sub = 0; sub < param_.m; sub++)
+                ((unsigned char *) code)[sub] = (unsigned char) closestCentroid(sub, (const float *) vector + sub * dsub_);
+        }
+
+        void decode(const void *code, void *vector) {
+            for (size_t sub = 0; sub < param_.m; sub++)
+                memcpy((float *) vector + sub * dsub_, centroid(sub, ((const unsigned char *) code)[sub]), dsub_ * sizeof(float));
+        }
+
+        size_t get_query_size() {
+            return param_.m * PQ_KSUB * sizeof(float);
+        }
+
+        // the distances of the query to all centroids, built once per search
+        void encode_query(const void *query, void *encoded) {
+            checkTrained();
+            DISTFUNC<float> distfunc = sub_space_.get_dist_func();
+            void *dist_param = sub_space_.get_dist_func_param();
+            float *table = (float *) encoded;
+            for (size_t sub = 0; sub < param_.m; sub++) {
+                const float *subquery = (const float *) query + sub * dsub_;
+                for (size_t k = 0; k < PQ_KSUB; k++)
+                    table[sub * PQ_KSUB + k] = distfunc(subquery, centroid(sub, k), dist_param);
+            }
+        }
+
+        DISTFUNC<float> get_query_dist_func() {
+            return PQDistanceTable;
+        }
+
+        DISTFUNC<float> get_input_dist_func() {
+            return exact_.get_dist_func();
+        }
+
+        void *get_input_dist_func_param() {
+            return exact_.get_dist_func_param();
+        }
+
+        size_t get_dim() {
+            return dim_;
+        }
+
+        ~PQSpace() {}
+    };
+}
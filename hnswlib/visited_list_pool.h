@@ -1,7 +1,16 @@
 #pragma once
 
 #include <mutex>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <memory>
+#include <new>
 #include <string.h>
+#include <stdexcept>
+#include "huge_pages.h"
 
 namespace hnswlib {
     typedef unsigned short int vl_type;
@@ -11,11 +20,15 @@ namespace hnswlib {
         vl_type curV;
         vl_type *mass;
         unsigned int numelements;
+        // buffers of the search using the list, sized by the index on first use and pooled with the list
+        std::vector<char> scratch;
 
-        VisitedList(int numelements1) {
+        VisitedList(int numelements1, bool huge_pages = false) {
             curV = -1;
             numelements = numelements1;
-            mass = new vl_type[numelements];
+            mass = (vl_type *) allocateLarge(sizeof(vl_type) * numelements, huge_pages);
+            if (mass == nullptr)
+                throw std::runtime_error("Not enough memory: VisitedList failed to allocate");
         }
 
         void reset() {
@@ -26,53 +39,252 @@ namespace hnswlib {
             }
         };
 
-        ~VisitedList() { delete[] mass; }
+        // marks the element visited, returns false if it already was
+        inline bool visit(unsigned int id) {
+            if (mass[id] == curV)
+                return false;
+            mass[id] = curV;
+            return true;
+        }
+
+        inline void prefetch(unsigned int id) const {
+#ifdef USE_SSE
+            _mm_prefetch((char *) (mass + id), _MM_HINT_T0);
+#endif
+        }
+
+        ~VisitedList() { freeLarge(mass); }
+    };
+
+///////////////////////////////////////////////////////////
+//
+// Visited set whose memory scales with the number of elements
+// a search touches rather than with the index size: an
+// open-addressing hash set with linear probing. Like
+// VisitedList it is cleared by bumping an epoch tag.
+//
+/////////////////////////////////////////////////////////
+
+    class VisitedHashSet {
+        static const unsigned int max_start_capacity = 1024;
+        // the capacity a reset shrinks back to
+        unsigned int start_capacity;
+
+        // key and tag share a cache line, a probe touches one line
+        struct Entry {
+            unsigned int key;
+            vl_type tag;
+        };
+
+        Entry *table;
+        unsigned int capacity;
+        unsigned int shift;
+        unsigned int count;
+
+        inline unsigned int slotOf(unsigned int id) const {
+            return (id * 2654435769u) >> shift;
+        }
+
+        void allocate(unsigned int new_capacity) {
+            capacity = new_capacity;
+            shift = 32;
+            while ((1u << (32 - shift)) < capacity)
+                shift--;
+            table = new Entry[capacity];
+            memset(table, 0, sizeof(Entry) * capacity);
+        }
+
+        void grow() {
+            Entry *old_table = table;
+            unsigned int old_capacity = capacity;
+            allocate(capacity * 2);
+            for (unsigned int i = 0; i < old_capacity; i++) {
+                if (old_table[i].tag != curV)
+                    continue;
+                unsigned int slot = slotOf(old_table[i].key);
+                while (table[slot].tag == curV)
+                    slot = (slot + 1) & (capacity - 1);
+                table[slot] = old_table[i];
+            }
+            delete[] old_table;
+        }
+
+    public:
+        vl_type curV;
+        // see VisitedList::scratch
+        std::vector<char> scratch;
+
+        /**
+         * The table starts at 1024 slots, or at twice numelements1 for smaller indexes, and doubles whenever a
+         * search fills half of it. A reset after a search that used less than an eighth of the table shrinks it
+         * to the size that search needed, a large search does not keep its memory in the pool. The table is small,
+         * huge pages would not help and are ignored.
+         */
+        VisitedHashSet(int numelements1, bool /* huge_pages */ = false) {
+            curV = -1;
+            count = 0;
+            start_capacity = 16;
+            while (start_capacity < max_start_capacity && start_capacity < 2 * (unsigned int) std::max(numelements1, 1))
+                start_capacity *= 2;
+            allocate(start_capacity);
+        }
+
+        void reset() {
+            curV++;
+            if (capacity > start_capacity && count * 8 < capacity) {
+                unsigned int new_capacity = start_capacity;
+                while (new_capacity < count * 4)
+                    new_capacity *= 2;
+                delete[] table;
+                allocate(new_capacity);
+                curV = 1;
+            } else if (curV == 0) {
+                memset(table, 0, sizeof(Entry) * capacity);
+                curV++;
+            }
+            count = 0;
+        };
+
+        // marks the element visited, returns false if it already was
+        inline bool visit(unsigned int id) {
+            unsigned int slot = slotOf(id);
+            while (table[slot].tag == curV) {
+                if (table[slot].key == id)
+                    return false;
+                slot = (slot + 1) & (capacity - 1);
+            }
+            table[slot].key = id;
+            table[slot].tag = curV;
+            // keep the load factor at or below 1/2
+            if (++count * 2 > capacity)
+                grow();
+            return true;
+        }
+
+        inline void prefetch(unsigned int id) const {
+#ifdef USE_SSE
+            _mm_prefetch((char *) (table + slotOf(id)), _MM_HINT_T0);
+#endif
+        }
+
+        size_t memoryUsage() const {
+            return capacity * sizeof(Entry);
+        }
+
+        ~VisitedHashSet() { delete[] table; }
+    };
+
+    enum VisitedSetType {
+        // a tag per element of the index: fastest, but max_elements * 2 bytes per concurrent search
+        VISITED_LIST,
+        // a hash set growing with the number of touched elements, for huge indexes searched with low ef
+        VISITED_HASH_SET
     };
 ///////////////////////////////////////////////////////////
 //
 // Class for multi-threaded pool-management of VisitedLists
 //
+// Every thread gets a home slot (a thread-local index into a
+// fixed array of atomic pointers), so a thread normally takes
+// back the list it released last without touching shared
+// state. If its slot is empty, the lists parked in the other
+// slots are stolen with lock-free exchanges; the mutex-guarded
+// overflow list is only used when all slots are occupied.
+//
 /////////////////////////////////////////////////////////
 
-    class VisitedListPool {
-        std::deque<VisitedList *> pool;
-        std::mutex poolguard;
+    template<typename VisitedT>
+    class BasicVisitedListPool {
+        // one slot per cache line, so threads do not invalidate each other's slots
+        struct alignas(64) Slot {
+            std::atomic<VisitedT *> vl;
+        };
+        static_assert(sizeof(Slot) == 64, "a slot must fill one cache line");
+
+        Slot *slots;
+        // new does not align to more than the fundamental alignment before C++17, slots is aligned in it
+        char *slots_memory;
+        size_t num_slots;
+        std::deque<VisitedT *> overflow;
+        std::mutex overflow_guard;
         int numelements;
+        bool huge_pages;
+
+        static size_t threadIndex() {
+            static std::atomic<size_t> next_thread_index(0);
+            thread_local size_t thread_index = next_thread_index.fetch_add(1);
+            return thread_index;
+        }
 
     public:
-        VisitedListPool(int initmaxpools, int numelements1) {
+        BasicVisitedListPool(int initmaxpools, int numelements1, bool huge_pages1 = false) {
             numelements = numelements1;
+            huge_pages = huge_pages1;
+            size_t hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+            num_slots = 16;
+            while (num_slots < 2 * hardware_threads)
+                num_slots *= 2;
+            size_t slots_size = sizeof(Slot) * (num_slots + 1);
+            slots_memory = new char[slots_size];
+            void *aligned = slots_memory;
+            std::align(alignof(Slot), sizeof(Slot) * num_slots, aligned, slots_size);
+            slots = (Slot *) aligned;
+            for (size_t i = 0; i < num_slots; i++) {
+                new (&slots[i]) Slot();
+                slots[i].vl.store(nullptr, std::memory_order_relaxed);
+            }
             for (int i = 0; i < initmaxpools; i++)
-                pool.push_front(new VisitedList(numelements));
+                releaseVisitedList(new VisitedT(numelements, huge_pages));
         }
 
-        VisitedList *getFreeVisitedList() {
-            VisitedList *rez;
-            {
-                std::unique_lock <std::mutex> lock(poolguard);
-                if (pool.size() > 0) {
-                    rez = pool.front();
-                    pool.pop_front();
-                } else {
-                    rez = new VisitedList(numelements);
+        VisitedT *getFreeVisitedList() {
+            size_t home = threadIndex() & (num_slots - 1);
+            VisitedT *rez = slots[home].vl.exchange(nullptr, std::memory_order_acquire);
+            for (size_t i = 1; rez == nullptr && i < num_slots; i++) {
+                Slot &slot = slots[(home + i) & (num_slots - 1)];
+                if (slot.vl.load(std::memory_order_relaxed) != nullptr)
+                    rez = slot.vl.exchange(nullptr, std::memory_order_acquire);
+            }
+            if (rez == nullptr) {
+                std::unique_lock <std::mutex> lock(overflow_guard);
+                if (overflow.size() > 0) {
+                    rez = overflow.front();
+                    overflow.pop_front();
                 }
             }
+            if (rez == nullptr)
+                rez = new VisitedT(numelements, huge_pages);
             rez->reset();
             return rez;
         };
 
-        void releaseVisitedList(VisitedList *vl) {
-            std::unique_lock <std::mutex> lock(poolguard);
-            pool.push_front(vl);
+        void releaseVisitedList(VisitedT *vl) {
+            size_t home = threadIndex() & (num_slots - 1);
+            for (size_t i = 0; i < num_slots; i++) {
+                Slot &slot = slots[(home + i) & (num_slots - 1)];
+                VisitedT *expected = nullptr;
+                if (slot.vl.load(std::memory_order_relaxed) == nullptr &&
+                    slot.vl.compare_exchange_strong(expected, vl, std::memory_order_release))
+                    return;
+            }
+            std::unique_lock <std::mutex> lock(overflow_guard);
+            overflow.push_front(vl);
         };
 
-        ~VisitedListPool() {
-            while (pool.size()) {
-                VisitedList *rez = pool.front();
-                pool.pop_front();
+        ~BasicVisitedListPool() {
+            for (size_t i = 0; i < num_slots; i++) {
+                delete slots[i].vl.load();
+                slots[i].~Slot();
+            }
+            delete[] slots_memory;
+            while (overflow.size()) {
+                VisitedT *rez = overflow.front();
+                overflow.pop_front();
                 delete rez;
             }
         };
     };
-}
 
+    typedef BasicVisitedListPool<VisitedList> VisitedListPool;
+    typedef BasicVisitedListPool<VisitedHashSet> VisitedHashSetPool;
+}
@@ -8,75 +8,12 @@
 
 namespace py = pybind11;
 
-/*
- * replacement for the openmp '#pragma omp parallel for' directive
- * only handles a subset of functionality (no reductions etc)
- * Process ids from start (inclusive) to end (EXCLUSIVE)
- *
- * The method is borrowed from nmslib 
- */
-template<class Function>
-inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn) {
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-    }
-
-    if (numThreads == 1) {
-        for (size_t id = start; id < end; id++) {
-            fn(id, 0);
-        }
-    } else {
-        std::vector<std::thread> threads;
-        std::atomic<size_t> current(start);
-
-        // keep track of exceptions in threads
-        // https://stackoverflow.com/a/32428427/1713196
-        std::exception_ptr lastException = nullptr;
-        std::mutex lastExceptMutex;
-
-        for (size_t threadId = 0; threadId < numThreads; ++threadId) {
-            threads.push_back(std::thread([&, threadId] {
-                while (true) {
-                    size_t id = current.fetch_add(1);
-
-                    if ((id >= end)) {
-                        break;
-                    }
-
-                    try {
-                        fn(id, threadId);
-                    } catch (...) {
-                        std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
-                        lastException = std::current_exception();
-                        /*
-                         * This will work even when current is the largest value that
-                         * size_t can fit, because fetch_add returns the previous value
-                         * before the increment (what will result in overflow
-                         * and produce 0 instead of current + 1).
-                         */
-                        current = end;
-                        break;
-                    }
-                }
-            }));
-        }
-        for (auto &thread : threads) {
-            thread.join();
-        }
-        if (lastException) {
-            std::rethrow_exception(lastException);
-        }
-    }
-
-
-}
-
 template<typename dist_t, typename data_t=float>
 class Index {
 public:
     Index(const std::string &space_name, const int dim) :
             space_name(space_name), dim(dim) {
-        normalize=false;
+        half_input=false;
         if(space_name=="l2") {
             l2space = new hnswlib::L2Space(dim);
         }
@@ -84,11 +21,29 @@ public:
             l2space = new hnswlib::InnerProductSpace(dim);
         }
         else if(space_name=="cosine") {
-            l2space = new hnswlib::InnerProductSpace(dim);
-            normalize=true;
+            l2space = new hnswlib::CosineSpace(dim);
+        }
+        else if(space_name=="l2_sq8") {
+            l2space = new hnswlib::L2SpaceSQ8(dim);
+        }
+        else if(space_name=="ip_sq8") {
+            l2space = new hnswlib::InnerProductSpaceSQ8(dim);
+        }
+        else if(space_name=="l2_fp16") {
+            l2space = new hnswlib::L2SpaceFP16(dim);
+            half_input=true;
+        }
+        else if(space_name=="ip_fp16") {
+            l2space = new hnswlib::InnerProductSpaceFP16(dim);
+            half_input=true;
+        }
+        else if(space_name=="l2_bf16") {
+            l2space = new hnswlib::L2SpaceBF16(dim);
+        }
+        else if(space_name=="ip_bf16") {
+            l2space = new hnswlib::InnerProductSpaceBF16(dim);
         }
         appr_alg = NULL;
-        ep_added = true;
         index_inited = false;
         num_threads_default = std::thread::hardware_concurrency();
     }
@@ -100,7 +55,6 @@ public:
         cur_l = 0;
         appr_alg = new hnswlib::HierarchicalNSW<dist_t>(l2space, maxElements, M, efConstruction, random_seed);
         index_inited = true;
-        ep_added = false;
     }
 
     void set_ef(size_t ef) {
@@ -119,29 +73,33 @@ public:
         this->num_threads_default = num_threads;
     }
 
+    void set_compact_visited(bool compact) {
+        appr_alg->setVisitedSetType(compact ? hnswlib::VISITED_HASH_SET : hnswlib::VISITED_LIST);
+    }
+
     void saveIndex(const std::string &path_to_index) {
         appr_alg->saveIndex(path_to_index);
     }
 
-    void loadIndex(const std::string &path_to_index, size_t max_elements) {
+    void loadIndex(const std::string &path_to_index, size_t max_elements, bool use_mmap, int num_threads) {
         if (appr_alg) {
             std::cerr<<"Warning: Calling load_index for an already inited index. Old index is being deallocated.";
             delete appr_alg;
         }
-        appr_alg = new hnswlib::HierarchicalNSW<dist_t>(l2space, path_to_index, false, max_elements);
+        if (num_threads <= 0)
+            num_threads = num_threads_default;
+        appr_alg = new hnswlib::HierarchicalNSW<dist_t>(l2space, path_to_index, false, max_elements, use_mmap, num_threads);
 		cur_l = appr_alg->cur_element_count;
     }
-	void normalize_vector(float *data, float *norm_array){
-		float norm=0.0f;
-		for(int i=0;i<dim;i++)
-			norm+=data[i]*data[i];
-		norm= 1.0f / (sqrtf(norm) + 1e-30f);
-		for(int i=0;i<dim;i++)
-			norm_array[i]=data[i]*norm;
-	}
+    // fp16 spaces take numpy float16 vectors as they are, other arrays are converted to float16
+    py::array inputArray(py::object input) {
+        if (half_input)
+            return py::array(py::module::import("numpy").attr("ascontiguousarray")(input, "float16"));
+        return py::array_t < dist_t, py::array::c_style | py::array::forcecast >(input);
+    }
 
     void addItems(py::object input, py::object ids_ = py::none(), int num_threads = -1) {
-        py::array_t < dist_t, py::array::c_style | py::array::forcecast > items(input);
+        py::array items = inputArray(input);
         auto buffer = items.request();
         if (num_threads <= 0)
             num_threads = num_threads_default;
@@ -188,43 +146,44 @@ public:
 
 
         {
-
-            int start = 0;
-            if (!ep_added) {
-                size_t id = ids.size() ? ids.at(0) : (cur_l);
-				float *vector_data=(float *) items.data(0);
-                                std::vector<float> norm_array(dim);
-				if(normalize){					
-					normalize_vector(vector_data, norm_array.data());					
-					vector_data = norm_array.data();
-					
-				}
-				appr_alg->addPoint((void *) vector_data, (size_t) id);
-                start = 1;
-                ep_added = true;
+            if (!ids.size()) {
+                ids.resize(rows);
+                for (size_t row = 0; row < rows; row++)
+                    ids[row] = cur_l + row;
             }
 
             py::gil_scoped_release l;
-            if(normalize==false) {
-                ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
-                    size_t id = ids.size() ? ids.at(row) : (cur_l+row);
-                    appr_alg->addPoint((void *) items.data(row), (size_t) id);
-                });
-            } else{
-                std::vector<float> norm_array(num_threads * dim);
-                ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
-                    // normalize vector:
-					size_t start_idx = threadId * dim;
-                    normalize_vector((float *) items.data(row), (norm_array.data()+start_idx));
-
-                    size_t id = ids.size() ? ids.at(row) : (cur_l+row);
-                    appr_alg->addPoint((void *) (norm_array.data()+start_idx), (size_t) id);
-                });
-            };
+            appr_alg->buildFrom(items.data(0), ids.data(), rows, num_threads);
             cur_l+=rows;
         }
     }
 
+    // replaces the vectors of existing labels in place, see HierarchicalNSW::updatePoint
+    void updateItems(py::object input, py::object ids_, int num_threads = -1) {
+        py::array items = inputArray(input);
+        auto buffer = items.request();
+        if (num_threads <= 0)
+            num_threads = num_threads_default;
+        if (buffer.ndim != 2 && buffer.ndim != 1) throw std::runtime_error("data must be a 1d/2d array");
+        size_t rows = buffer.ndim == 2 ? buffer.shape[0] : 1;
+        size_t features = buffer.ndim == 2 ? buffer.shape[1] : buffer.shape[0];
+        if (features != dim)
+            throw std::runtime_error("wrong dimensionality of the vectors");
+
+        py::array_t < size_t, py::array::c_style | py::array::forcecast > labels(ids_);
+        auto ids_numpy = labels.request();
+        if (!((ids_numpy.ndim == 1 && ids_numpy.shape[0] == rows) || (ids_numpy.ndim == 0 && rows == 1)))
+            throw std::runtime_error("wrong dimensionality of the labels");
+        std::vector<size_t> ids(labels.data(), labels.data() + rows);
+
+        if (rows <= num_threads * 4)
+            num_threads = 1;
+        py::gil_scoped_release l;
+        hnswlib::ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
+            appr_alg->updatePoint((void *) items.data(row), (size_t) ids[row]);
+        });
+    }
+
     std::vector<std::vector<data_t>> getDataReturnList(py::object ids_ = py::none()) {
         std::vector<size_t> ids;
         if (!ids_.is_none()) {
@@ -239,6 +198,14 @@ public:
 
         std::vector<std::vector<data_t>> data;
         for (auto id : ids) {
+            if (half_input) {
+                std::vector<uint16_t> halves = appr_alg->template getDataByLabel<uint16_t>(id);
+                std::vector<data_t> values(halves.size());
+                for (size_t i = 0; i < halves.size(); i++)
+                    values[i] = hnswlib::halfToFloat(halves[i]);
+                data.push_back(values);
+                continue;
+            }
             data.push_back(appr_alg->template getDataByLabel<data_t>(id));
         }
         return data;
@@ -248,15 +215,15 @@ public:
 
         std::vector<hnswlib::labeltype> ids;
 
-        for(auto kv : appr_alg->label_lookup_) {
-            ids.push_back(kv.first);
-        }
+        appr_alg->label_lookup_.forEach([&](hnswlib::labeltype label, hnswlib::tableint id) {
+            ids.push_back(label);
+        });
         return ids;
     }
 
     py::object knnQuery_return_numpy(py::object input, size_t k = 1, int num_threads = -1) {
 
-        py::array_t < dist_t, py::array::c_style | py::array::forcecast > items(input);
+        py::array items = inputArray(input);
         auto buffer = items.request();
         hnswlib::labeltype *data_numpy_l;
         dist_t *data_numpy_d;
@@ -288,44 +255,18 @@ public:
             data_numpy_l = new hnswlib::labeltype[rows * k];
             data_numpy_d = new dist_t[rows * k];
 
-            if(normalize==false) {
-                ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                                std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
-                                        (void *) items.data(row), k);
-                                if (result.size() != k)
-                                    throw std::runtime_error(
-                                            "Cannot return the results in a contigious 2D array. Probably ef or M is to small");
-                                for (int i = k - 1; i >= 0; i--) {
-                                    auto &result_tuple = result.top();
-                                    data_numpy_d[row * k + i] = result_tuple.first;
-                                    data_numpy_l[row * k + i] = result_tuple.second;
-                                    result.pop();
-                                }
-                            }
-                );
-            }
-            else{
-                std::vector<float> norm_array(num_threads*features);
-                ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                                float *data= (float *) items.data(row);
-
-                                size_t start_idx = threadId * dim;
-								normalize_vector((float *) items.data(row), (norm_array.data()+start_idx));
-
-                                std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
-                                        (void *) (norm_array.data()+start_idx), k);
-                                if (result.size() != k)
-                                    throw std::runtime_error(
-                                            "Cannot return the results in a contigious 2D array. Probably ef or M is to small");
-                                for (int i = k - 1; i >= 0; i--) {
-                                    auto &result_tuple = result.top();
-                                    data_numpy_d[row * k + i] = result_tuple.first;
-                                    data_numpy_l[row * k + i] = result_tuple.second;
-                                    result.pop();
-                                }
-                            }
-                );
-            }
+            // queries are searched in small groups whose graph walks are interleaved by searchKnnBatch
+            const size_t group_size = 4;
+            size_t num_groups = (rows + group_size - 1) / group_size;
+            hnswlib::ParallelFor(0, num_groups, num_threads, [&](size_t group, size_t threadId) {
+                            size_t start = group * group_size;
+                            size_t count = std::min(group_size, rows - start);
+                            if (appr_alg->searchKnnBatch((void *) items.data(start), count, k, data_numpy_l + start * k,
+                                                         data_numpy_d + start * k, group_size))
+                                throw std::runtime_error(
+                                        "Cannot return the results in a contigious 2D array. Probably ef or M is to small");
+                        }
+            );
 
         }
         py::capsule free_when_done_l(data_numpy_l, [](void *f) {
@@ -355,6 +296,17 @@ public:
         appr_alg->markDelete(label);
     }
 
+    void setReplaceDeleted(bool replace_deleted) {
+        appr_alg->setReplaceDeleted(replace_deleted);
+    }
+
+    void compact(int num_threads) {
+        if (num_threads <= 0)
+            num_threads = num_threads_default;
+        py::gil_scoped_release l;
+        appr_alg->compact(num_threads);
+    }
+
     void resizeIndex(size_t new_size) {
         appr_alg->resizeIndex(new_size);
     }
@@ -372,8 +324,7 @@ public:
 
 
     bool index_inited;
-    bool ep_added;
-    bool normalize;
+    bool half_input;
     int num_threads_default;
     hnswlib::labeltype cur_l;
     hnswlib::HierarchicalNSW<dist_t> *appr_alg;
@@ -395,15 +346,20 @@ PYBIND11_PLUGIN(hnswlib) {
         py::arg("ef_construction")=200, py::arg("random_seed")=100)
         .def("knn_query", &Index<float>::knnQuery_return_numpy, py::arg("data"), py::arg("k")=1, py::arg("num_threads")=-1)
         .def("add_items", &Index<float>::addItems, py::arg("data"), py::arg("ids") = py::none(), py::arg("num_threads")=-1)
+        .def("update_items", &Index<float>::updateItems, py::arg("data"), py::arg("ids"), py::arg("num_threads")=-1)
         .def("get_items", &Index<float, float>::getDataReturnList, py::arg("ids") = py::none())
         .def("get_ids_list", &Index<float>::getIdsList)
         .def("set_ef", &Index<float>::set_ef, py::arg("ef"))
         .def("get_ef_construction", &Index<float>::get_ef_construction)
         .def("get_M", &Index<float>::get_M)
         .def("set_num_threads", &Index<float>::set_num_threads, py::arg("num_threads"))
+        .def("set_compact_visited", &Index<float>::set_compact_visited, py::arg("compact"))
         .def("save_index", &Index<float>::saveIndex, py::arg("path_to_index"))
-        .def("load_index", &Index<float>::loadIndex, py::arg("path_to_index"), py::arg("max_elements")=0)
+        .def("load_index", &Index<float>::loadIndex, py::arg("path_to_index"), py::arg("max_elements")=0, py::arg("use_mmap")=false,
+        py::arg("num_threads")=-1)
         .def("mark_deleted", &Index<float>::markDeleted, py::arg("label"))
+        .def("set_replace_deleted", &Index<float>::setReplaceDeleted, py::arg("replace_deleted"))
+        .def("compact", &Index<float>::compact, py::arg("num_threads")=-1)
         .def("resize_index", &Index<float>::resizeIndex, py::arg("new_size"))
         .def("get_max_elements", &Index<float>::getMaxElements)
         .def("get_current_count", &Index<float>::getCurrentCount)
@@ -0,0 +1,55 @@
+import unittest
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testAddItems(self):
+        import hnswlib
+        import numpy as np
+
+        print("\n**** Add items test ****\n")
+
+        np.random.seed(42)
+        dim = 16
+        num_elements = 5000
+
+        data = np.float32(np.random.random((num_elements, dim)))
+        labels = np.random.permutation(num_elements) * 3 + 1000
+
+        p = hnswlib.Index(space='l2', dim=dim)
+        p.init_index(max_elements=2 * num_elements, ef_construction=100, M=16)
+        p.set_ef(100)
+
+        # The same batch on one and on four threads
+        p.add_items(data, labels, num_threads=4)
+        self.assertEqual(p.get_current_count(), num_elements)
+        self.assertEqual(sorted(p.get_ids_list()), sorted(labels))
+        result, _ = p.knn_query(data, k=1)
+        self.assertGreater(np.mean(result.reshape(-1) == labels), 0.98)
+        self.assertTrue(np.allclose(np.array(p.get_items(labels[:100])), data[:100]))
+
+        p_single = hnswlib.Index(space='l2', dim=dim)
+        p_single.init_index(max_elements=num_elements, ef_construction=100, M=16)
+        p_single.set_ef(100)
+        p_single.add_items(data, labels, num_threads=1)
+        result_single, _ = p_single.knn_query(data, k=1)
+        self.assertGreater(np.mean(result_single.reshape(-1) == labels), 0.98)
+
+        # A label twice in a batch and a label already in the index: the last vector wins
+        batch = np.float32(np.random.random((3, dim)))
+        p.add_items(batch, [1, labels[0], 1], num_threads=2)
+        self.assertEqual(p.get_current_count(), num_elements + 3)
+        self.assertEqual(len(p.get_ids_list()), num_elements + 1)
+        self.assertTrue(np.allclose(np.array(p.get_items([1, labels[0]])), batch[[2, 1]]))
+        result, _ = p.knn_query(batch[1:], k=1)
+        self.assertEqual(list(result.reshape(-1)), [labels[0], 1])
+        result, _ = p.knn_query(data[:1], k=10)
+        self.assertNotIn(labels[0], result[0])
+
+        # More elements than the index has room for
+        with self.assertRaises(RuntimeError):
+            p.add_items(data)
+        self.assertEqual(p.get_current_count(), num_elements + 3)
+
+
+if __name__ == "__main__":
+    unittest.main()
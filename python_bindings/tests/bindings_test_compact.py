@@ -0,0 +1,61 @@
+import unittest
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testCompact(self):
+        import hnswlib
+        import numpy as np
+
+        print("\n**** Compact test ****\n")
+
+        np.random.seed(42)
+        dim = 16
+        num_elements = 5000
+
+        data = np.float32(np.random.random((num_elements, dim)))
+
+        p = hnswlib.Index(space='l2', dim=dim)
+        p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+        p.set_ef(100)
+        p.set_num_threads(4)
+        p.add_items(data)
+
+        # Every tenth element survives
+        live = np.arange(0, num_elements, 10)
+        for label in range(num_elements):
+            if label % 10 != 0:
+                p.mark_deleted(label)
+        p.compact()
+
+        self.assertEqual(p.get_current_count(), len(live))
+        self.assertEqual(p.get_max_elements(), num_elements)
+        self.assertEqual(sorted(p.get_ids_list()), list(live))
+
+        labels, _ = p.knn_query(data[live], k=1)
+        self.assertGreater(np.mean(labels.reshape(-1) == live), 0.98)
+        labels, _ = p.knn_query(data, k=10)
+        self.assertTrue(np.all(labels % 10 == 0))
+        self.assertTrue(np.allclose(np.array(p.get_items(live)), data[live]))
+
+        # The freed slots take new elements without a resize
+        more = np.float32(np.random.random((num_elements - len(live), dim)))
+        more_labels = np.arange(num_elements, num_elements + len(more))
+        p.add_items(more, more_labels)
+        self.assertEqual(p.get_current_count(), num_elements)
+        labels, _ = p.knn_query(more, k=1)
+        self.assertGreater(np.mean(labels.reshape(-1) == more_labels), 0.98)
+
+        # With everything deleted the index is empty again
+        for label in p.get_ids_list():
+            p.mark_deleted(label)
+        p.compact()
+        self.assertEqual(p.get_current_count(), 0)
+        self.assertEqual(p.get_max_elements(), num_elements)
+        self.assertEqual(len(p.get_ids_list()), 0)
+        p.add_items(data)
+        labels, _ = p.knn_query(data, k=1)
+        self.assertGreater(np.mean(labels.reshape(-1) == np.arange(num_elements)), 0.98)
+
+
+if __name__ == "__main__":
+    unittest.main()
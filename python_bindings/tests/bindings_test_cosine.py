@@ -0,0 +1,44 @@
+import unittest
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testRandomSelf(self):
+        import hnswlib
+        import numpy as np
+
+        print("\n**** Cosine space test ****\n")
+
+        np.random.seed(42)
+        dim = 16
+        num_elements = 5000
+
+        # Vectors with very different norms: only their directions matter
+        data = np.float32(np.random.random((num_elements, dim)) - 0.5)
+        data *= np.float32(10 ** np.random.uniform(-3, 3, (num_elements, 1)))
+        queries = np.float32(np.random.random((100, dim)) - 0.5)
+
+        p = hnswlib.Index(space='cosine', dim=dim)
+        p.init_index(max_elements=num_elements, ef_construction=200, M=16)
+        p.set_ef(100)
+        p.add_items(data)
+
+        normalized = data / np.linalg.norm(data, axis=1)[:, None]
+        expected = np.argmax(np.dot(queries, normalized.T), axis=1)
+
+        labels, distances = p.knn_query(queries, k=1)
+        recall = np.mean(labels.reshape(-1) == expected)
+        print("Recall for cosine: %f" % recall)
+        self.assertGreater(recall, 0.95)
+
+        # The distances are 1 - cos(query, vector)
+        queries_normalized = queries / np.linalg.norm(queries, axis=1)[:, None]
+        cos = np.sum(queries_normalized * normalized[labels.reshape(-1)], axis=1)
+        self.assertTrue(np.allclose(distances.reshape(-1), 1 - cos, atol=1e-5))
+
+        # The index keeps the normalized vectors
+        items = np.array(p.get_items(list(range(10))))
+        self.assertTrue(np.allclose(items, normalized[:10], atol=1e-6))
+
+
+if __name__ == "__main__":
+    unittest.main()
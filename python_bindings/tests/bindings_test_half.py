@@ -0,0 +1,51 @@
+import unittest
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testRandomSelf(self):
+        import hnswlib
+        import numpy as np
+
+        print("\n**** Half-precision space test ****\n")
+
+        np.random.seed(42)
+        dim = 32
+        num_elements = 10000
+
+        # Generating sample data
+        data = np.float32(np.random.random((num_elements, dim)))
+
+        for space in ['l2_fp16', 'ip_fp16', 'l2_bf16', 'ip_bf16']:
+            p = hnswlib.Index(space=space, dim=dim)
+            p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+            p.set_ef(100)
+            if space.endswith('fp16'):
+                # float16 arrays are stored as they are
+                items_in = data.astype(np.float16)
+                tolerance = 1e-3
+            else:
+                items_in = data
+                tolerance = 1e-2
+            p.add_items(items_in)
+
+            if space.startswith('l2'):
+                labels, distances = p.knn_query(items_in, k=1)
+                recall = np.mean(labels.reshape(-1) == np.arange(len(data)))
+                print("Recall for %s: %f" % (space, recall))
+                self.assertGreater(recall, 0.99)
+
+            items = np.array(p.get_items(list(range(100))))
+            self.assertTrue(np.all(np.abs(items - data[:100]) <= tolerance))
+
+            index_path = 'half_index.bin'
+            p.save_index(index_path)
+            p_loaded = hnswlib.Index(space=space, dim=dim)
+            p_loaded.load_index(index_path)
+            p_loaded.set_ef(100)
+            labels, distances = p.knn_query(items_in[:100], k=5)
+            labels_loaded, distances_loaded = p_loaded.knn_query(items_in[:100], k=5)
+            self.assertTrue(np.array_equal(labels, labels_loaded))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,114 @@
+import struct
+import unittest
+
+
+def write_legacy_index(path, data, M):
+    """Writes data as an index in the format of the original hnswlib, a single layer with the exact
+    nearest neighbors of every element as its links."""
+    import numpy as np
+
+    num_elements, dim = data.shape
+    maxM0 = 2 * M
+    size_links_level0 = 4 * (maxM0 + 1)
+    label_offset = size_links_level0 + 4 * dim
+    size_data_per_element = label_offset + 8
+
+    squared = np.sum(data.astype(np.float64) ** 2, axis=1)
+    distances = squared[:, None] + squared[None, :] - 2 * np.dot(data.astype(np.float64), data.T.astype(np.float64))
+    np.fill_diagonal(distances, np.inf)
+    links = np.zeros((num_elements, maxM0 + 1), dtype=np.uint32)
+    links[:, 0] = maxM0
+    links[:, 1:] = np.argsort(distances, axis=1)[:, :maxM0]
+
+    level0 = np.zeros((num_elements, size_data_per_element), dtype=np.uint8)
+    level0[:, :size_links_level0] = links.view(np.uint8)
+    level0[:, size_links_level0:label_offset] = np.ascontiguousarray(data, dtype=np.float32).view(np.uint8)
+    level0[:, label_offset:] = np.arange(num_elements, dtype=np.uint64).reshape(-1, 1).view(np.uint8)
+
+    with open(path, 'wb') as f:
+        # offsetLevel0, max_elements, cur_element_count, size_data_per_element, label_offset, offsetData,
+        # maxlevel, enterpoint_node, maxM, maxM0, M, mult, ef_construction
+        f.write(struct.pack('<QQQQQQiIQQQdQ', 0, num_elements, num_elements, size_data_per_element, label_offset,
+                            size_links_level0, 0, 0, M, maxM0, M, 1 / np.log(M), 100))
+        f.write(level0.tobytes())
+        # no element has upper layers
+        f.write(np.zeros(num_elements, dtype=np.uint32).tobytes())
+
+
+class LoadThreadsTestCase(unittest.TestCase):
+    def testLoadThreads(self):
+        import hnswlib
+        import numpy as np
+
+        print("\n**** Multithreaded index load test ****\n")
+
+        np.random.seed(7)
+        dim = 16
+        num_elements = 10000
+
+        data = np.float32(np.random.random((num_elements, dim)))
+
+        p = hnswlib.Index(space='l2', dim=dim)
+        p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+        p.set_ef(50)
+        p.add_items(data)
+        for label in range(0, num_elements, 10):
+            p.mark_deleted(label)
+        labels, distances = p.knn_query(data, k=5)
+
+        index_path = 'threads_index.bin'
+        p.save_index(index_path)
+
+        # Every thread count has to load the same index
+        for num_threads in [1, 2, 4, 7]:
+            loaded = hnswlib.Index(space='l2', dim=dim)
+            loaded.load_index(index_path, max_elements=num_elements + 100, num_threads=num_threads)
+            loaded.set_ef(50)
+            self.assertEqual(loaded.get_current_count(), num_elements)
+            self.assertEqual(loaded.get_max_elements(), num_elements + 100)
+
+            labels_loaded, distances_loaded = loaded.knn_query(data, k=5, num_threads=1)
+            self.assertTrue(np.array_equal(labels, labels_loaded))
+            self.assertTrue(np.allclose(distances, distances_loaded))
+            self.assertEqual(np.sum(labels_loaded % 10 == 0), 0)
+
+            items = loaded.get_items(list(range(1, num_elements, 10)))
+            self.assertAlmostEqual(np.max(np.abs(data[1::10] - items)), 0, delta=1e-6)
+
+            # the loaded index keeps growing
+            loaded.add_items(data[:100] + 1, np.arange(num_elements, num_elements + 100))
+            self.assertEqual(loaded.get_current_count(), num_elements + 100)
+
+    def testLoadThreadsLegacy(self):
+        import hnswlib
+        import numpy as np
+
+        print("\n**** Multithreaded legacy index load test ****\n")
+
+        np.random.seed(8)
+        dim = 16
+        num_elements = 2000
+
+        data = np.float32(np.random.random((num_elements, dim)))
+        index_path = 'legacy_index.bin'
+        write_legacy_index(index_path, data, 16)
+
+        results = []
+        for num_threads in [1, 4]:
+            p = hnswlib.Index(space='l2', dim=dim)
+            p.load_index(index_path, num_threads=num_threads)
+            p.set_ef(50)
+            self.assertEqual(p.get_current_count(), num_elements)
+            self.assertEqual(sorted(p.get_ids_list()), list(range(num_elements)))
+
+            labels, distances = p.knn_query(data, k=1)
+            self.assertAlmostEqual(np.mean(labels.reshape(-1) == np.arange(num_elements)), 1.0, 3)
+            items = p.get_items(list(range(num_elements)))
+            self.assertAlmostEqual(np.max(np.abs(data - items)), 0, delta=1e-6)
+            results.append(labels)
+
+        self.assertTrue(np.array_equal(results[0], results[1]))
+
+
+if __name__ == "__main__":
+    unittest.main()
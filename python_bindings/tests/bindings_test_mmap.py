@@ -0,0 +1,59 @@
+import unittest
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testRandomSelf(self):
+        import hnswlib
+        import numpy as np
+
+        print("\n**** Memory-mapped index load test ****\n")
+
+        np.random.seed(42)
+        dim = 16
+        num_elements = 10000
+
+        # Generating sample data
+        data = np.float32(np.random.random((num_elements, dim)))
+
+        p = hnswlib.Index(space='l2', dim=dim)
+        p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+        p.set_ef(100)
+        p.add_items(data)
+        p.mark_deleted(0)
+
+        labels, distances = p.knn_query(data, k=1)
+
+        index_path = 'mmap_index.bin'
+        print("Saving index to '%s'" % index_path)
+        p.save_index(index_path)
+
+        print("\nLoading index from '%s' with use_mmap=True\n" % index_path)
+        p_mmap = hnswlib.Index(space='l2', dim=dim)
+        p_mmap.load_index(index_path, use_mmap=True)
+        p_mmap.set_ef(100)
+
+        self.assertEqual(p_mmap.get_current_count(), num_elements)
+        self.assertEqual(p_mmap.get_max_elements(), num_elements)
+
+        # The mapped index has to return exactly the same results as the original one
+        labels_mmap, distances_mmap = p_mmap.knn_query(data, k=1)
+        self.assertTrue(np.array_equal(labels, labels_mmap))
+        self.assertTrue(np.allclose(distances, distances_mmap))
+        self.assertNotIn(0, labels_mmap.reshape(-1))
+
+        items = p_mmap.get_items(list(range(1, num_elements)))
+        self.assertAlmostEqual(np.max(np.abs(data[1:] - items)), 0, delta=1e-6)
+
+        # The mapping is read-only
+        with self.assertRaises(RuntimeError):
+            p_mmap.add_items(data[:1], num_elements + 1)
+        with self.assertRaises(RuntimeError):
+            p_mmap.mark_deleted(1)
+        with self.assertRaises(RuntimeError):
+            p_mmap.resize_index(2 * num_elements)
+
+        del p_mmap
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,66 @@
+import unittest
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testReplaceDeleted(self):
+        import hnswlib
+        import numpy as np
+
+        print("\n**** Replace deleted test ****\n")
+
+        np.random.seed(42)
+        dim = 16
+        num_elements = 4000
+
+        data = np.float32(np.random.random((num_elements, dim)))
+        replacements = np.float32(np.random.random((num_elements // 2, dim)))
+        new_labels = np.arange(num_elements, num_elements + len(replacements))
+
+        p = hnswlib.Index(space='l2', dim=dim)
+        p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+        p.set_ef(100)
+        p.set_num_threads(4)
+        p.add_items(data)
+
+        # Half of the elements are deleted, their slots go to the new labels
+        for label in range(num_elements // 2):
+            p.mark_deleted(label)
+        p.set_replace_deleted(True)
+        p.add_items(replacements, new_labels)
+
+        # The index did not grow and is full now
+        self.assertEqual(p.get_current_count(), num_elements)
+        self.assertEqual(p.get_max_elements(), num_elements)
+        with self.assertRaises(RuntimeError):
+            p.add_items(replacements[:1], [3 * num_elements])
+
+        # The labels of the replaced elements are gone
+        expected_ids = set(range(num_elements // 2, num_elements)) | set(new_labels)
+        self.assertEqual(set(p.get_ids_list()), expected_ids)
+
+        labels, _ = p.knn_query(replacements, k=1)
+        self.assertGreater(np.mean(labels.reshape(-1) == new_labels), 0.98)
+        labels, _ = p.knn_query(data[num_elements // 2:], k=1)
+        self.assertGreater(np.mean(labels.reshape(-1) == np.arange(num_elements // 2, num_elements)), 0.98)
+
+        # Deleted labels are never returned
+        labels, _ = p.knn_query(data[:num_elements // 2], k=10)
+        self.assertFalse(np.any(labels < num_elements // 2))
+
+        items = np.array(p.get_items(new_labels))
+        self.assertTrue(np.allclose(items, replacements))
+
+        # Without replace_deleted a new element needs room
+        p.mark_deleted(num_elements)
+        p.set_replace_deleted(False)
+        with self.assertRaises(RuntimeError):
+            p.add_items(data[:1], [3 * num_elements])
+        p.resize_index(num_elements + 1)
+        p.add_items(data[:1], [3 * num_elements])
+        self.assertEqual(p.get_current_count(), num_elements + 1)
+        labels, _ = p.knn_query(data[:1], k=1)
+        self.assertEqual(labels[0][0], 3 * num_elements)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,47 @@
+import unittest
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testRandomSelf(self):
+        import hnswlib
+        import numpy as np
+
+        print("\n**** Int8 quantized space test ****\n")
+
+        np.random.seed(42)
+        dim = 32
+        num_elements = 10000
+
+        # Generating sample data
+        data = np.float32(np.random.random((num_elements, dim)))
+
+        for space in ['l2_sq8', 'ip_sq8']:
+            p = hnswlib.Index(space=space, dim=dim)
+            p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+            p.set_ef(100)
+            p.add_items(data)
+
+            if space == 'l2_sq8':
+                # Query dataset, k - number of closest elements (returns 2 numpy arrays)
+                labels, distances = p.knn_query(data, k=1)
+                recall = np.mean(labels.reshape(-1) == np.arange(len(data)))
+                print("Recall for %s: %f" % (space, recall))
+                self.assertGreater(recall, 0.95)
+
+            # The stored vectors are within half a quantization step of the originals
+            items = np.array(p.get_items(list(range(100))))
+            step = (data[:100].max(axis=1) - data[:100].min(axis=1)) / 255
+            self.assertTrue(np.all(np.abs(items - data[:100]) <= step[:, None] / 2 + 1e-6))
+
+            index_path = 'sq8_index.bin'
+            p.save_index(index_path)
+            p_loaded = hnswlib.Index(space=space, dim=dim)
+            p_loaded.load_index(index_path)
+            p_loaded.set_ef(100)
+            labels, distances = p.knn_query(data[:100], k=5)
+            labels_loaded, distances_loaded = p_loaded.knn_query(data[:100], k=5)
+            self.assertTrue(np.array_equal(labels, labels_loaded))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,56 @@
+import unittest
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testUpdateItems(self):
+        import hnswlib
+        import numpy as np
+
+        print("\n**** Update items test ****\n")
+
+        np.random.seed(42)
+        dim = 16
+        num_elements = 4000
+
+        data = np.float32(np.random.random((num_elements, dim)))
+
+        p = hnswlib.Index(space='l2', dim=dim)
+        p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+        p.set_ef(100)
+        p.set_num_threads(4)
+        p.add_items(data)
+
+        # A quarter of the elements move: half of them a little, half to new random vectors
+        changed = np.arange(0, num_elements, 4)
+        updated = data.copy()
+        small = changed[changed % 8 == 0]
+        far = changed[changed % 8 == 4]
+        updated[small] += np.float32((np.random.random((len(small), dim)) - 0.5) * 0.05)
+        updated[far] = np.float32(np.random.random((len(far), dim)))
+        p.update_items(updated[changed], changed)
+
+        # The index did not grow and returns the new vectors
+        self.assertEqual(p.get_current_count(), num_elements)
+        self.assertEqual(sorted(p.get_ids_list()), list(range(num_elements)))
+        self.assertTrue(np.allclose(np.array(p.get_items(changed)), updated[changed]))
+
+        labels, _ = p.knn_query(updated, k=1)
+        self.assertGreater(np.mean(labels.reshape(-1) == np.arange(num_elements)), 0.98)
+
+        # Recall@10 of random queries against brute force on the updated vectors
+        queries = np.float32(np.random.random((200, dim)))
+        labels, _ = p.knn_query(queries, k=10)
+        distances = ((queries[:, None, :] - updated[None, :, :]) ** 2).sum(-1)
+        truth = np.argsort(distances, axis=1)[:, :10]
+        recall = np.mean([len(set(labels[i]) & set(truth[i])) / 10.0 for i in range(len(queries))])
+        self.assertGreater(recall, 0.95)
+
+        with self.assertRaises(RuntimeError):
+            p.update_items(updated[:1], [num_elements + 1])
+        p.mark_deleted(1)
+        with self.assertRaises(RuntimeError):
+            p.update_items(updated[:1], [1])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,43 @@
+import unittest
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testRandomSelf(self):
+        import hnswlib
+        import numpy as np
+
+        print("\n**** Compact visited set test ****\n")
+
+        np.random.seed(42)
+        dim = 16
+        num_elements = 10000
+
+        # Generating sample data
+        data = np.float32(np.random.random((num_elements, dim)))
+
+        p = hnswlib.Index(space='l2', dim=dim)
+        p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+        p.set_num_threads(1)
+        p.add_items(data)
+        p.set_ef(100)
+
+        p_compact = hnswlib.Index(space='l2', dim=dim)
+        p_compact.init_index(max_elements=num_elements, ef_construction=100, M=16)
+        p_compact.set_compact_visited(True)
+        p_compact.set_num_threads(1)
+        p_compact.add_items(data)
+        p_compact.set_ef(100)
+
+        # Both backends visit the same elements, so the results have to be identical
+        labels, distances = p.knn_query(data, k=5)
+        labels_compact, distances_compact = p_compact.knn_query(data, k=5)
+        self.assertTrue(np.array_equal(labels, labels_compact))
+        self.assertTrue(np.allclose(distances, distances_compact))
+
+        p_compact.set_compact_visited(False)
+        labels_list, _ = p_compact.knn_query(data, k=5)
+        self.assertTrue(np.array_equal(labels, labels_list))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -119,6 +119,52 @@ void test_vs_recall(float *massQ, size_t vecsize, size_t qsize, HierarchicalNSW<
         }
     }
 }
+// latency of the same graph with the large arrays on malloc and on huge pages, the index is copied through a file
+void test_huge_pages(float *massQ, size_t vecsize, size_t qsize, HierarchicalNSW<float> &appr_alg, size_t vecdim,
+                     vector<std::priority_queue<std::pair<float, labeltype >>> &answers, size_t k) {
+    appr_alg.saveIndex("hnswlib_sift_pages");
+    HierarchicalNSW<float> huge_alg(appr_alg.space_, "hnswlib_sift_pages", false, 0, false, 1, true);
+    cout << "Level 0 memory: " << pageBackingName(appr_alg.getPageBacking()) << " vs "
+         << pageBackingName(huge_alg.getPageBacking()) << "\n";
+    cout << "ef\trecall\tmalloc\thuge pages\n";
+    vector<size_t> efs = {10, 20, 50, 100, 200, 400};
+    for (size_t ef : efs) {
+        appr_alg.setEf(ef);
+        huge_alg.setEf(ef);
+        StopW stopw = StopW();
+        float recall = test_approx(massQ, vecsize, qsize, appr_alg, vecdim, answers, k);
+        float time_us_malloc = stopw.getElapsedTimeMicro() / qsize;
+        stopw.reset();
+        test_approx(massQ, vecsize, qsize, huge_alg, vecdim, answers, k);
+        float time_us_huge = stopw.getElapsedTimeMicro() / qsize;
+        cout << ef << "\t" << recall << "\t" << time_us_malloc << " us\t" << time_us_huge << " us\n";
+    }
+}
+
+// queries per second before and after renumbering the graph for locality, reorders appr_alg
+void test_reorder(float *massQ, size_t vecsize, size_t qsize, HierarchicalNSW<float> &appr_alg, size_t vecdim,
+                  vector<std::priority_queue<std::pair<float, labeltype >>> &answers, size_t k) {
+    vector<size_t> efs = {10, 20, 50, 100, 200, 400};
+    vector<float> qps_before;
+    for (size_t ef : efs) {
+        appr_alg.setEf(ef);
+        StopW stopw = StopW();
+        test_approx(massQ, vecsize, qsize, appr_alg, vecdim, answers, k);
+        qps_before.push_back(qsize / (stopw.getElapsedTimeMicro() * 1e-6));
+    }
+    StopW stopr = StopW();
+    appr_alg.reorder(REORDER_BFS);
+    cout << "Reordered, time=" << stopr.getElapsedTimeMicro() * 1e-6 << "\n";
+    cout << "ef\trecall\tQPS before\tQPS after\n";
+    for (size_t i = 0; i < efs.size(); i++) {
+        appr_alg.setEf(efs[i]);
+        StopW stopw = StopW();
+        float recall = test_approx(massQ, vecsize, qsize, appr_alg, vecdim, answers, k);
+        float qps = qsize / (stopw.getElapsedTimeMicro() * 1e-6);
+        cout << efs[i] << "\t" << recall << "\t" << qps_before[i] << "\t" << qps << "\n";
+    }
+}
+
 //void get_knn_quality(unsigned int *massA,size_t vecsize, size_t maxn, HierarchicalNSW<float> &appr_alg) {
 //    size_t total = 0;
 //    size_t correct = 0;    
@@ -206,13 +252,7 @@ void sift_test() {
 
     cout << "Building index\n";
     StopW stopwb = StopW();
-    for (int i = 0; i < 1; i++) {
-        appr_alg.addPoint((void *) (mass + vecdim * i), (size_t) i);
-    }
-#pragma omp parallel for
-    for (int i = 1; i < vecsize; i++) {
-        appr_alg.addPoint((void *) (mass + vecdim * i), (size_t) i);
-    }
+    appr_alg.buildFrom(mass, nullptr, vecsize);
     /*GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
     virtualMemUsedByMe = pmc.WorkingSetSize;
     cout << virtualMemUsedByMe / 1000 / 1000 << "\n";*/
@@ -234,6 +274,8 @@ void sift_test() {
     cout << "Loaded gt\n";
     for (int i = 0; i < 1; i++)
         test_vs_recall(massQ, vecsize, qsize, appr_alg, vecdim, answers, k);
+    test_huge_pages(massQ, vecsize, qsize, appr_alg, vecdim, answers, k);
+    test_reorder(massQ, vecsize, qsize, appr_alg, vecdim, answers, k);
     //cout << "opt:\n";
     //appr_alg.opt = true;
 
@@ -0,0 +1,121 @@
+#include <iostream>
+#include <random>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "hnswlib/hnswlib.h"
+
+using namespace std;
+using namespace hnswlib;
+
+/*
+ * Runs inserts, searches and deletions on one HierarchicalNSW at the same time and checks the answers.
+ * Meant to be built with ThreadSanitizer (cmake -DENABLE_TSAN=ON), which then reports any unsynchronized
+ * access between the lock-free searches and the writers. Exits with 1 on a wrong result.
+ * Usage: stress_concurrent [elements] [insert threads] [search threads]
+ */
+
+// Lock order checking is off: addPoint holds the lock of the new element while it locks the lists of
+// others, the order differs between elements but nobody can wait on an element that is not linked yet.
+extern "C" const char *__tsan_default_options() {
+    return "detect_deadlocks=0";
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? atoi(argv[1]) : 20000;
+    size_t insert_threads = argc > 2 ? atoi(argv[2]) : 2;
+    size_t search_threads = argc > 3 ? atoi(argv[3]) : 2;
+    const size_t dim = 16;
+    const size_t k = 10;
+
+    mt19937 rng(42);
+    uniform_real_distribution<float> distrib;
+    vector<float> data(n * dim);
+    for (float &x : data)
+        x = distrib(rng);
+
+    L2Space space(dim);
+    HierarchicalNSW<float> index(&space, n, 16, 100);
+
+    atomic<size_t> next_insert(0);
+    atomic<size_t> inserted(0);
+    atomic<bool> inserting(true);
+    atomic<size_t> searches(0);
+    atomic<size_t> failures(0);
+
+    vector<thread> threads;
+    for (size_t t = 0; t < insert_threads; t++) {
+        threads.emplace_back([&]() {
+            size_t i;
+            while ((i = next_insert++) < n) {
+                index.addPoint(data.data() + i * dim, i);
+                inserted++;
+            }
+        });
+    }
+    for (size_t t = 0; t < search_threads; t++) {
+        threads.emplace_back([&, t]() {
+            mt19937 query_rng(t);
+            HierarchicalNSW<float>::SearchContext context;
+            vector<float> query(dim);
+            while (inserting) {
+                for (float &x : query)
+                    x = distrib(query_rng);
+                // both search paths, the priority queue one and the context one
+                priority_queue<pair<float, labeltype>> result = index.searchKnn(query.data(), k);
+                const vector<pair<float, labeltype>> &result_context = index.searchKnn(query.data(), k, context);
+                float last = numeric_limits<float>::max();
+                while (!result.empty()) {
+                    if (result.top().second >= n || result.top().first > last)
+                        failures++;
+                    last = result.top().first;
+                    result.pop();
+                }
+                for (size_t i = 1; i < result_context.size(); i++) {
+                    if (result_context[i].second >= n || result_context[i].first < result_context[i - 1].first)
+                        failures++;
+                }
+                searches++;
+            }
+        });
+    }
+    // deletions of elements inserted a while ago, searches must never return them afterwards
+    threads.emplace_back([&]() {
+        for (size_t label = 0; label < n; label += 97) {
+            while (inserted < label + 1000 && inserted < n)
+                this_thread::yield();
+            try {
+                index.markDelete(label);
+            } catch (const runtime_error &) {
+                // not inserted yet
+            }
+        }
+    });
+
+    for (size_t t = 0; t < insert_threads; t++)
+        threads[t].join();
+    inserting = false;
+    for (size_t t = insert_threads; t < threads.size(); t++)
+        threads[t].join();
+
+    // the finished index has to find the inserted vectors
+    index.setEf(50);
+    size_t found = 0, deleted_returned = 0;
+    for (size_t i = 0; i < n; i++) {
+        priority_queue<pair<float, labeltype>> result = index.searchKnn(data.data() + i * dim, 1);
+        if (i % 97 == 0)
+            continue;
+        if (!result.empty() && result.top().second == i)
+            found++;
+        if (!result.empty() && result.top().second % 97 == 0)
+            deleted_returned++;
+    }
+    size_t expected = n - (n + 96) / 97;
+    double recall = (double) found / expected;
+    cout << "searches during inserts: " << searches << ", wrong results: " << failures
+         << ", recall after: " << recall << ", deleted returned: " << deleted_returned << "\n";
+    if (failures > 0 || recall < 0.95 || deleted_returned > 0)
+        return 1;
+    return 0;
+}
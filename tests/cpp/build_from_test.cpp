@@ -0,0 +1,98 @@
+#include "test_utils.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+using namespace hnswlib;
+
+/*
+ * buildFrom: labels given or consecutive, duplicates in the batch and labels already in the index, and a
+ * reader running next to the build that must never find a label before its vector is stored.
+ */
+
+static const size_t dim = 16;
+
+int main() {
+    size_t n = 5000;
+    std::vector<float> data = randomVectors(n, dim, 1);
+
+    // shuffled labels that are not slot numbers
+    std::vector<labeltype> labels(n);
+    for (size_t i = 0; i < n; i++)
+        labels[i] = 1000 + 3 * i;
+    std::shuffle(labels.begin(), labels.end(), std::mt19937(7));
+
+    L2Space space(dim);
+    HierarchicalNSW<float> index(&space, 2 * n, 16, 100);
+    std::atomic<bool> building(true);
+    std::atomic<size_t> seen(0), wrong(0);
+    std::thread reader([&]() {
+        while (building) {
+            for (size_t i = 0; i < n; i += 7) {
+                tableint id;
+                if (!index.label_lookup_.find(labels[i], id))
+                    continue;
+                seen++;
+                std::vector<float> stored = index.getDataByLabel<float>(labels[i]);
+                if (!std::equal(stored.begin(), stored.end(), data.data() + i * dim))
+                    wrong++;
+            }
+        }
+    });
+    index.buildFrom(data.data(), labels.data(), n, 4);
+    building = false;
+    reader.join();
+    std::printf("labels looked up during the build: %zu, with a wrong vector: %zu\n", (size_t) seen, (size_t) wrong);
+    CHECK(wrong == 0);
+
+    CHECK(index.cur_element_count == n);
+    CHECK(index.label_lookup_.size() == n);
+    index.setEf(100);
+    double recall = selfRecall(index, data.data(), labels, dim);
+    std::printf("self recall %.4f\n", recall);
+    CHECK(recall > 0.98);
+    for (size_t i = 0; i < n; i += 13) {
+        std::vector<float> stored = index.getDataByLabel<float>(labels[i]);
+        CHECK(std::equal(stored.begin(), stored.end(), data.data() + i * dim));
+    }
+
+    // a batch with a label twice and a label already in the index: the last vector of a label wins, the
+    // others are marked deleted
+    std::vector<float> batch = randomVectors(3, dim, 2);
+    labeltype batch_labels[3] = {1, labels[0], 1};
+    index.buildFrom(batch.data(), batch_labels, 3, 2);
+    CHECK(index.cur_element_count == n + 3);
+    CHECK(index.label_lookup_.size() == n + 1);
+    std::vector<float> stored = index.getDataByLabel<float>(1);
+    CHECK(std::equal(stored.begin(), stored.end(), batch.data() + 2 * dim));
+    stored = index.getDataByLabel<float>(labels[0]);
+    CHECK(std::equal(stored.begin(), stored.end(), batch.data() + dim));
+    size_t deleted = 0;
+    for (tableint i = 0; i < index.cur_element_count; i++)
+        deleted += index.isMarkedDeleted(i);
+    CHECK(deleted == 2);
+    CHECK(index.searchKnn(batch.data() + dim, 1).top().second == labels[0]);
+    CHECK(index.searchKnn(data.data(), 1).top().second != labels[0]);
+    CHECK(index.searchKnn(batch.data(), 1).top().second != 1);
+
+    // without labels the new elements are labeled with their slots
+    std::vector<float> more = randomVectors(100, dim, 3);
+    index.buildFrom(more.data(), nullptr, 100, 2);
+    std::vector<labeltype> more_labels;
+    for (size_t i = 0; i < 100; i++)
+        more_labels.push_back(n + 3 + i);
+    CHECK(selfRecall(index, more.data(), more_labels, dim) > 0.98);
+
+    // more elements than there is room for
+    bool threw = false;
+    try {
+        index.buildFrom(data.data(), nullptr, n, 2);
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(index.cur_element_count == n + 103);
+
+    std::printf("buildFrom test passed\n");
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include "test_utils.h"
+
+using namespace hnswlib;
+
+/*
+ * repairDeletedLinks and compact after most of the index is deleted: the live elements are still found, no
+ * deleted one is returned, compact keeps the capacity and frees the slots, and an index with everything
+ * deleted compacts to an empty one.
+ */
+
+static const size_t dim = 16;
+
+static size_t level0ListSize(HierarchicalNSW<float> &index, tableint id) {
+    return index.getListCount(index.get_linklist0(id));
+}
+
+static bool returnsDeleted(const HierarchicalNSW<float> &index, const std::vector<float> &queries, size_t nq,
+                           labeltype first_live, size_t live_step) {
+    for (size_t i = 0; i < nq; i++) {
+        std::priority_queue<std::pair<float, labeltype>> result = index.searchKnn(queries.data() + i * dim, 10);
+        while (!result.empty()) {
+            if ((result.top().second - first_live) % live_step != 0)
+                return true;
+            result.pop();
+        }
+    }
+    return false;
+}
+
+int main() {
+    size_t n = 5000, nq = 200;
+    std::vector<float> data = randomVectors(n, dim, 1);
+    std::vector<float> queries = randomVectors(nq, dim, 2);
+    // every tenth element survives
+    size_t live_step = 10;
+    std::vector<labeltype> live;
+    std::vector<float> live_data;
+    for (size_t i = 0; i < n; i += live_step) {
+        live.push_back(i);
+        live_data.insert(live_data.end(), data.begin() + i * dim, data.begin() + (i + 1) * dim);
+    }
+
+    L2Space space(dim);
+    HierarchicalNSW<float> repaired(&space, n, 16, 100);
+    HierarchicalNSW<float> compacted(&space, n, 16, 100);
+    repaired.buildFrom(data.data(), nullptr, n, 2);
+    compacted.buildFrom(data.data(), nullptr, n, 2);
+    for (size_t i = 0; i < n; i++) {
+        if (i % live_step != 0) {
+            repaired.markDelete(i);
+            compacted.markDelete(i);
+        }
+    }
+    repaired.setEf(100);
+    compacted.setEf(100);
+
+    size_t last_progress = 0;
+    repaired.repairDeletedLinks(2, [&](size_t done, size_t total) {
+        CHECK(total == n && done > last_progress && done <= total);
+        last_progress = done;
+    });
+    CHECK(last_progress == n);
+    for (labeltype label : live) {
+        tableint id;
+        CHECK(repaired.label_lookup_.find(label, id));
+        CHECK(level0ListSize(repaired, id) > 0);
+        linklistsizeint *ll = repaired.get_linklist0(id);
+        for (size_t j = 0; j < repaired.getListCount(ll); j++)
+            CHECK(!repaired.isMarkedDeleted(((tableint *) (ll + 1))[j]));
+    }
+    double repaired_recall = selfRecall(repaired, live_data.data(), live, dim);
+    CHECK(repaired_recall > 0.98);
+    CHECK(!returnsDeleted(repaired, queries, nq, 0, live_step));
+
+    compacted.compact(2);
+    CHECK(compacted.cur_element_count == live.size());
+    CHECK(compacted.max_elements_ == n);
+    CHECK(compacted.label_lookup_.size() == live.size());
+    double compacted_recall = selfRecall(compacted, live_data.data(), live, dim);
+    std::printf("self recall after repair %.4f, after compact %.4f\n", repaired_recall, compacted_recall);
+    CHECK(compacted_recall > 0.98);
+    CHECK(!returnsDeleted(compacted, queries, nq, 0, live_step));
+    for (size_t i = 0; i < live.size(); i++) {
+        std::vector<float> stored = compacted.getDataByLabel<float>(live[i]);
+        CHECK(std::equal(stored.begin(), stored.end(), live_data.data() + i * dim));
+    }
+    bool threw = false;
+    try {
+        compacted.getDataByLabel<float>(1);
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    // the freed slots take new elements without a resize
+    std::vector<float> more = randomVectors(n - live.size(), dim, 3);
+    std::vector<labeltype> more_labels;
+    for (size_t i = 0; i < n - live.size(); i++) {
+        compacted.addPoint(more.data() + i * dim, n + i);
+        more_labels.push_back(n + i);
+    }
+    CHECK(compacted.cur_element_count == n);
+    CHECK(selfRecall(compacted, more.data(), more_labels, dim) > 0.98);
+    CHECK(selfRecall(compacted, live_data.data(), live, dim) > 0.98);
+
+    // a survivor whose deleted neighbors lead to no live element still gets links: its only neighbor is deleted
+    // and only links back to it
+    std::vector<float> small = randomVectors(1000, dim, 4);
+    HierarchicalNSW<float> isolated(&space, 1000, 8, 50);
+    for (size_t i = 0; i < 1000; i++)
+        isolated.addPoint(small.data() + i * dim, i);
+    tableint survivor, neighbor;
+    CHECK(isolated.label_lookup_.find(5, survivor) && isolated.label_lookup_.find(6, neighbor));
+    ((tableint *) (isolated.get_linklist0(survivor) + 1))[0] = neighbor;
+    isolated.setListCount(isolated.get_linklist0(survivor), 1);
+    ((tableint *) (isolated.get_linklist0(neighbor) + 1))[0] = survivor;
+    isolated.setListCount(isolated.get_linklist0(neighbor), 1);
+    isolated.markDelete(6);
+    isolated.repairDeletedLinks(1);
+    CHECK(level0ListSize(isolated, survivor) > 0);
+    linklistsizeint *ll = isolated.get_linklist0(survivor);
+    for (size_t j = 0; j < isolated.getListCount(ll); j++)
+        CHECK(!isolated.isMarkedDeleted(((tableint *) (ll + 1))[j]));
+    isolated.compact(1);
+    CHECK(isolated.cur_element_count == 999);
+    CHECK(isolated.label_lookup_.find(5, survivor));
+    CHECK(level0ListSize(isolated, survivor) > 0);
+
+    // with everything deleted compact leaves an empty index of the same capacity
+    for (size_t i = 0; i < 1000; i++) {
+        if (i != 6)
+            isolated.markDelete(i);
+    }
+    isolated.compact(1);
+    CHECK(isolated.cur_element_count == 0);
+    CHECK(isolated.max_elements_ == 1000);
+    CHECK(!isolated.hasEntryPoint());
+    CHECK(isolated.searchKnn(small.data(), 1).empty());
+    std::vector<labeltype> all_labels;
+    for (size_t i = 0; i < 1000; i++) {
+        isolated.addPoint(small.data() + i * dim, i);
+        all_labels.push_back(i);
+    }
+    isolated.setEf(50);
+    CHECK(selfRecall(isolated, small.data(), all_labels, dim) > 0.98);
+
+    std::printf("compact test passed\n");
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include "test_utils.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+using namespace hnswlib;
+
+/*
+ * LabelMap: probe sequences of colliding keys, also across the end of a shard, the backward shift of erase,
+ * a random mix of operations against std::unordered_map, and inserts, erases and exchanges from several threads.
+ * Last the label map of an index: addPoint must not publish a label before the vector of its element is stored.
+ */
+
+typedef LabelMap<labeltype, tableint> Map;
+
+// the hash of LabelMap, to find keys that collide: the top 6 bits pick the shard, the low bits the slot
+static uint64_t labelHash(labeltype key) {
+    uint64_t h = (uint64_t) key;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+// the first count keys that land in shard 0 at the given slot of a 16-slot table
+static std::vector<labeltype> collidingKeys(size_t count, size_t slot) {
+    std::vector<labeltype> keys;
+    for (labeltype key = 0; keys.size() < count; key++) {
+        uint64_t h = labelHash(key);
+        if ((h >> 58) == 0 && (h & 15) == slot)
+            keys.push_back(key);
+    }
+    return keys;
+}
+
+static bool contains(const Map &map, labeltype key, tableint expected) {
+    tableint value;
+    return map.find(key, value) && value == expected;
+}
+
+int main() {
+    {
+        Map map;
+        tableint value, previous;
+        CHECK(!map.find(1, value));
+        CHECK(!map.erase(1, 0));
+        map.insert(1, 10);
+        CHECK(contains(map, 1, 10));
+        CHECK(map.exchange(1, 11, previous) && previous == 10);
+        CHECK(!map.exchange(2, 20, previous));
+        CHECK(map.size() == 2);
+        // erase only removes the key while it maps to the given value
+        CHECK(!map.erase(1, 10));
+        CHECK(map.erase(1, 11));
+        CHECK(!map.find(1, value));
+        CHECK(map.size() == 1);
+        map.clear();
+        CHECK(map.size() == 0 && !map.find(2, value));
+    }
+
+    {
+        // six keys with the last slot as home: the probe sequence wraps to the start of the shard
+        std::vector<labeltype> keys = collidingKeys(6, 15);
+        Map map;
+        for (size_t i = 0; i < keys.size(); i++)
+            map.insert(keys[i], i);
+        for (size_t i = 0; i < keys.size(); i++)
+            CHECK(contains(map, keys[i], i));
+        // erasing from the middle of the sequence moves the later keys back
+        CHECK(map.erase(keys[2], 2));
+        CHECK(map.erase(keys[0], 0));
+        for (size_t i = 0; i < keys.size(); i++) {
+            tableint value;
+            CHECK(i == 0 || i == 2 ? !map.find(keys[i], value) : contains(map, keys[i], i));
+        }
+        CHECK(map.size() == 4);
+        map.insert(keys[2], 12);
+        CHECK(contains(map, keys[2], 12));
+        for (size_t i : {1, 2, 3, 4, 5})
+            CHECK(map.erase(keys[i], i == 2 ? 12 : i));
+        CHECK(map.size() == 0);
+
+        // keys of a neighboring home slot share the run: they must stay reachable when the first ones go
+        std::vector<labeltype> neighbors = collidingKeys(3, 0);
+        for (size_t i = 0; i < 3; i++)
+            map.insert(keys[i], i);
+        for (size_t i = 0; i < 3; i++)
+            map.insert(neighbors[i], 100 + i);
+        CHECK(map.erase(keys[0], 0));
+        CHECK(map.erase(keys[1], 1));
+        for (size_t i = 0; i < 3; i++)
+            CHECK(contains(map, neighbors[i], 100 + i));
+        CHECK(contains(map, keys[2], 2));
+        CHECK(map.size() == 4);
+    }
+
+    {
+        // a random mix against std::unordered_map, the small key range makes erases and updates common
+        Map map;
+        std::unordered_map<labeltype, tableint> reference;
+        std::mt19937 rng(5);
+        for (size_t op = 0; op < 200000; op++) {
+            labeltype key = rng() % 5000;
+            tableint value = rng() % 1000;
+            std::unordered_map<labeltype, tableint>::iterator it = reference.find(key);
+            switch (rng() % 3) {
+                case 0:
+                    map.insert(key, value);
+                    reference[key] = value;
+                    break;
+                case 1: {
+                    tableint previous;
+                    bool found = map.exchange(key, value, previous);
+                    CHECK(found == (it != reference.end()));
+                    CHECK(!found || previous == it->second);
+                    reference[key] = value;
+                    break;
+                }
+                default:
+                    if (it != reference.end() && rng() % 2) {
+                        CHECK(map.erase(key, it->second));
+                        reference.erase(it);
+                    } else {
+                        CHECK(!map.erase(key, it == reference.end() ? value : it->second + 1));
+                    }
+            }
+        }
+        CHECK(map.size() == reference.size());
+        for (labeltype key = 0; key < 5000; key++) {
+            tableint value;
+            std::unordered_map<labeltype, tableint>::iterator it = reference.find(key);
+            CHECK(map.find(key, value) == (it != reference.end()));
+            CHECK(it == reference.end() || value == it->second);
+        }
+        size_t visited = 0;
+        map.forEach([&](labeltype key, tableint &value) {
+            CHECK(reference.count(key) && reference[key] == value);
+            visited++;
+        });
+        CHECK(visited == reference.size());
+    }
+
+    {
+        // reserve keeps the contents and the load below 3/4, a million labels take far less than unordered_map
+        Map map;
+        for (labeltype key = 0; key < 1000; key++)
+            map.insert(key, key);
+        map.reserve(1000000);
+        for (labeltype key = 0; key < 1000; key++)
+            CHECK(contains(map, key, key));
+        for (labeltype key = 1000; key < 1000000; key++)
+            map.insert(key, key);
+        CHECK(map.size() == 1000000);
+        double bytes_per_label = (double) map.allocatedBytes() / map.size();
+        std::printf("%.1f bytes per label\n", bytes_per_label);
+        CHECK(bytes_per_label >= 12 && bytes_per_label < 32);
+    }
+
+    {
+        // four threads insert their own keys, erase every other one and exchange a shared key
+        Map map;
+        size_t num_threads = 4, per_thread = 50000;
+        std::vector<size_t> first_exchanges(num_threads, 0);
+        std::vector<tableint> previous_values(num_threads, (tableint) -1);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < num_threads; t++) {
+            threads.emplace_back([&, t]() {
+                for (size_t i = 0; i < per_thread; i++)
+                    map.insert(t * per_thread + i, t);
+                for (size_t i = 0; i < per_thread; i += 2)
+                    CHECK(map.erase(t * per_thread + i, t));
+                tableint previous;
+                if (!map.exchange(labeltype(-1), t, previous))
+                    first_exchanges[t] = 1;
+                else
+                    previous_values[t] = previous;
+            });
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+        CHECK(map.size() == num_threads * per_thread / 2 + 1);
+        for (size_t t = 0; t < num_threads; t++) {
+            for (size_t i = 0; i < per_thread; i++) {
+                tableint value = 0;
+                CHECK(map.find(t * per_thread + i, value) == (i % 2 == 1));
+                CHECK(i % 2 == 0 || value == t);
+            }
+        }
+        // exactly one exchange found the key missing, the others each got a different earlier value
+        size_t first = 0;
+        std::vector<bool> seen(num_threads, false);
+        for (size_t t = 0; t < num_threads; t++) {
+            first += first_exchanges[t];
+            if (previous_values[t] != (tableint) -1) {
+                CHECK(!seen[previous_values[t]]);
+                seen[previous_values[t]] = true;
+            }
+        }
+        tableint last;
+        CHECK(first == 1 && map.find(labeltype(-1), last) && !seen[last]);
+    }
+
+    {
+        // addPoint from several threads publishes a label only once the vector of its element is stored: a reader
+        // looking the labels up next to the inserts never gets a vector that is zeroed or partly written. Every
+        // element raises the top level, so the inserts queue on the lock of the top level with their vectors not
+        // yet stored
+        size_t dim = 16, n = 400, num_threads = 4;
+        std::vector<float> data = randomVectors(n, dim, 1);
+        L2Space space(dim);
+        HierarchicalNSW<float> index(&space, n, 16, 100);
+        std::atomic<size_t> next(0), seen(0), wrong(0);
+        std::atomic<bool> inserting(true);
+        std::thread reader([&]() {
+            while (inserting) {
+                for (labeltype label = 0; label < n; label++) {
+                    tableint id;
+                    if (!index.label_lookup_.find(label, id))
+                        continue;
+                    seen++;
+                    std::vector<float> stored = index.getDataByLabel<float>(label);
+                    if (!std::equal(stored.begin(), stored.end(), data.data() + label * dim))
+                        wrong++;
+                }
+            }
+        });
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < num_threads; t++) {
+            threads.emplace_back([&]() {
+                size_t i;
+                while ((i = next++) < n)
+                    index.addPoint(data.data() + i * dim, i, 1 + i / 4);
+            });
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+        inserting = false;
+        reader.join();
+        std::printf("labels looked up during addPoint: %zu, with a wrong vector: %zu\n", (size_t) seen, (size_t) wrong);
+        CHECK(wrong == 0);
+        CHECK(index.label_lookup_.size() == n);
+    }
+
+    std::printf("LabelMap test passed\n");
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "test_utils.h"
+#include <algorithm>
+#include <random>
+#include <unordered_set>
+
+using namespace hnswlib;
+
+/*
+ * PQSpace: train, build, search against brute force with and without the exact re-rank, and the same
+ * results from a space whose codebooks went through saveCodebooks and loadCodebooks.
+ */
+
+static const size_t dim = 32;
+static const size_t k = 10;
+
+static double recall(HierarchicalNSW<float> &index, const std::vector<float> &queries, size_t nq,
+                     const std::vector<std::unordered_set<labeltype>> &truth) {
+    size_t found = 0;
+    for (size_t i = 0; i < nq; i++) {
+        std::priority_queue<std::pair<float, labeltype>> result = index.searchKnn(queries.data() + i * dim, k);
+        CHECK(result.size() == k);
+        while (!result.empty()) {
+            found += truth[i].count(result.top().second);
+            result.pop();
+        }
+    }
+    return (double) found / (nq * k);
+}
+
+int main() {
+    size_t n = 5000, nq = 200;
+    std::mt19937 rng(42);
+    std::normal_distribution<float> normal;
+    // clustered data, PQ is meant for data with structure
+    std::vector<float> centers(50 * dim);
+    for (float &x : centers)
+        x = normal(rng) * 3;
+    std::vector<float> data(n * dim), queries(nq * dim);
+    for (size_t i = 0; i < n + nq; i++) {
+        float *v = i < n ? data.data() + i * dim : queries.data() + (i - n) * dim;
+        size_t c = rng() % 50;
+        for (size_t j = 0; j < dim; j++)
+            v[j] = centers[c * dim + j] + normal(rng);
+    }
+
+    L2Space exact(dim);
+    std::vector<std::unordered_set<labeltype>> truth(nq);
+    for (size_t i = 0; i < nq; i++) {
+        std::vector<std::pair<float, labeltype>> distances;
+        for (size_t j = 0; j < n; j++)
+            distances.emplace_back(exact.get_dist_func()(queries.data() + i * dim, data.data() + j * dim, exact.get_dist_func_param()), j);
+        std::partial_sort(distances.begin(), distances.begin() + k, distances.end());
+        for (size_t j = 0; j < k; j++)
+            truth[i].insert(distances[j].second);
+    }
+
+    PQSpace space(dim, 8);
+    CHECK(!space.isTrained());
+    bool threw = false;
+    try {
+        std::vector<unsigned char> code(8);
+        space.encode(data.data(), code.data());
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+    space.train(data.data(), n, 10, 2);
+    CHECK(space.isTrained());
+    CHECK(space.get_data_size() == 8);
+    CHECK(space.get_dim() == dim);
+
+    HierarchicalNSW<float> index(&space, n, 16, 100);
+    index.buildFrom(data.data(), nullptr, n, 2);
+    index.setEf(100);
+    double pq_recall = recall(index, queries, nq, truth);
+
+    // the exact distances of the candidates fix the order of the approximations
+    index.setRerank(data.data(), 50);
+    double rerank_recall = recall(index, queries, nq, truth);
+    std::printf("recall@10 PQ %.3f, re-ranked %.3f\n", pq_recall, rerank_recall);
+    CHECK(pq_recall > 0.4);
+    CHECK(rerank_recall > 0.9);
+    CHECK(rerank_recall > pq_recall);
+
+    // the decoded vector is the closest centroid in every subspace
+    std::vector<float> decoded = index.getDataByLabel<float>(7);
+    CHECK(decoded.size() == dim);
+    float error = exact.get_dist_func()(decoded.data(), data.data() + 7 * dim, exact.get_dist_func_param());
+    CHECK(error < exact.get_dist_func()(centers.data(), data.data() + 7 * dim, exact.get_dist_func_param()));
+
+    // codebooks round trip
+    space.saveCodebooks("pq_codebooks.bin");
+    PQSpace loaded("pq_codebooks.bin");
+    CHECK(loaded.isTrained() && loaded.get_dim() == dim);
+    for (size_t i = 0; i < 100; i++) {
+        unsigned char code1[8], code2[8];
+        space.encode(data.data() + i * dim, code1);
+        loaded.encode(data.data() + i * dim, code2);
+        CHECK(std::equal(code1, code1 + 8, code2));
+    }
+    PQSpace other_shape(dim, 4);
+    threw = false;
+    try {
+        other_shape.loadCodebooks("pq_codebooks.bin");
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    // an index saved with one space and loaded with the reloaded codebooks answers the same
+    index.setRerank(nullptr);
+    index.saveIndex("pq_index.bin");
+    HierarchicalNSW<float> reloaded(&loaded, "pq_index.bin");
+    reloaded.setEf(100);
+    for (size_t i = 0; i < nq; i++) {
+        std::priority_queue<std::pair<float, labeltype>> a = index.searchKnn(queries.data() + i * dim, k);
+        std::priority_queue<std::pair<float, labeltype>> b = reloaded.searchKnn(queries.data() + i * dim, k);
+        CHECK(a.size() == b.size());
+        while (!a.empty()) {
+            CHECK(a.top().second == b.top().second && a.top().first == b.top().first);
+            a.pop();
+            b.pop();
+        }
+    }
+    std::remove("pq_codebooks.bin");
+    std::remove("pq_index.bin");
+    std::printf("PQSpace test passed\n");
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "test_utils.h"
+#include <thread>
+
+using namespace hnswlib;
+
+/*
+ * setReplaceDeleted: inserts take the slots of deleted elements, the index does not grow, the deleted labels
+ * are never returned and both the new and the surviving elements are found.
+ */
+
+static const size_t dim = 16;
+
+static bool searchReturns(const HierarchicalNSW<float> &index, const float *query, labeltype label, size_t k) {
+    std::priority_queue<std::pair<float, labeltype>> result = index.searchKnn(query, k);
+    while (!result.empty()) {
+        if (result.top().second == label)
+            return true;
+        result.pop();
+    }
+    return false;
+}
+
+static size_t deletedCount(const HierarchicalNSW<float> &index) {
+    size_t deleted = 0;
+    for (tableint i = 0; i < index.cur_element_count; i++)
+        deleted += index.isMarkedDeleted(i);
+    return deleted;
+}
+
+int main() {
+    size_t n = 4000;
+    std::vector<float> data = randomVectors(n, dim, 1);
+    std::vector<float> replacements = randomVectors(n, dim, 2);
+
+    L2Space space(dim);
+    HierarchicalNSW<float> index(&space, n, 16, 100);
+    for (size_t i = 0; i < n; i++)
+        index.addPoint(data.data() + i * dim, i);
+    index.setEf(100);
+
+    // elements deleted before replace_deleted is turned on are collected too
+    for (size_t i = 0; i < n / 4; i++)
+        index.markDelete(i);
+    index.setReplaceDeleted(true);
+    CHECK(index.isReplaceDeleted());
+    for (size_t i = n / 4; i < n / 2; i++)
+        index.markDelete(i);
+
+    // half of the slots are reused by new labels, added from several threads
+    size_t num_threads = 4;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = t; i < n / 2; i += num_threads)
+                index.addPoint(replacements.data() + i * dim, n + i);
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    CHECK(index.cur_element_count == n);
+    CHECK(deletedCount(index) == 0);
+
+    // the index is full and no deleted slot is left
+    bool threw = false;
+    try {
+        index.addPoint(replacements.data() + (n / 2) * dim, 2 * n);
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    std::vector<labeltype> new_labels, old_labels;
+    for (size_t i = 0; i < n / 2; i++)
+        new_labels.push_back(n + i);
+    for (size_t i = n / 2; i < n; i++)
+        old_labels.push_back(i);
+    double new_recall = selfRecall(index, replacements.data(), new_labels, dim);
+    double old_recall = selfRecall(index, data.data() + (n / 2) * dim, old_labels, dim);
+    std::printf("self recall: new %.4f, surviving %.4f\n", new_recall, old_recall);
+    CHECK(new_recall > 0.98);
+    CHECK(old_recall > 0.98);
+
+    for (size_t i = 0; i < n / 2; i++) {
+        CHECK(!searchReturns(index, data.data() + i * dim, i, 10));
+        threw = false;
+        try {
+            index.getDataByLabel<float>(i);
+        } catch (const std::runtime_error &) {
+            threw = true;
+        }
+        CHECK(threw);
+        std::vector<float> stored = index.getDataByLabel<float>(n + i);
+        CHECK(std::equal(stored.begin(), stored.end(), replacements.data() + i * dim));
+    }
+
+    // adding an existing label replaces its element, which gives its own slot
+    index.addPoint(data.data(), n + 1);
+    CHECK(index.cur_element_count == n);
+    CHECK(searchReturns(index, data.data(), n + 1, 1));
+    CHECK(!searchReturns(index, replacements.data() + dim, n + 1, 10));
+
+    // without replace_deleted deleted slots stay, the index needs room to grow
+    index.markDelete(n);
+    index.setReplaceDeleted(false);
+    index.resizeIndex(n + 1);
+    index.addPoint(replacements.data(), 3 * n);
+    CHECK(index.cur_element_count == n + 1);
+    CHECK(deletedCount(index) == 1);
+    CHECK(!searchReturns(index, replacements.data(), n, 10));
+    CHECK(searchReturns(index, replacements.data(), 3 * n, 1));
+
+    std::printf("replace_deleted test passed\n");
+    return 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <fstream>
+#include "../../hnswlib/hnswlib.h"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// assert() is compiled out by the -DNDEBUG of the build, the tests check with this instead
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::exit(1); \
+        } \
+    } while (0)
+
+// n uniformly random vectors of dim floats, one after another
+inline std::vector<float> randomVectors(size_t n, size_t dim, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform;
+    std::vector<float> data(n * dim);
+    for (float &x : data)
+        x = uniform(rng);
+    return data;
+}
+
+// share of the vectors i (with label labels[i]) that find themselves as the nearest neighbor
+template<typename Index>
+inline double selfRecall(const Index &index, const float *data, const std::vector<hnswlib::labeltype> &labels,
+                         size_t dim) {
+    size_t found = 0;
+    for (size_t i = 0; i < labels.size(); i++) {
+        std::priority_queue<std::pair<float, hnswlib::labeltype>> result = index.searchKnn(data + i * dim, 1);
+        if (!result.empty() && result.top().second == labels[i])
+            found++;
+    }
+    return labels.empty() ? 1.0 : (double) found / labels.size();
+}
@@ -0,0 +1,98 @@
+#include "test_utils.h"
+#include <algorithm>
+#include <thread>
+
+using namespace hnswlib;
+
+/*
+ * updatePoint: the vectors of a quarter of the index move, a little or to a random new place, from several
+ * threads. The index keeps its size, returns the new vectors and finds the moved elements at their new place.
+ */
+
+static const size_t dim = 16;
+
+int main() {
+    size_t n = 4000, nq = 200, k = 10;
+    std::vector<float> data = randomVectors(n, dim, 1);
+    std::vector<float> noise = randomVectors(n, dim, 2);
+    std::vector<float> moved = randomVectors(n, dim, 3);
+
+    L2Space space(dim);
+    HierarchicalNSW<float> index(&space, n, 16, 100);
+    index.buildFrom(data.data(), nullptr, n, 2);
+    index.setEf(100);
+
+    // labels 0 mod 8 move a little, 4 mod 8 jump to a new random vector
+    std::vector<float> updated = data;
+    std::vector<labeltype> changed;
+    for (size_t i = 0; i < n; i += 4) {
+        for (size_t j = 0; j < dim; j++) {
+            float &x = updated[i * dim + j];
+            x = i % 8 == 0 ? x + (noise[i * dim + j] - 0.5f) * 0.05f : moved[i * dim + j];
+        }
+        changed.push_back(i);
+    }
+    size_t num_threads = 4;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t c = t; c < changed.size(); c += num_threads)
+                index.updatePoint(updated.data() + changed[c] * dim, changed[c]);
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    CHECK(index.cur_element_count == n);
+    CHECK(index.label_lookup_.size() == n);
+    for (tableint i = 0; i < n; i++)
+        CHECK(!index.isMarkedDeleted(i));
+    for (labeltype label : changed) {
+        std::vector<float> stored = index.getDataByLabel<float>(label);
+        CHECK(std::equal(stored.begin(), stored.end(), updated.data() + label * dim));
+    }
+
+    std::vector<labeltype> all(n);
+    for (size_t i = 0; i < n; i++)
+        all[i] = i;
+    double self_recall = selfRecall(index, updated.data(), all, dim);
+
+    // recall@10 of random queries against brute force on the updated vectors
+    std::vector<float> queries = randomVectors(nq, dim, 4);
+    size_t found = 0;
+    for (size_t q = 0; q < nq; q++) {
+        std::vector<std::pair<float, labeltype>> distances;
+        for (size_t i = 0; i < n; i++)
+            distances.emplace_back(L2Sqr(queries.data() + q * dim, updated.data() + i * dim, &dim), i);
+        std::partial_sort(distances.begin(), distances.begin() + k, distances.end());
+        std::priority_queue<std::pair<float, labeltype>> result = index.searchKnn(queries.data() + q * dim, k);
+        while (!result.empty()) {
+            for (size_t j = 0; j < k; j++)
+                found += distances[j].second == result.top().second;
+            result.pop();
+        }
+    }
+    double recall = (double) found / (nq * k);
+    std::printf("self recall %.4f, recall@10 %.4f\n", self_recall, recall);
+    CHECK(self_recall > 0.98);
+    CHECK(recall > 0.95);
+
+    bool threw = false;
+    try {
+        index.updatePoint(updated.data(), n + 1);
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+    index.markDelete(1);
+    threw = false;
+    try {
+        index.updatePoint(updated.data(), 1);
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    std::printf("updatePoint test passed\n");
+    return 0;
+}